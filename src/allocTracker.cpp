@@ -0,0 +1,98 @@
+// allocTracker.cpp
+
+
+#include "headers.h"
+#include "allocTracker.h"
+
+#include <atomic>
+#include <new>
+
+
+#ifdef TRACK_ALLOCS
+
+// Counters are atomic because the ride analysis allocates from
+// several threads.
+
+static std::atomic<unsigned long> allocCount( 0 );
+static std::atomic<unsigned long> allocBytes( 0 );
+
+
+static void *countedAlloc( size_t size )
+
+{
+  allocCount.fetch_add( 1, std::memory_order_relaxed );
+  allocBytes.fetch_add( size, std::memory_order_relaxed );
+
+  void *p = malloc( size > 0 ? size : 1 );
+  if (p == NULL)
+    throw std::bad_alloc();
+
+  return p;
+}
+
+
+void *operator new( size_t size )                  { return countedAlloc( size ); }
+void *operator new[]( size_t size )                { return countedAlloc( size ); }
+void  operator delete( void *p ) noexcept          { free( p ); }
+void  operator delete[]( void *p ) noexcept        { free( p ); }
+void  operator delete( void *p, size_t ) noexcept   { free( p ); }
+void  operator delete[]( void *p, size_t ) noexcept { free( p ); }
+
+void *operator new( size_t size, const std::nothrow_t & ) noexcept
+
+{
+  allocCount.fetch_add( 1, std::memory_order_relaxed );
+  allocBytes.fetch_add( size, std::memory_order_relaxed );
+  return malloc( size > 0 ? size : 1 );
+}
+
+void *operator new[]( size_t size, const std::nothrow_t &nt ) noexcept
+
+{
+  return operator new( size, nt );
+}
+
+void operator delete( void *p, const std::nothrow_t & ) noexcept   { free( p ); }
+void operator delete[]( void *p, const std::nothrow_t & ) noexcept { free( p ); }
+
+
+bool          allocTrackingEnabled() { return true; }
+unsigned long numAllocs()            { return allocCount.load( std::memory_order_relaxed ); }
+unsigned long numAllocBytes()        { return allocBytes.load( std::memory_order_relaxed ); }
+
+#else
+
+bool          allocTrackingEnabled() { return false; }
+unsigned long numAllocs()            { return 0; }
+unsigned long numAllocBytes()        { return 0; }
+
+#endif
+
+
+// Report the allocations made since beginFrame()
+
+bool AllocTracker::endFrame()
+
+{
+  unsigned long allocs = numAllocs() - frameAllocs;
+  unsigned long bytes  = numAllocBytes() - frameBytes;
+
+  bool ok = true;
+
+  if (allocs > 0) {
+
+    bool warmingUp = (frameNum < warmupFrames);
+
+    cerr << "frame " << frameNum << ": " << allocs << " allocations, " << bytes << " bytes"
+         << (warmingUp ? " (warmup)" : "") << endl;
+
+    if (!warmingUp) {
+      numBadFrames++;
+      ok = false;
+    }
+  }
+
+  frameNum++;
+
+  return ok;
+}
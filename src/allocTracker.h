@@ -0,0 +1,71 @@
+/* allocTracker.h
+ *
+ * Count heap allocations made through operator new, to find (and keep
+ * out) allocations in the per-frame loop.
+ *
+ * The counting is only compiled in when TRACK_ALLOCS is defined (add
+ * -DTRACK_ALLOCS to CXXFLAGS in the Makefile).  Otherwise the counts
+ * stay at zero and AllocTracker does nothing.
+ *
+ * Use it around each frame:
+ *
+ *   AllocTracker tracker( warmupFrames );
+ *
+ *   while (...) {
+ *     tracker.beginFrame();
+ *     ... update and draw ...
+ *     tracker.endFrame();
+ *   }
+ *
+ * endFrame() reports any frame that allocates, and returns false if a
+ * frame after the first 'warmupFrames' frames allocated.
+ */
+
+
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+
+#define ALLOC_WARMUP_FRAMES 10  // frames at startup that may allocate (lazy setup, arena growth)
+
+
+bool          allocTrackingEnabled(); // true if compiled with TRACK_ALLOCS
+unsigned long numAllocs();            // operator new calls so far
+unsigned long numAllocBytes();        // bytes requested in those calls
+
+
+class AllocTracker {
+
+  int           warmupFrames;   // frames at startup in which allocation is expected
+  int           frameNum;
+  int           numBadFrames;   // frames after warmup that allocated
+  unsigned long frameAllocs, frameBytes;
+
+ public:
+
+  AllocTracker( int warmup ) {
+    warmupFrames = warmup;
+    frameNum = 0;
+    numBadFrames = 0;
+    frameAllocs = 0;
+    frameBytes = 0;
+  }
+
+  void beginFrame() {
+    frameAllocs = numAllocs();
+    frameBytes = numAllocBytes();
+  }
+
+  bool endFrame();
+
+  int badFrames() {
+    return numBadFrames;
+  }
+
+  int frames() {
+    return frameNum;
+  }
+};
+
+
+#endif
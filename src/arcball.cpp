@@ -56,6 +56,24 @@ mat4 Arcball::VRotationOnly()
 }
 
 
+// V is always rigid (a rotation and translation), so its inverse is
+// cheap.  It's still cached, since picking asks for it on every mouse
+// movement.  V can be set from outside (e.g. when a view is read), so
+// the cache is checked against V itself.
+
+mat4 Arcball::Vinverse()
+
+{
+  if (!haveInvV || invVof != V) {
+    invV = V.inverse( TRANSFORM_RIGID );
+    invVof = V;
+    haveInvV = true;
+  }
+
+  return invV;
+}
+
+
 // Get the eye position
 
 vec3 Arcball::eyePosition()
@@ -26,6 +26,10 @@ class Arcball {
   GLFWwindow *window;
 
   bool doingZRotation;  // true if rotating about viewing z axis
+
+  mat4 invV;          // inverse of V when V was 'invVof'
+  mat4 invVof;
+  bool haveInvV;
   
   vec2 normalizeMousePos( float x, float y );
   void getRotation( vec3 from, vec3 to, float &angle, vec3 &axis );
@@ -37,10 +41,12 @@ class Arcball {
 
   Arcball( GLFWwindow *w ) {
     window = w;
+    haveInvV = false;
   }
   
   Arcball( GLFWwindow *w, vec3 initEyePosition, vec3 initEyeLookat, vec3 initEyeUp ) {
     window = w;
+    haveInvV = false;
     setV( initEyePosition, initEyeLookat, initEyeUp );
   }
 
@@ -52,6 +58,7 @@ class Arcball {
   void centreViewpoint();
 
   mat4 VRotationOnly();
+  mat4 Vinverse();              // view-to-world transform (cached until V changes)
   vec3 eyePosition();
   vec3 upDirection();
   vec3 viewDirection();
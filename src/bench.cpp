@@ -0,0 +1,1167 @@
+// bench.cpp
+
+
+#include "headers.h"
+#include "bench.h"
+#include "spline.h"
+#include "train.h"
+#include "rideAnalysis.h"
+#include "scene.h"
+#include "journal.h"
+#include "frameArena.h"
+#include "allocTracker.h"
+
+#include <chrono>
+#include <thread>
+#include <iomanip>
+#include <vector>
+
+
+// Seconds since some fixed time
+
+static double now()
+
+{
+  return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+
+// Build a closed, hilly test track of 'numPoints' control points on a
+// circle.
+
+static void buildTestTrack( Spline *spline, int numPoints )
+
+{
+  float radius = 10 * numPoints / (2*M_PI);
+
+  for (int i=0; i<numPoints; i++) {
+    float theta = i / (float) numPoints * 2 * M_PI;
+    spline->addPoint( vec3( radius * cos(theta), radius * sin(theta), 50 + 30 * sin(7*theta) ) );
+  }
+}
+
+
+// Time Train::step() in COUPLED_PHYSICS against the number of cars
+
+
+static int benchTrain( int argc, char **argv )
+
+{
+  int numSteps = (argc > 0 ? atoi(argv[0]) : 100000);
+
+  Spline spline;
+  buildTestTrack( &spline, 200 );
+
+  int carCounts[] = { 1, 2, 5, 10, 20, 50, 100 };
+
+  cout << "train step time vs. number of cars (" << numSteps << " steps of " << SUBSTEP << " s)" << endl
+       << setw(8) << "cars" << setw(16) << "us/step" << setw(16) << "ns/car-step" << endl;
+
+  for (unsigned int k=0; k<sizeof(carCounts)/sizeof(carCounts[0]); k++) {
+
+    Train train( &spline );
+
+    while (train.getPhysicsModel() != COUPLED_PHYSICS)
+      train.nextPhysicsModel();
+
+    train.setNumCars( carCounts[k] );
+    train.speedProfile();
+
+    double start = now();
+    for (int i=0; i<numSteps; i++)
+      train.step( SUBSTEP );
+    double elapsed = now() - start;
+
+    cout << setw(8) << carCounts[k]
+         << setw(16) << elapsed / numSteps * 1e6
+         << setw(16) << elapsed / numSteps / carCounts[k] * 1e9
+         << endl;
+  }
+
+  return 0;
+}
+
+
+// Time the ride analysis of a long track against the number of threads
+
+
+static int benchRide( int argc, char **argv )
+
+{
+  int numPoints = (argc > 0 ? atoi(argv[0]) : 2000);
+
+  Spline spline;
+  buildTestTrack( &spline, numPoints );
+
+  SpeedProfile profile;
+  profile.compute( &spline );
+
+  cout << "ride analysis of a " << spline.totalArcLength() << " unit track at "
+       << profile.sampleSpacing() << " unit spacing" << endl
+       << setw(8) << "threads" << setw(16) << "seconds" << endl;
+
+  int maxThreads = std::thread::hardware_concurrency();
+
+  for (int numThreads=1; numThreads<=maxThreads; numThreads*=2) {
+
+    RideAnalysis analysis;
+
+    double start = now();
+    analysis.compute( &spline, &profile, profile.sampleSpacing(), numThreads );
+    double elapsed = now() - start;
+
+    cout << setw(8) << numThreads << setw(16) << elapsed << endl;
+  }
+
+  return 0;
+}
+
+
+// Report the number of track vertices from adaptive tessellation at
+// several tolerances, compared to one vertex per unit of arc length
+// and to SplineSegment::ARC_SAMPLES vertices per segment.
+
+
+static int benchTessellation( int argc, char **argv )
+
+{
+  Spline spline;
+  CtrlPoints ctrlPoints( &spline, NULL );
+  SceneFile file;
+
+  if (argc > 0) {
+    if (!Scene::readTrack( argv[0], &ctrlPoints, file )) {
+      cerr << "Could not open file '" << argv[0] << "'." << endl;
+      return 1;
+    }
+  } else
+    buildTestTrack( &spline, 200 );
+
+  float chordTols[] = { 0.5, 0.2, 0.1, 0.05, 0.02, 0.01 };
+
+  do {
+    cout << spline.name() << ": " << spline.data.size() << " segments, length " << spline.totalArcLength() << endl
+         << "  one vertex per unit length: " << (int) spline.totalArcLength() << endl
+         << "  20 vertices per segment:    " << 20 * spline.data.size() << endl
+         << setw(16) << "chord tol" << setw(16) << "angle tol" << setw(12) << "vertices" << setw(12) << "seconds" << endl;
+
+    for (unsigned int i=0; i<sizeof(chordTols)/sizeof(chordTols[0]); i++) {
+
+      // angle tolerance scaled with chord tolerance, matching the defaults
+
+      float angleTol = DEFAULT_ANGLE_TOLERANCE * sqrt( chordTols[i] / DEFAULT_CHORD_TOLERANCE );
+
+      double start = now();
+      int count = spline.tessellate( chordTols[i], angleTol );
+      double elapsed = now() - start;
+
+      cout << setw(16) << chordTols[i] << setw(16) << angleTol << setw(12) << count << setw(12) << elapsed << endl;
+    }
+
+    spline.nextCOB();
+
+  } while (strcmp( spline.name(), "linear" ) != 0);
+
+  return 0;
+}
+
+
+// Run the simulation and track geometry of the frame loop without a
+// window, and fail if any frame after the warmup allocates.  This
+// needs a build with TRACK_ALLOCS.
+
+
+static int benchAllocs( int argc, char **argv )
+
+{
+  int numFrames = (argc > 0 ? atoi(argv[0]) : 1000);
+
+  if (!allocTrackingEnabled()) {
+    cerr << "allocs needs a build with -DTRACK_ALLOCS" << endl;
+    return 1;
+  }
+
+  Spline spline;
+  buildTestTrack( &spline, 200 );
+
+  Train train( &spline );
+
+  while (train.getPhysicsModel() != COUPLED_PHYSICS)
+    train.nextPhysicsModel();
+
+  train.setNumCars( DEFAULT_NUM_CARS );
+
+  FrameArena arena( 1024 );     // small, so that it has to grow during the warmup
+  AllocTracker tracker( ALLOC_WARMUP_FRAMES );
+
+  for (int i=0; i<numFrames; i++) {
+
+    tracker.beginFrame();
+
+    train.advance( 1/60.0 );
+
+    arena.reset();
+
+    int numPts = spline.tessellate( DEFAULT_CHORD_TOLERANCE, DEFAULT_ANGLE_TOLERANCE );
+    vec3 *pts = arena.alloc<vec3>( numPts );
+    for (int s=0, k=0; s<spline.data.size(); s++)
+      for (int j=0; j<spline.tessSamples(s).size(); j++)
+        pts[k++] = spline.eval( s + spline.tessSamples(s)[j], VALUE );
+
+    tracker.endFrame();
+  }
+
+  int numChecked = numFrames - ALLOC_WARMUP_FRAMES;
+
+  if (tracker.badFrames() > 0) {
+    cerr << tracker.badFrames() << " of " << numChecked << " frames after warmup allocated" << endl;
+    return 1;
+  }
+
+  cout << "no allocations in " << numChecked << " frames after warmup" << endl;
+  return 0;
+}
+
+
+// Editing a track near one place, as when dragging or adding points
+// by hand.  Each edit is followed by what the next frame needs: the
+// arc lengths and the tessellation.  The time per edit should grow
+// only with log(number of points).  For comparison, the same edits
+// are timed with every segment resampled after each edit.
+//
+// The first edit at the cursor moves the gap buffers' gaps there from
+// the end, which is O(n), so it's made before the timing starts.
+//
+// The edited spline must then have the same arc lengths, to the bit,
+// as one built from its points in order, as a replay would build it.
+
+
+static int benchEditing( int argc, char **argv )
+
+{
+  int maxPoints = (argc > 0 ? atoi(argv[0]) : 100000);
+  int numEdits = 90;
+
+  cout << setw(10) << "points" << setw(20) << "us/edit" << setw(20) << "resample all" << endl;
+
+  for (int numPoints=1000; numPoints<=maxPoints; numPoints*=10) {
+
+    double times[2];
+
+    for (int all=0; all<2; all++) {
+
+      Spline spline;
+      CtrlPoints cp( &spline, NULL );
+
+      float radius = 10 * numPoints / (2*M_PI);
+
+      for (int i=0; i<numPoints; i++) {
+        float theta = i / (float) numPoints * 2 * M_PI;
+        cp.addPointWithHeight( vec3( radius * cos(theta), radius * sin(theta), 0 ), 50 + 30 * sin(7*theta) );
+      }
+
+      int cursor = numPoints / 2;
+
+      cp.addPoint( 0.5 * (cp.base(cursor) + cp.base(cursor+1)) );
+      cp.deletePoint( cursor+1 );
+
+      spline.totalArcLength();
+      spline.tessellate( DEFAULT_CHORD_TOLERANCE, DEFAULT_ANGLE_TOLERANCE );
+
+      double start = now();
+
+      for (int i=0; i<numEdits; i++) {
+
+        switch (i % 3) {
+        case 0: cp.addPoint( 0.5 * (cp.base(cursor) + cp.base(cursor+1)) ); break; // inserted after the cursor
+        case 1: cp.moveBase( cursor, cp.base(cursor) + vec3( 1, 1, 0 ) ); break;
+        case 2: cp.deletePoint( cursor ); break;
+        }
+
+        if (all)
+          spline.segmentsChanged( 0, spline.data.size()-1 );
+
+        spline.totalArcLength();
+        spline.tessellate( DEFAULT_CHORD_TOLERANCE, DEFAULT_ANGLE_TOLERANCE );
+      }
+
+      times[all] = (now() - start) / numEdits;
+
+      Spline fresh;
+      for (int i=0; i<spline.data.size(); i++)
+        fresh.addPoint( spline.data[i] );
+
+      float len = fresh.totalArcLength();
+
+      if (fresh.totalArcLength() != spline.totalArcLength() ||
+          fresh.paramAtArcLength( 0.37 * len ) != spline.paramAtArcLength( 0.37 * len )) {
+        cerr << "arc lengths after editing differ from those of the same points added in order" << endl;
+        return 1;
+      }
+    }
+
+    cout << setw(10) << numPoints << setw(20) << times[0] * 1e6 << setw(20) << times[1] * 1e6 << endl;
+  }
+
+  return 0;
+}
+
+
+// mat4 products with SSE against the scalar versions.  The results
+// must be identical to the bit.
+
+
+static float randomFloat()
+
+{
+  return (rand() / (float) RAND_MAX) * 200 - 100;
+}
+
+
+static mat4 randomMatrix()
+
+{
+  switch (rand() % 3) {
+  case 0:
+    return translate( randomFloat(), randomFloat(), randomFloat() ) * rotate( randomFloat(), vec3( randomFloat(), randomFloat(), randomFloat() ) ) * scale( 2, 3, 4 );
+  case 1:
+    return perspective( 0.1 + rand() % 100 / 100.0, 1.5, 1, 1000 ) * translate( randomFloat(), randomFloat(), randomFloat() );
+  default: {
+    mat4 M;
+    for (int i=0; i<4; i++)
+      M.rows[i] = vec4( randomFloat(), randomFloat(), randomFloat(), randomFloat() );
+    return M;
+  }
+  }
+}
+
+
+static int benchLinalg( int argc, char **argv )
+
+{
+  int n = (argc > 0 ? atoi(argv[0]) : 1000000);
+
+#ifdef LINALG_SSE
+  cout << "mat4 operations with SSE vs. scalar, " << n << " of each" << endl;
+#else
+  cout << "mat4 operations without SSE (LINALG_NO_SIMD or no SSE target), " << n << " of each" << endl;
+#endif
+
+  // Check
+
+  int mismatches = 0;
+
+  for (int i=0; i<10000; i++) {
+
+    mat4 A = randomMatrix();
+    mat4 B = randomMatrix();
+    vec4 v( randomFloat(), randomFloat(), randomFloat(), (i % 2 == 0 ? 1 : randomFloat()) );
+
+    mat4 AB  = A * B;
+    mat4 ABs = mulScalar( A, B );
+    vec4 Av  = A * v;
+    vec4 Avs = mulScalar( A, v );
+
+    vec3 p[2], ps[2];
+    p[0] = ps[0] = vec3( randomFloat(), randomFloat(), randomFloat() );
+    p[1] = ps[1] = vec3( 0, 0, 0 );
+    transformPoints( A, p, 2 );
+    transformPointsScalar( A, ps, 2 );
+
+    if (memcmp( &AB, &ABs, sizeof(mat4) ) != 0 ||
+        memcmp( &Av, &Avs, sizeof(vec4) ) != 0 ||
+        memcmp( p, ps, sizeof(p) ) != 0)
+      mismatches++;
+  }
+
+  // Rotations built at compile time agree with rotate()
+
+  static constexpr mat4 constR = constRotate( 1.5, vec3(1,0,0) );
+
+  float maxRotDiff = 0;
+
+  for (int i=0; i<1000; i++) {
+    float theta = (i == 0 ? 1.5 : 20 * randomFloat());
+    vec3 axis = (i == 0 ? vec3(1,0,0) : vec3( randomFloat(), randomFloat(), randomFloat() ).normalize());
+    mat4 R = rotate( theta, axis );
+    mat4 C = (i == 0 ? constR : constRotate( theta, axis ));
+    for (int r=0; r<4; r++)
+      for (int k=0; k<4; k++)
+        maxRotDiff = fmax( maxRotDiff, fabs( R[r][k] - C[r][k] ) );
+  }
+
+  if (maxRotDiff > 1e-6) {
+    cerr << "constRotate() differs from rotate() by " << maxRotDiff << endl;
+    mismatches++;
+  }
+
+  // Time
+
+  int numMatrices = 1024;       // reused, so that they stay in cache
+  mat4 *mats = new mat4[ numMatrices ];
+  vec4 *vecs = new vec4[ numMatrices ];
+  for (int i=0; i<numMatrices; i++) {
+    mats[i] = randomMatrix();
+    vecs[i] = vec4( randomFloat(), randomFloat(), randomFloat(), 1 );
+  }
+
+  vec3 *pts = new vec3[ n ];
+  for (int i=0; i<n; i++)
+    pts[i] = vec3( randomFloat(), randomFloat(), randomFloat() );
+
+  volatile float sink = 0;
+  double start, simdTime, scalarTime;
+
+  cout << setw(24) << "" << setw(12) << "ns" << setw(12) << "scalar ns" << endl;
+
+  mat4 acc = identity4();
+  start = now();
+  for (int i=0; i<n; i++)
+    acc = mats[ i & (numMatrices-1) ] * mats[ (i+1) & (numMatrices-1) ];
+  simdTime = now() - start;
+  sink = sink + acc.rows[0].x;
+
+  start = now();
+  for (int i=0; i<n; i++)
+    acc = mulScalar( mats[ i & (numMatrices-1) ], mats[ (i+1) & (numMatrices-1) ] );
+  scalarTime = now() - start;
+  sink = sink + acc.rows[0].x;
+
+  cout << setw(24) << "mat4 * mat4" << setw(12) << simdTime / n * 1e9 << setw(12) << scalarTime / n * 1e9 << endl;
+
+  vec4 sum( 0, 0, 0, 0 );
+  start = now();
+  for (int i=0; i<n; i++)
+    sum = sum + mats[ i & (numMatrices-1) ] * vecs[ (i+1) & (numMatrices-1) ];
+  simdTime = now() - start;
+  sink = sink + sum.x;
+
+  start = now();
+  for (int i=0; i<n; i++)
+    sum = sum + mulScalar( mats[ i & (numMatrices-1) ], vecs[ (i+1) & (numMatrices-1) ] );
+  scalarTime = now() - start;
+  sink = sink + sum.x;
+
+  cout << setw(24) << "mat4 * vec4" << setw(12) << simdTime / n * 1e9 << setw(12) << scalarTime / n * 1e9 << endl;
+
+  start = now();
+  transformPoints( mats[0], pts, n );
+  simdTime = now() - start;
+
+  start = now();
+  transformPointsScalar( mats[0], pts, n );
+  scalarTime = now() - start;
+  sink = sink + pts[0].x;
+
+  cout << setw(24) << "transformPoints (each)" << setw(12) << simdTime / n * 1e9 << setw(12) << scalarTime / n * 1e9 << endl;
+
+  delete [] mats;
+  delete [] vecs;
+  delete [] pts;
+
+  if (mismatches > 0) {
+    cerr << mismatches << " checks differ from the scalar versions" << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+// Inverses of each kind of transformation, with the fast path for
+// that kind and with the general 4x4 inverse.  Each fast inverse must
+// agree with the general one.
+
+
+static mat4 randomOfClass( TransformClass type )
+
+{
+  vec3 t( randomFloat(), randomFloat(), randomFloat() );
+  vec3 axis( randomFloat(), randomFloat(), randomFloat() );
+
+  switch (type) {
+  case TRANSFORM_TRANSLATION: return translate( t );
+  case TRANSFORM_RIGID:       return translate( t ) * rotate( randomFloat(), axis );
+  case TRANSFORM_AFFINE:      return translate( t ) * rotate( randomFloat(), axis ) * scale( 0.5 + rand() % 100 / 50.0, 2, 3 );
+  default:                    return perspective( 0.5, 1.5, 1, 1000 ) * translate( t ) * rotate( randomFloat(), axis );
+  }
+}
+
+
+static int benchInverse( int argc, char **argv )
+
+{
+  int n = (argc > 0 ? atoi(argv[0]) : 1000000);
+
+  const char *names[] = { "translation", "rigid", "affine", "projective" };
+
+  int failures = 0;
+
+  // classify()
+
+  if (translate( 1, 2, 3 ).classify() != TRANSFORM_TRANSLATION ||
+      (translate( 1, 2, 3 ) * scale( 1, 2, 1 )).classify() != TRANSFORM_AFFINE ||
+      perspective( 0.5, 1, 1, 10 ).classify() != TRANSFORM_PROJECTIVE) {
+    cerr << "transformations are classified wrongly" << endl;
+    failures++;
+  }
+
+  int numMatrices = 1024;
+  mat4 *mats = new mat4[ numMatrices ];
+
+  cout << setw(14) << "" << setw(12) << "fast ns" << setw(12) << "general ns" << setw(14) << "max diff" << endl;
+
+  for (int c=TRANSFORM_TRANSLATION; c<=TRANSFORM_PROJECTIVE; c++) {
+
+    TransformClass type = (TransformClass) c;
+
+    for (int i=0; i<numMatrices; i++)
+      mats[i] = randomOfClass( type );
+
+    // Largest difference between the two inverses, relative to the
+    // largest entry of the general inverse
+
+    float maxDiff = 0;
+
+    for (int i=0; i<numMatrices; i++) {
+      mat4 fast = mats[i].inverse( type );
+      mat4 general = mats[i].inverse( TRANSFORM_PROJECTIVE );
+      float maxEntry = 0, diff = 0;
+      for (int r=0; r<4; r++)
+        for (int k=0; k<4; k++) {
+          maxEntry = fmax( maxEntry, fabs( general[r][k] ) );
+          diff = fmax( diff, fabs( fast[r][k] - general[r][k] ) );
+        }
+      maxDiff = fmax( maxDiff, diff / maxEntry );
+    }
+
+    if (maxDiff > 1e-4) {
+      cerr << names[c] << " inverse differs from the general inverse by " << maxDiff << endl;
+      failures++;
+    }
+
+    volatile float sink = 0;
+
+    double start = now();
+    for (int i=0; i<n; i++)
+      sink = sink + mats[ i & (numMatrices-1) ].inverse( type ).rows[0].w;
+    double fastTime = now() - start;
+
+    start = now();
+    for (int i=0; i<n; i++)
+      sink = sink + mats[ i & (numMatrices-1) ].inverse( TRANSFORM_PROJECTIVE ).rows[0].w;
+    double generalTime = now() - start;
+
+    cout << setw(14) << names[c] << setw(12) << fastTime / n * 1e9 << setw(12) << generalTime / n * 1e9 << setw(14) << maxDiff << endl;
+  }
+
+  delete [] mats;
+
+  return (failures > 0 ? 1 : 0);
+}
+
+
+// seq<T> against std::vector<T> for the operations used in the hot
+// paths: appending, indexing, reusing cleared storage, and growing a
+// sequence of sequences (which moves the inner sequences).  With
+// NDEBUG undefined, seq's operator [] includes its bounds check.
+
+
+static void printSeqRow( const char *name, double seqTime, double vecTime, int n )
+
+{
+  cout << "  " << left << setw(28) << name << right
+       << setw(10) << seqTime / n * 1e9 << setw(12) << vecTime / n * 1e9 << endl;
+}
+
+
+static int benchSeq( int argc, char **argv )
+
+{
+  int n = (argc > 0 ? atoi(argv[0]) : 1000000);
+  int reps = 10;
+
+  volatile float sink = 0;
+  double start, seqTime, vecTime;
+
+  cout << "seq<T> vs. std::vector<T>, " << n << " elements, " << reps << " repetitions"
+#ifdef NDEBUG
+       << " (no bounds checks)"
+#else
+       << " (with bounds checks)"
+#endif
+       << endl
+       << "  " << left << setw(28) << "" << right << setw(10) << "seq ns" << setw(12) << "vector ns" << endl;
+
+  // add / push_back from empty
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    seq<vec3> s;
+    for (int i=0; i<n; i++)
+      s.add( vec3( i, i, i ) );
+    sink = sink + s[n-1].x;
+  }
+  seqTime = now() - start;
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    std::vector<vec3> v;
+    for (int i=0; i<n; i++)
+      v.push_back( vec3( i, i, i ) );
+    sink = sink + v[n-1].x;
+  }
+  vecTime = now() - start;
+
+  printSeqRow( "add", seqTime, vecTime, n*reps );
+
+  // add after reserve
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    seq<vec3> s;
+    s.reserve( n );
+    for (int i=0; i<n; i++)
+      s.add( vec3( i, i, i ) );
+    sink = sink + s[n-1].x;
+  }
+  seqTime = now() - start;
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    std::vector<vec3> v;
+    v.reserve( n );
+    for (int i=0; i<n; i++)
+      v.push_back( vec3( i, i, i ) );
+    sink = sink + v[n-1].x;
+  }
+  vecTime = now() - start;
+
+  printSeqRow( "add after reserve", seqTime, vecTime, n*reps );
+
+  // Indexed reads
+
+  seq<float> s( n );
+  std::vector<float> v;
+  v.reserve( n );
+  for (int i=0; i<n; i++) {
+    s.add( i % 100 );
+    v.push_back( i % 100 );
+  }
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    float sum = 0;
+    for (int i=0; i<s.size(); i++)
+      sum += s[i];
+    sink = sink + sum;
+  }
+  seqTime = now() - start;
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    float sum = 0;
+    for (unsigned int i=0; i<v.size(); i++)
+      sum += v[i];
+    sink = sink + sum;
+  }
+  vecTime = now() - start;
+
+  printSeqRow( "sum with []", seqTime, vecTime, n*reps );
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    float sum = 0;
+    const float *p = s.data();
+    for (int i=0; i<s.size(); i++)
+      sum += p[i];
+    sink = sink + sum;
+  }
+  seqTime = now() - start;
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    float sum = 0;
+    const float *p = v.data();
+    for (unsigned int i=0; i<v.size(); i++)
+      sum += p[i];
+    sink = sink + sum;
+  }
+  vecTime = now() - start;
+
+  printSeqRow( "sum with data()", seqTime, vecTime, n*reps );
+
+  // clear() and refill, which reuses the storage
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    s.clear();
+    for (int i=0; i<n; i++)
+      s.add( i );
+  }
+  seqTime = now() - start;
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    v.clear();
+    for (int i=0; i<n; i++)
+      v.push_back( i );
+  }
+  vecTime = now() - start;
+
+  printSeqRow( "clear and refill", seqTime, vecTime, n*reps );
+
+  // Growing a sequence of sequences moves the inner sequences
+
+  int numInner = n / 10;
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    seq< seq<int> > ss;
+    for (int i=0; i<numInner; i++) {
+      seq<int> inner( 10 );
+      for (int j=0; j<10; j++)
+        inner.add( j );
+      ss.add( std::move( inner ) );
+    }
+    sink = sink + ss[numInner-1][9];
+  }
+  seqTime = now() - start;
+
+  start = now();
+  for (int r=0; r<reps; r++) {
+    std::vector< std::vector<int> > vv;
+    for (int i=0; i<numInner; i++) {
+      std::vector<int> inner;
+      inner.reserve( 10 );
+      for (int j=0; j<10; j++)
+        inner.push_back( j );
+      vv.push_back( std::move( inner ) );
+    }
+    sink = sink + vv[numInner-1][9];
+  }
+  vecTime = now() - start;
+
+  printSeqRow( "add 10-element sequence", seqTime, vecTime, numInner*reps );
+
+  return 0;
+}
+
+
+// Control point picking and insertion with the grid, compared to
+// testing every point (as before the grid).  The results must agree.
+
+
+static int bruteSelectedPoint( CtrlPoints &cp, vec3 start, vec3 dir, mat4 &M )
+
+{
+  int   minIndex = -1;
+  float minZDist = MAXFLOAT;
+
+  for (int i=0; i<cp.count(); i++)
+    for (int k=0; k<2; k++) {
+      vec3 p = (M * vec4( (k == 0 ? cp.base(i) : cp.top(i)), 1 )).toVec3();
+      if (p.distanceToLine( start, dir ) < 4.0) { // POINT_RADIUS
+        float zdist = (p - start)*dir;
+        if (zdist < minZDist) {
+          minZDist = zdist;
+          minIndex = 2*i + k;
+        }
+      }
+    }
+
+  return minIndex;
+}
+
+
+static int bruteClosestEdge( CtrlPoints &cp, vec3 pt )
+
+{
+  float minDist = MAXFLOAT;
+  int edgeIndex = -1;
+
+  for (int i=0; i<cp.count(); i++) {
+    vec3 a = cp.base(i);
+    vec3 b = cp.base( (i+1) % cp.count() );
+    vec3 u = pt - a;
+    vec3 v = (b - a).normalize();
+    float t = u*v;
+    if (t >= 0 && t <= (b-a).length()) {
+      float dist = (u - t*v).squaredLength();
+      if (dist < minDist) {
+        minDist = dist;
+        edgeIndex = i;
+      }
+    }
+  }
+
+  return edgeIndex;
+}
+
+
+static int benchPicking( int argc, char **argv )
+
+{
+  int numPoints  = (argc > 0 ? atoi(argv[0]) : 100000);
+  int numQueries = 1000;
+
+  Spline spline;
+  CtrlPoints cp( &spline, NULL );
+
+  // A wandering track, so that the points don't all lie on one line
+
+  srand( 1 );
+
+  double start = now();
+
+  vec3 p( 0, 0, 0 );
+  float heading = 0;
+
+  for (int i=0; i<numPoints; i++) {
+    heading += (randIn01() - 0.5) * 0.5;
+    p = p + vec3( 10 * cos(heading), 10 * sin(heading), 0 );
+    p.z = 20 * randIn01();
+    cp.addPointWithHeight( p, 30 + 20 * randIn01() );
+  }
+
+  double buildTime = now() - start;
+
+  mat4 M = translate( -100, -200, 0 );
+
+  // Picking: rays from above and to the side toward random posts
+
+  vec3 *rayStarts = new vec3[ numQueries ];
+  vec3 *rayDirs   = new vec3[ numQueries ];
+
+  for (int i=0; i<numQueries; i++) {
+    int k = rand() % numPoints;
+    vec3 target = (M * vec4( (i % 2 == 0 ? cp.base(k) : cp.top(k)), 1 )).toVec3() + vec3( 6*randIn01()-3, 6*randIn01()-3, 0 );
+    rayStarts[i] = target + vec3( 300 * randIn01() - 150, -300, 200 );
+    rayDirs[i] = (target - rayStarts[i]).normalize();
+  }
+
+  int mismatches = 0, hits = 0;
+
+  start = now();
+  for (int i=0; i<numQueries; i++)
+    if (cp.findSelectedPoint( rayStarts[i], rayDirs[i], M ) >= 0)
+      hits++;
+  double gridPick = now() - start;
+
+  start = now();
+  for (int i=0; i<numQueries; i++)
+    bruteSelectedPoint( cp, rayStarts[i], rayDirs[i], M );
+  double brutePick = now() - start;
+
+  for (int i=0; i<numQueries; i++)
+    if (cp.findSelectedPoint( rayStarts[i], rayDirs[i], M ) != bruteSelectedPoint( cp, rayStarts[i], rayDirs[i], M ))
+      mismatches++;
+
+  // Closest edges for points near the track
+
+  vec3 *pts = new vec3[ numQueries ];
+
+  for (int i=0; i<numQueries; i++)
+    pts[i] = cp.base( rand() % numPoints ) + vec3( 40*randIn01()-20, 40*randIn01()-20, 0 );
+
+  start = now();
+  for (int i=0; i<numQueries; i++)
+    cp.closestEdge( pts[i] );
+  double gridEdge = now() - start;
+
+  start = now();
+  for (int i=0; i<numQueries; i++)
+    bruteClosestEdge( cp, pts[i] );
+  double bruteEdge = now() - start;
+
+  for (int i=0; i<numQueries; i++)
+    if (cp.closestEdge( pts[i] ) != bruteClosestEdge( cp, pts[i] ))
+      mismatches++;
+
+  // Edits, which update the grids
+
+  start = now();
+  for (int i=0; i<numQueries; i++) {
+    int k = rand() % cp.count();
+    cp.moveBase( k, cp.base(k) + vec3( 5, 5, 0 ) );
+  }
+  double moveTime = now() - start;
+
+  // Each of these is at a random place, so moves the gaps in the
+  // points and the spline by n/3 on average
+
+  start = now();
+  for (int i=0; i<numQueries; i++)
+    cp.addPoint( pts[i] );
+  for (int i=0; i<numQueries; i++)
+    cp.deletePoint( rand() % cp.count() );
+  double addDeleteTime = now() - start;
+
+  for (int i=0; i<numQueries; i++)
+    if (cp.closestEdge( pts[i] ) != bruteClosestEdge( cp, pts[i] ))
+      mismatches++;
+
+  cout << numPoints << " control points, " << numQueries << " queries of each kind" << endl
+       << "  build                " << setw(10) << buildTime * 1e3 << " ms" << endl
+       << "  pick (grid)          " << setw(10) << gridPick / numQueries * 1e6 << " us/query  (" << hits << " hits)" << endl
+       << "  pick (all points)    " << setw(10) << brutePick / numQueries * 1e6 << " us/query" << endl
+       << "  closest edge (grid)  " << setw(10) << gridEdge / numQueries * 1e6 << " us/query" << endl
+       << "  closest edge (all)   " << setw(10) << bruteEdge / numQueries * 1e6 << " us/query" << endl
+       << "  moveBase             " << setw(10) << moveTime / numQueries * 1e6 << " us" << endl
+       << "  addPoint+deletePoint " << setw(10) << addDeleteTime / numQueries * 1e6 << " us  (at random places)" << endl;
+
+  delete [] rayStarts;
+  delete [] rayDirs;
+  delete [] pts;
+
+  if (mismatches > 0) {
+    cerr << mismatches << " queries gave different results with the grid" << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+// Save and load a scene as text and as binary.  "load" includes
+// adding the points to a CtrlPoints.  Both formats must read back the
+// exact points.
+
+
+static int benchScene( int argc, char **argv )
+
+{
+  int numPoints = (argc > 0 ? atoi(argv[0]) : 1000000);
+
+  const char *filenames[2] = { "bench-scene.txt", "bench-scene.bin" };
+
+  // A hilly track on a circle
+
+  Spline spline;
+  CtrlPoints cp( &spline, NULL );
+
+  float radius = 10 * numPoints / (2*M_PI);
+
+  for (int i=0; i<numPoints; i++) {
+    float theta = i / (float) numPoints * 2 * M_PI;
+    cp.addPointWithHeight( vec3( radius * cos(theta), radius * sin(theta), 5 * sin(3*theta) ), 50 + 30 * sin(7*theta) );
+  }
+
+  SceneFile out;
+  out.hasTerrain = true;
+  out.heightfieldName = "hills-heights.png";
+  out.textureName = "hills-texture.png";
+  out.heightScale = 123.456789;  // more digits than ostream writes by default
+  out.friction = 0.0123456789;
+  out.drag = 1 / 3.0;
+
+  int mismatches = 0;
+
+  cout << numPoints << " control points" << endl
+       << "  " << setw(8) << "" << setw(10) << "MB" << setw(12) << "save ms" << setw(12) << "read ms" << setw(12) << "load ms" << endl;
+
+  for (int binary=0; binary<2; binary++) {
+
+    double start = now();
+    if (!Scene::writeTrack( out, &cp, filenames[binary], binary )) {
+      cerr << "Could not write '" << filenames[binary] << "'." << endl;
+      return 1;
+    }
+    double saveTime = now() - start;
+
+    ifstream f( filenames[binary], ios::binary | ios::ate );
+    double size = f.tellg();
+
+    Spline spline2;
+    CtrlPoints cp2( &spline2, NULL );
+    SceneFile in;
+
+    start = now();
+    in.read( filenames[binary] );
+    double readTime = now() - start;
+    cp2.addPointsWithHeights( in.points, in.numPoints );
+    double loadTime = now() - start;
+
+    if (cp2.count() != cp.count() || in.heightfieldName != out.heightfieldName || in.textureName != out.textureName ||
+        in.heightScale != out.heightScale || in.friction != out.friction || in.drag != out.drag)
+      mismatches++;
+    else
+      for (int i=0; i<cp.count(); i++)
+        if (cp2.base(i) != cp.base(i) || cp2.top(i) != cp.top(i))
+          mismatches++;
+
+    cout << "  " << setw(8) << (binary ? "binary" : "text") << setw(10) << size / (1024*1024)
+         << setw(12) << saveTime * 1e3 << setw(12) << readTime * 1e3 << setw(12) << loadTime * 1e3 << endl;
+
+    remove( filenames[binary] );
+  }
+
+  if (mismatches > 0) {
+    cerr << mismatches << " points read back differently" << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+// The time on the editing thread to save a track edit: storing the
+// whole scene against appending the edit to the journal.  Halfway
+// through, the journal is compacted (which the writer thread does
+// from its own copy of the points).  The track is then read back from
+// the scene file and the journal, as after a crash, and must be the
+// same as the edited one.
+
+
+static int benchJournal( int argc, char **argv )
+
+{
+  int numPoints = (argc > 0 ? atoi(argv[0]) : 100000);
+  int numEdits = 4000;
+
+  const char *filename = "bench-journal.bin";
+  string journalFilename = string( filename ) + string( ".journal" );
+
+  Spline spline;
+  CtrlPoints cp( &spline, NULL );
+
+  float radius = 10 * numPoints / (2*M_PI);
+
+  for (int i=0; i<numPoints; i++) {
+    float theta = i / (float) numPoints * 2 * M_PI;
+    cp.addPointWithHeight( vec3( radius * cos(theta), radius * sin(theta), 0 ), 50 + 30 * sin(7*theta) );
+  }
+
+  remove( journalFilename.c_str() );
+
+  SceneFile out;
+
+  double start = now();
+  if (!Scene::writeTrack( out, &cp, filename, true )) {
+    cerr << "Could not write '" << filename << "'." << endl;
+    return 1;
+  }
+  double saveTime = now() - start;
+
+  // Edits near the middle of the track, saved to the journal
+
+  double appendTime = 0, maxAppendTime = 0, compactTime = 0;
+
+  {
+    SceneFile in;
+    in.read( filename );
+
+    SceneJournal journal;
+    journal.open( filename, in, &cp );
+
+    int cursor = numPoints / 2;
+
+    for (int i=0; i<numEdits; i++) {
+
+      InputEvent e;
+
+      switch (i % 4) {
+      case 0: e = InputEvent( INPUT_ADD_POINT, 0, 0.5 * (cp.base(cursor) + cp.base(cursor+1)) ); break;
+      case 1: e = InputEvent( INPUT_MOVE_BASE, cursor+1, cp.base(cursor+1) + vec3( 1, 1, 0 ) ); break;
+      case 2: e = InputEvent( INPUT_SET_HEIGHT, cursor, vec3( 0, 0, 40 + i % 20 ) ); break;
+      case 3: e = InputEvent( INPUT_DELETE_POINT, cursor+2, vec3( 0, 0, 0 ) ); break;
+      }
+
+      applyInputEvent( e, &cp, NULL );
+
+      start = now();
+      journal.append( e );
+      double t = now() - start;
+
+      appendTime += t;
+      if (t > maxAppendTime)
+        maxAppendTime = t;
+
+      if (i == numEdits/2 - 1) {
+        start = now();
+        journal.compact( false );
+        compactTime = now() - start;
+      }
+    }
+
+  } // stops the writer without storing the scene, as if the program stopped here
+
+  // Read it back
+
+  Spline spline2;
+  CtrlPoints cp2( &spline2, NULL );
+  int numReplayed;
+
+  {
+    SceneFile in;
+    in.read( filename );
+    cp2.addPointsWithHeights( in.points, in.numPoints );
+
+    SceneJournal journal;
+    numReplayed = journal.open( filename, in, &cp2 );
+  }
+
+  int mismatches = 0;
+
+  if (cp2.count() != cp.count())
+    mismatches++;
+  else
+    for (int i=0; i<cp.count(); i++)
+      if (cp2.base(i) != cp.base(i) || cp2.top(i) != cp.top(i))
+        mismatches++;
+
+  cout << numPoints << " control points, " << numEdits << " edits" << endl
+       << "  store the scene      " << setw(10) << saveTime * 1e3 << " ms" << endl
+       << "  append to journal    " << setw(10) << appendTime / numEdits * 1e6 << " us/edit (max "
+       << maxAppendTime * 1e6 << " us)" << endl
+       << "  request compaction   " << setw(10) << compactTime * 1e6 << " us" << endl;
+
+  remove( filename );
+  remove( journalFilename.c_str() );
+
+  if (numReplayed != numEdits - numEdits/2 || mismatches > 0) {
+    cerr << numReplayed << " edits replayed, and " << mismatches << " points differ" << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+// Table of benchmarks
+
+
+static struct {
+  const char *name;
+  int (*run)( int argc, char **argv );
+  const char *description;
+} benchmarks[] = {
+  { "train", benchTrain, "[steps]  coupled train step time vs. number of cars" },
+  { "ride",  benchRide,  "[points] ride analysis time vs. number of threads" },
+  { "tess",  benchTessellation, "[scene]  track vertex counts at several tessellation tolerances" },
+  { "pick",  benchPicking, "[points] control point picking and insertion, grid vs. all points" },
+  { "edit",  benchEditing, "[points] time per track edit near one point vs. number of points" },
+  { "linalg", benchLinalg, "[n]      mat4 products with SSE vs. scalar (and check they agree)" },
+  { "inverse", benchInverse, "[n]     mat4 inverse for each kind of transformation vs. the general inverse" },
+  { "seq",   benchSeq,   "[elements] seq<T> vs. std::vector<T>" },
+  { "scene", benchScene, "[points] scene file save and load, text vs. binary" },
+  { "journal", benchJournal, "[points] cost of saving an edit, whole scene vs. journal (and check the replay)" },
+  { "allocs", benchAllocs, "[frames] fail if the headless frame loop allocates (needs TRACK_ALLOCS)" },
+  { NULL, NULL, NULL }
+};
+
+
+int runBenchmark( int argc, char **argv )
+
+{
+  if (argc > 0)
+    for (int i=0; benchmarks[i].name != NULL; i++)
+      if (strcmp( argv[0], benchmarks[i].name ) == 0)
+        return benchmarks[i].run( argc-1, argv+1 );
+
+  cerr << "Benchmarks:" << endl;
+  for (int i=0; benchmarks[i].name != NULL; i++)
+    cerr << "  " << benchmarks[i].name << " " << benchmarks[i].description << endl;
+
+  return 1;
+}
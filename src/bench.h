@@ -0,0 +1,15 @@
+// bench.h
+//
+// Benchmarks that run without opening a window.  Run them as
+//
+//   ./roller -bench name [args]
+//
+// and run './roller -bench' to list them.
+
+
+#ifndef BENCH_H
+#define BENCH_H
+
+int runBenchmark( int argc, char **argv );
+
+#endif
@@ -2,26 +2,37 @@
 
 #include "ctrlPoints.h"
 #include "main.h"
+#include "profiler.h"
 
 
 #define POST_RADIUS 2.0
 #define POINT_RADIUS 4.0
 #define INITIAL_VERTICAL_OFFSET vec3(0,0,30)
+#define MIN(a,b)  ((a)<(b)?(a):(b))
 #define MAX(a,b)  ((a)>(b)?(a):(b))
 
 
+// Moves the cylinder model from z in [-0.5,0.5] to z in [0,1]
+
+static constexpr mat4 POST_OFFSET = translate( 0, 0, 0.5 );
+
+
 void CtrlPoints::draw( bool drawPostsOnly, mat4 &WCStoVCS, mat4 &WCStoCCS, vec3 lightDir, vec3 colour )
 
 {
+  PROFILE_GPU_SCOPE( "CtrlPoints::draw" );
+
   mat4 M, MV, MVP;
   
-  for (int i=0; i<points.size(); i++) {
+  for (int i=0; i<pts.size(); i++) {
+
+    CtrlPoint &p = pts[i];
 
     if (!drawPostsOnly) {
 
       // draw base
 
-      M   = translate( bases[i] ) * scale( POINT_RADIUS, POINT_RADIUS, POINT_RADIUS );
+      M   = translate( p.base ) * scale( POINT_RADIUS, POINT_RADIUS, POINT_RADIUS );
       MV  = WCStoVCS * M;
       MVP = WCStoCCS * M;
 
@@ -29,7 +40,7 @@ void CtrlPoints::draw( bool drawPostsOnly, mat4 &WCStoVCS, mat4 &WCStoCCS, vec3
 
       // draw top
 
-      M   = translate( points[i] ) * scale( POINT_RADIUS, POINT_RADIUS, POINT_RADIUS );
+      M   = translate( p.top ) * scale( POINT_RADIUS, POINT_RADIUS, POINT_RADIUS );
       MV  = WCStoVCS * M;
       MVP = WCStoCCS * M;
 
@@ -38,9 +49,9 @@ void CtrlPoints::draw( bool drawPostsOnly, mat4 &WCStoVCS, mat4 &WCStoCCS, vec3
 
     // draw post
 
-    float len = points[i].z - bases[i].z;
+    float len = p.top.z - p.base.z;
 
-    M   = translate( bases[i] ) * scale( POST_RADIUS, POST_RADIUS, len ) * translate( 0, 0, 0.5 );
+    M   = translate( p.base ) * scale( POST_RADIUS, POST_RADIUS, len ) * POST_OFFSET;
     MV  = WCStoVCS * M;
     MVP = WCStoCCS * M;
 
@@ -52,93 +63,285 @@ void CtrlPoints::draw( bool drawPostsOnly, mat4 &WCStoVCS, mat4 &WCStoCCS, vec3
 void CtrlPoints::addPoint( vec3 pt )
 
 {
-  // Find the closest edge to v
+  // Insert v into the closest edge (or at the start if there's no
+  // edge beside v)
+
+  int edgeIndex = closestEdge( pt );
+
+  insertPointAt( edgeIndex+1, pt, pt + INITIAL_VERTICAL_OFFSET );
+}
+
+
+// Return the index of the edge from base i to base i+1 closest to 'pt'
+// among those beside 'pt' (i.e. 'pt' projects onto the edge).  Return
+// -1 if there is none.
+//
+// The grid cells are searched in rings of increasing size around
+// 'pt'.  An edge that is in none of the cells of rings 0..r is at
+// least r cells away, so the search stops once the closest edge found
+// is nearer than that.
+
+
+int CtrlPoints::closestEdge( vec3 pt )
 
+{
   float minDist = MAXFLOAT;
   int edgeIndex = -1;
 
-  for (int i=0; i<bases.size(); i++) {
-    int j = (i+1) % bases.size();
-    vec3 u = pt - bases[i];
-    vec3 v = (bases[j] - bases[i]).normalize();
-    float t = u*v;
-    if (t >= 0 && t <= (bases[j]-bases[i]).length()) {
+  if (pts.size() < 2)
+    return -1;
+
+  testEdge( pts.size()-1, pt, minDist, edgeIndex ); // the closing edge
+
+  queryNum++;
+  candidates.clear();
+
+  int numTested = 0;
+
+  for (int r=edgeGrid.firstRing( pt ); ; r++) {
+
+    edgeGrid.collectRing( pt, r, candidates );
+
+    for (int k=numTested; k<candidates.size(); k++) {
 
-      float dist = (u - t*v).squaredLength();
+      int id = candidates[k];
 
-      if (dist < minDist) {
-        minDist = dist;
-        edgeIndex = i;
+      if (stamps[id] != queryNum) {
+        stamps[id] = queryNum;
+        testEdge( indexOfId( id ), pt, minDist, edgeIndex );
       }
     }
+
+    numTested = candidates.size();
+
+    if (edgeIndex >= 0 && sqrt(minDist) <= (r-1) * edgeGrid.size())
+      break;
+
+    if (edgeGrid.ringCoversAll( pt, r ))
+      break;
   }
 
-  // Insert v into this closest edge
+  return edgeIndex;
+}
 
-  edgeIndex++;
 
-  if (edgeIndex < bases.size()) {
+// If 'pt' is beside edge i and closer than 'minDist' (squared), update
+// 'minDist' and 'edgeIndex'.  On a tie, the lower index wins.
 
-    bases.shift( edgeIndex );
-    bases[edgeIndex] = pt;
+void CtrlPoints::testEdge( int i, vec3 pt, float &minDist, int &edgeIndex )
 
-    points.shift( edgeIndex );
-    points[edgeIndex] = pt + INITIAL_VERTICAL_OFFSET;
+{
+  vec3 a = pts[i].base;
+  vec3 b = pts[ (i+1) % pts.size() ].base;
+  vec3 u = pt - a;
+  vec3 v = (b - a).normalize();
+  float t = u*v;
+  if (t >= 0 && t <= (b-a).length()) {
+
+    float dist = (u - t*v).squaredLength();
+
+    if (dist < minDist || (dist == minDist && i < edgeIndex)) {
+      minDist = dist;
+      edgeIndex = i;
+    }
+  }
+}
 
-    spline->data.shift( edgeIndex );
-    spline->data[edgeIndex] = points[edgeIndex];
 
-  } else {
+// Move the gap in 'pts' to 'index'.  The points that the gap passes
+// over have new storage positions.
+
+void CtrlPoints::moveGap( int index )
+
+{
+  int first = MIN( index, pts.gap() );
+  int last  = MAX( index, pts.gap() );
+
+  pts.moveGap( index );
 
-    bases.add( pt );
-    points.add( pt + INITIAL_VERTICAL_OFFSET );
-    spline->data.add( points[edgeIndex] );
+  for (int i=first; i<last; i++)
+    slotOfId[ pts[i].id ] = pts.slot( i );
+}
+
+
+// Insert a control point so that it becomes point 'index'
+
+void CtrlPoints::insertPointAt( int index, vec3 base, vec3 top )
+
+{
+  int n = pts.size();
+
+  // The edge into which the point is inserted goes away
+
+  if (n > 0)
+    removeEdge( (index-1+n) % n );
+
+  // Growing the storage moves every point after the gap
+
+  if (n == pts.capacity()) {
+    pts.reserve( n+1 );
+    for (int i=pts.gap(); i<n; i++)
+      slotOfId[ pts[i].id ] = pts.slot( i );
+  }
+
+  moveGap( index );
+
+  int id;
+
+  if (freeIds.size() > 0) {
+    id = freeIds[ freeIds.size()-1 ];
+    freeIds.remove();
+  } else {
+    id = slotOfId.size();
+    slotOfId.add( -1 );
+    stamps.add( 0 );
   }
 
-  spline->mustRecomputeArcLength = true;
+  pts.insert( index, CtrlPoint( base, top, id ) );
+
+  slotOfId[id] = pts.slot( index );
+
+  if (spline != NULL)
+    spline->insertPoint( index, top );
+
+  // Add the post and the two edges on either side of it
+
+  n++;
+
+  insertPost( index );
+  insertEdge( (index-1+n) % n );
+  insertEdge( index );
 }
 
 
 void CtrlPoints::addPointWithHeight( vec3 v, float height )
 
 {
-  bases.add( v );
-  points.add( v + vec3(0,0,height) );
-  spline->data.add( points[points.size()-1] );
-  spline->mustRecomputeArcLength = true;
+  addPointWithTop( v, v + vec3(0,0,height) );
+}
+
+
+void CtrlPoints::addPointWithTop( vec3 base, vec3 top )
+
+{
+  insertPointAt( pts.size(), base, top );
+}
+
+
+// Append n points, each given by four floats: the base and the height
+// (as in a scene file).  The storage is reserved once, instead of
+// growing as the points are added one by one.
+
+
+void CtrlPoints::addPointsWithHeights( const float *points, int n )
+
+{
+  int total = pts.size() + n;
+
+  moveGap( pts.size() );        // so that growing moves no points
+
+  pts.reserve( total );
+  slotOfId.reserve( total );
+  stamps.reserve( total );
+  if (spline != NULL)
+    spline->reserve( total );
+
+  postGrid.reserve( total );    // at least one cell each
+  edgeGrid.reserve( total );
+
+  for (int i=0; i<n; i++, points+=4) {
+    vec3 base( points[0], points[1], points[2] );
+    insertPointAt( pts.size(), base, base + vec3( 0, 0, points[3] ) );
+  }
+}
+
+
+// Set 'points' to four floats per point, as addPointsWithHeights()
+// takes them
+
+
+void CtrlPoints::getPointsWithHeights( seq<float> &points )
+
+{
+  int n = pts.size();
+
+  points.clear();
+  points.reserve( 4*n );
+
+  for (int i=0; i<n; i++) {
+    vec3 base = pts[i].base;
+    points.add( base.x );
+    points.add( base.y );
+    points.add( base.z );
+    points.add( pts[i].top.z - base.z );
+  }
 }
 
 
 void CtrlPoints::deletePoint( int index )
 
 {
-  bases.remove(index);
-  points.remove(index);
-  spline->data.remove(index);
-  spline->mustRecomputeArcLength = true;
+  int n = pts.size();
+
+  removePost( index );
+  removeEdge( (index-1+n) % n );
+  removeEdge( index );
+
+  moveGap( index );
+
+  int id = pts[index].id;
+
+  slotOfId[id] = -1;
+  freeIds.add( id );
+
+  pts.remove( index );
+
+  if (spline != NULL)
+    spline->removePoint( index );
+
+  // Join the neighbours of the deleted point
+
+  n--;
+
+  if (n > 0)
+    insertEdge( (index-1+n) % n );
 }
 
 
 void CtrlPoints::moveBase( int index, vec3 newPos )
 
 {
-  float z = points[index].z;
+  int n = pts.size();
+
+  removePost( index );
+  removeEdge( (index-1+n) % n );
+  removeEdge( index );
+
+  CtrlPoint &p = pts[index];
+
+  float z = p.top.z;
   
-  bases[index] = newPos;
+  p.base = newPos;
 
   newPos.z = z;                 // keep the original height
-  points[index] = newPos;
-  spline->data[index] = newPos;
-  spline->mustRecomputeArcLength = true;
+  p.top = newPos;
+  if (spline != NULL)
+    spline->movePoint( index, newPos );
+
+  insertPost( index );
+  insertEdge( (index-1+n) % n );
+  insertEdge( index );
 }
 
 
 void CtrlPoints::setHeight( int index, float height )
 
 {
-  points[index].z = bases[index].z + height;
-  spline->data[index] = points[index];
-  spline->mustRecomputeArcLength = true;
+  CtrlPoint &p = pts[index];
+
+  p.top.z = p.base.z + height;
+  if (spline != NULL)
+    spline->movePoint( index, p.top );
 }
 
 
@@ -154,17 +357,39 @@ int CtrlPoints::findSelectedPoint( vec3 start, vec3 dir, mat4 &M )
   int   minIndex = -1;
   float minZDist = MAXFLOAT;
 
-  for (int i=0; i<points.size(); i++) {
+  // The grid is in the points' coordinate system, so get the posts
+  // near the line in that system.  (M is rigid, so distances are the
+  // same.)
+
+  mat4 Minv = M.inverse();
+
+  vec3 localStart = (Minv * vec4( start, 1 )).toVec3();
+  vec3 localDir   = (Minv * vec4( dir,   0 )).toVec3();
+
+  candidates.clear();
+  postGrid.collectAlong( localStart, localStart + localDir, POINT_RADIUS, candidates );
+
+  queryNum++;
+
+  for (int k=0; k<candidates.size(); k++) {
+
+    int id = candidates[k];
+
+    if (stamps[id] == queryNum)
+      continue;
+    stamps[id] = queryNum;
+
+    int i = indexOfId( id );
 
     // base i
 
-    vec3 p = (M * vec4( bases[i], 1 )).toVec3();
+    vec3 p = (M * vec4( pts[i].base, 1 )).toVec3();
     
     float distToLine = p.distanceToLine( start, dir );
 
     if (distToLine < POINT_RADIUS) {
       float zdist = (p - start)*dir;
-      if (zdist < minZDist) {
+      if (zdist < minZDist || (zdist == minZDist && 2*i < minIndex)) {
         minZDist = zdist;
         minIndex = 2*i + 0;  // ID of base of i is 2i
       }
@@ -172,13 +397,13 @@ int CtrlPoints::findSelectedPoint( vec3 start, vec3 dir, mat4 &M )
 
     // top i
 
-    p = (M * vec4( points[i], 1 )).toVec3();
+    p = (M * vec4( pts[i].top, 1 )).toVec3();
 
     distToLine = p.distanceToLine( start, dir );
 
     if (distToLine < POINT_RADIUS) {
       float zdist = (p - start)*dir;
-      if (zdist < minZDist) {
+      if (zdist < minZDist || (zdist == minZDist && 2*i+1 < minIndex)) {
         minZDist = zdist;
         minIndex = 2*i + 1;  // ID of base of i is 2i+1
       }
@@ -6,52 +6,141 @@
 
 #include "headers.h"
 #include "seq.h"
+#include "gapSeq.h"
 #include "spline.h"
+#include "spatialGrid.h"
 
 
-class CtrlPoints {
+#define GRID_CELL_SIZE  20.0    // cell size of the picking grid (in terrain units)
+
 
+class CtrlPoint {
  public:
+  vec3 base;                    // base on the terrain
+  vec3 top;                     // point in the air, which is the spline's data point
+  int  id;                      // doesn't change when other points are inserted or deleted
+  CtrlPoint() {}
+  CtrlPoint( vec3 b, vec3 t, int i ) { base = b; top = t; id = i; }
+};
+
+
+class CtrlPoints {
+
+  // The points are kept in a gap buffer, so inserting and deleting
+  // near the last edit is O(1).  An edit elsewhere moves the gap
+  // there, which costs O(distance from the last edit), as the points
+  // that the gap passes over are moved and get new storage positions.
+  // Every change is passed on to the spline, which then resamples
+  // only the segments around it.
+
+  gapSeq<CtrlPoint> pts;
+
+  // The posts (base to top) and the edges between consecutive bases
+  // are kept in grids, so that picking and inserting points don't
+  // have to look at every point.  The grids are updated by every
+  // function that changes 'pts'.
+  //
+  // The grids store each point's ID.  The edge from point i to point
+  // i+1 is stored under the ID of point i.  The index of a point is
+  // found from its position in the gap buffer's storage, which is
+  // updated whenever the gap moves past the point.  The IDs of deleted
+  // points are used again, so there are never more IDs than the most
+  // points there have been at once.
+  //
+  // The closing edge, from the last point back to the first, is not
+  // in the grid.  It changes with every point appended and can be
+  // long, so it's tested separately.
+
+  SpatialGrid postGrid;
+  SpatialGrid edgeGrid;
+
+  seq<int>          slotOfId;   // slotOfId[id] = storage position in 'pts' of the point with that ID (-1 if deleted)
+  seq<int>          freeIds;    // IDs of deleted points, to be used again
+
+  seq<int>          candidates; // IDs returned by the grids
+  seq<unsigned int> stamps;     // stamps[id] == queryNum if 'id' was already tested in this query
+  unsigned int      queryNum;
+
+  int  indexOfId( int id ) {
+    return pts.index( slotOfId[id] );
+  }
+
+  void insertPost( int i ) { postGrid.insert( pts[i].id, pts[i].base, pts[i].top ); }
+  void removePost( int i ) { postGrid.remove( pts[i].id, pts[i].base, pts[i].top ); }
+
+  void insertEdge( int i ) {
+    if (i < pts.size()-1)
+      edgeGrid.insert( pts[i].id, pts[i].base, pts[i+1].base );
+  }
+
+  void removeEdge( int i ) {
+    if (i < pts.size()-1)
+      edgeGrid.remove( pts[i].id, pts[i].base, pts[i+1].base );
+  }
+
+  void testEdge( int i, vec3 pt, float &minDist, int &edgeIndex );
+
+  void moveGap( int index );
+  void insertPointAt( int index, vec3 base, vec3 top );
 
-  seq<vec3> points;             // points in the air
-  seq<vec3> bases;              // base on the terrain
+ public:
 
-  Spline *spline;
+  Spline *spline;               // NULL for points that aren't drawn (e.g. SceneJournal's copy)
 
   GLFWwindow *window;
 
-  CtrlPoints( Spline *s, GLFWwindow *w ) {
+  CtrlPoints( Spline *s, GLFWwindow *w ) : postGrid( GRID_CELL_SIZE ), edgeGrid( GRID_CELL_SIZE ) {
     spline = s;
     window = w;
+    queryNum = 0;
   }
 
-  CtrlPoints( GLFWwindow *w ) {
+  CtrlPoints( GLFWwindow *w ) : postGrid( GRID_CELL_SIZE ), edgeGrid( GRID_CELL_SIZE ) {
+    spline = NULL;
     window = w;
+    queryNum = 0;
   }
 
   void clear() {
-    points.clear();
-    bases.clear();
-    spline->clear();
+    pts.clear();
+    if (spline != NULL)
+      spline->clear();
+    postGrid.clear();
+    edgeGrid.clear();
+    slotOfId.clear();
+    freeIds.clear();
+    stamps.clear();
   }
 
   int count() {
-    return points.size();
+    return pts.size();
+  }
+
+  vec3 base( int i ) {
+    return pts[i].base;
+  }
+
+  vec3 top( int i ) {
+    return pts[i].top;
   }
 
   void draw( bool drawPostsOnly, mat4 &WCStoVCS, mat4 &WCStoCCS, vec3 lightDir, vec3 colour );
   void addPoint( vec3 v );
   void addPointWithHeight( vec3 v, float height );
+  void addPointWithTop( vec3 base, vec3 top );
+  void addPointsWithHeights( const float *points, int n );
+  void getPointsWithHeights( seq<float> &points );
   void deletePoint( int index );
   void moveBase( int index, vec3 newPos );
   void setHeight( int index, float height );
   int findSelectedPoint( vec3 start, vec3 dir, mat4 &M );
+  int closestEdge( vec3 pt );
 
   float maxHeight() {
     float max = -MAXFLOAT;
-    for (int i=0; i<points.size(); i++)
-      if (points[i].z > max)
-        max = points[i].z;
+    for (int i=0; i<pts.size(); i++)
+      if (pts[i].top.z > max)
+        max = pts[i].top.z;
     return max;
   }
 };
@@ -97,6 +97,99 @@ void Segs::drawOneSeg( vec3 tail, vec3 head, mat4 &MV, mat4 &MVP, vec3 lightDir
 
 
 
+// Store vertices in a new VAO with the same attributes as drawSegs()
+// uses.  The buffers stay on the GPU until the caller deletes the VAO
+// with deleteVAO().
+
+GLuint Segs::makeVAO( vec3 *pts, vec3 *colours, vec3 *norms, int nPts )
+
+{
+  GLuint VAO;
+  
+  glGenVertexArrays( 1, &VAO );
+  glBindVertexArray( VAO );
+
+  GLuint VBO0, VBO1;
+
+  glGenBuffers( 1, &VBO0 );
+  glBindBuffer( GL_ARRAY_BUFFER, VBO0 );
+  glBufferData( GL_ARRAY_BUFFER, nPts * sizeof(vec3), pts, GL_STATIC_DRAW );
+  glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+  glEnableVertexAttribArray( 0 );
+
+  glGenBuffers( 1, &VBO1 );
+  glBindBuffer( GL_ARRAY_BUFFER, VBO1 );
+  glBufferData( GL_ARRAY_BUFFER, nPts * sizeof(vec3), colours, GL_STATIC_DRAW );
+  glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+  glEnableVertexAttribArray( 1 );
+
+  if (norms != NULL) {
+    GLuint VBO2;
+    glGenBuffers( 1, &VBO2 );
+    glBindBuffer( GL_ARRAY_BUFFER, VBO2 );
+    glBufferData( GL_ARRAY_BUFFER, nPts * sizeof(vec3), norms, GL_STATIC_DRAW );
+    glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+    glEnableVertexAttribArray( 2 );
+  }
+
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+  glBindVertexArray( 0 );
+
+  return VAO;
+}
+
+
+// Delete a VAO from makeVAO() and its buffers
+
+void Segs::deleteVAO( GLuint VAO )
+
+{
+  if (VAO == 0)
+    return;
+
+  glBindVertexArray( VAO );
+
+  for (int i=0; i<3; i++) {
+    GLint buffer = 0;
+    glGetVertexAttribiv( i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &buffer );
+    if (buffer != 0) {
+      GLuint id = buffer;
+      glDeleteBuffers( 1, &id );
+    }
+  }
+
+  glBindVertexArray( 0 );
+  glDeleteVertexArrays( 1, &VAO );
+}
+
+
+// Draw the first 'nPts' vertices of a VAO from makeVAO()
+
+void Segs::drawVAO( GLuint primitiveType, GLuint VAO, int nPts, bool useNormals, mat4 &MV, mat4 &MVP, vec3 lightDir )
+
+{
+  GLint id = 0;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &id); // get previously-active GPU program
+ 
+  gpuProg->activate();
+
+  gpuProg->setMat4( "MV",  MV  );
+  gpuProg->setMat4( "MVP", MVP );
+  gpuProg->setVec3( "lightDir", lightDir );
+
+  gpuProg->setInt( "useNormals", useNormals );
+
+  glBindVertexArray( VAO );
+  glDrawArrays( primitiveType, 0, nPts );
+  glBindVertexArray( 0 );
+
+  gpuProg->deactivate();
+
+  glUseProgram( id ); // restore previously-active GPU program
+}
+
+
+
 GPUProgram *Segs::setupShaders()
 
 {
@@ -0,0 +1,119 @@
+/* fenwickTree.h
+ *
+ * A Fenwick (binary indexed) tree of n integer values, all initially
+ * zero, which finds sums of the first i values and the value in which
+ * a running sum reaches a given amount, each in O(log n).
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     resize( n )         Make it n values, all zero
+ *     clear()             Set every value to zero
+ *     add( i, d )         Add d to value i
+ *     prefix( i )         Returns the sum of values 0 ... i-1
+ *     total()             Returns the sum of all values
+ *     find( s, rem )      Returns the first i with prefix(i+1) > s, and
+ *                         sets rem = s - prefix(i).  Returns n if s is
+ *                         at least total().  The values must not be
+ *                         negative.
+ *     build( valueOf )    Sets every value i to valueOf(i), in O(n)
+ *     rebuildIsCheaper( k ) Returns true if build() is cheaper than k add()s
+ *     size()              Returns n
+ *
+ * The values are integers so that the sums are exact, and don't depend
+ * on the order in which values were added or changed.
+ */
+
+
+#ifndef FENWICK_TREE_H
+#define FENWICK_TREE_H
+
+#include <stdint.h>
+#include <string.h>
+
+
+class FenwickTree {
+
+  int      n;
+  int      topBit;              // the highest power of two <= n
+  int64_t *tree;                // tree[k] is the sum of values k-(k&-k) ... k-1 (k from 1)
+
+ public:
+
+  FenwickTree() {
+    n = 0;
+    topBit = 0;
+    tree = NULL;
+  }
+
+  ~FenwickTree() {
+    delete [] tree;
+  }
+
+  FenwickTree( const FenwickTree & ) = delete;
+  FenwickTree & operator = ( const FenwickTree & ) = delete;
+
+  int size() const {
+    return n;
+  }
+
+  void resize( int newSize ) {
+    delete [] tree;
+    n = newSize;
+    tree = new int64_t[ n+1 ];
+    for (topBit=1; topBit*2 <= n; topBit*=2)
+      ;
+    clear();
+  }
+
+  void clear() {
+    if (tree != NULL)
+      memset( tree, 0, (n+1) * sizeof(int64_t) );
+  }
+
+  void add( int i, int64_t d ) {
+    for (int k=i+1; k<=n; k+=(k & -k))
+      tree[k] += d;
+  }
+
+  int64_t prefix( int i ) const {
+    int64_t sum = 0;
+    for (int k=i; k>0; k-=(k & -k))
+      sum += tree[k];
+    return sum;
+  }
+
+  int64_t total() const {
+    return prefix( n );
+  }
+
+  int find( int64_t s, int64_t &rem ) const {
+    int pos = 0;
+    for (int step=topBit; step>0; step/=2)
+      if (pos+step <= n && tree[pos+step] <= s) {
+        pos += step;
+        s -= tree[pos];
+      }
+    rem = s;
+    return pos;
+  }
+
+  template<class F> void build( F valueOf ) {
+    for (int k=1; k<=n; k++)
+      tree[k] = valueOf( k-1 );
+    for (int k=1; k<=n; k++) {
+      int parent = k + (k & -k);
+      if (parent <= n)
+        tree[parent] += tree[k];
+    }
+  }
+
+  bool rebuildIsCheaper( int numAdds ) const {
+    int levels = 0;
+    for (int b=topBit; b>0; b/=2)
+      levels++;
+    return (int64_t) numAdds * levels > n;
+  }
+};
+
+
+#endif
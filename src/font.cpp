@@ -17,17 +17,58 @@ void render_text( const char *text, int pixOriginX, int pixOriginY, GLFWwindow*
 
 #include "headers.h"
 #include "gpuProgram.h"
+#include "main.h"
+#include "profiler.h"
 #include <cstring>
 
 #include <ft2build.h>           // requires the freetype library.  On Linux: "sudo apt-get install libfreetype6-dev"
 #include FT_FREETYPE_H
 
 
-static FT_Library ft;
-static FT_Face face;
-static GLuint vao, vbo, tex;
+// All printable ASCII glyphs are rendered once, at initFont(), into
+// one texture (the atlas).  A string is then drawn as one buffer of
+// textured quads with one draw call.
+
+#define FIRST_GLYPH      32
+#define LAST_GLYPH       126
+#define ATLAS_WIDTH      512      // pixels
+#define GLYPH_PADDING    1        // pixels between glyphs in the atlas
+
+// Recently drawn strings keep their vertex buffers, so a string that
+// is drawn at the same place in the next frame is not rebuilt.
+
+#define TEXT_CACHE_SIZE  16
+#define MAX_CACHED_TEXT  1024     // longer strings are drawn but not kept
+
+
+class Glyph {
+ public:
+  int   width, rows;            // bitmap size in pixels
+  int   left, top;              // bitmap offset from the pen position
+  int   advance;                // pen advance in pixels
+  float u0, v0, u1, v1;         // bitmap in the atlas, in texture coordinates
+};
+
+
+class CachedText {
+ public:
+  GLuint   vao, vbo;
+  int      nVerts;
+  bool     valid;
+  int      x, y, fbWidth, fbHeight;
+  unsigned int lastUsed;
+  char     text[ MAX_CACHED_TEXT ];
+};
+
+
+static Glyph       glyphs[ LAST_GLYPH - FIRST_GLYPH + 1 ];
+static int         lineHeight;
+static GLuint      tex;
 static GPUProgram *gpu;
 
+static CachedText  cache[ TEXT_CACHE_SIZE ];
+static unsigned int frameCounter = 0;
+
 
 char *vertexShader = "\n\
 #version 300 es\n\
@@ -59,6 +100,9 @@ void main(void) {\n\
 void initFont( const char *ttf_file, int height_in_pixels )
 
 {
+  FT_Library ft;
+  FT_Face    face;
+
   if(FT_Init_FreeType(&ft)) {
     fprintf(stderr, "Could not init freetype library\n");
     exit(1);
@@ -71,43 +115,73 @@ void initFont( const char *ttf_file, int height_in_pixels )
 
   FT_Set_Pixel_Sizes(face, 0, height_in_pixels);
 
-  glGenTextures( 1, &tex );
-  glGenVertexArrays( 1, &vao );
-  glGenBuffers( 1, &vbo );
+  FT_GlyphSlot g = face->glyph;
 
-  gpu = new GPUProgram();
-  gpu->init( vertexShader, fragmentShader, "in font.cpp" );
-}
+  // Lay out the glyphs in rows across the atlas
 
+  int x = 0, y = 0, rowHeight = 0;
 
+  for (int c=FIRST_GLYPH; c<=LAST_GLYPH; c++) {
 
-// Print a string at (x,y) on the display
-//
-// x,y is the start position in [-1,1]x[-1,1]
-// sx,sy are the dimensions of a pixel in the [-1,1]x[-1,1] window coordinate system
+    Glyph &gl = glyphs[ c - FIRST_GLYPH ];
 
+    if (FT_Load_Char(face, c, FT_LOAD_RENDER)) {
+      gl.width = gl.rows = gl.left = gl.top = gl.advance = 0;
+      continue;
+    }
 
-void render_text( const char *text, int pixOriginX, int pixOriginY, GLFWwindow* window )
+    gl.width   = g->bitmap.width;
+    gl.rows    = g->bitmap.rows;
+    gl.left    = g->bitmap_left;
+    gl.top     = g->bitmap_top;
+    gl.advance = g->advance.x / 64;
 
-{
-  // Get size of a pixel in world coordinates [-1,1]x[-1,1]
+    if (x + gl.width > ATLAS_WIDTH) {
+      x = 0;
+      y += rowHeight + GLYPH_PADDING;
+      rowHeight = 0;
+    }
 
-  int width, height;
-  glfwGetFramebufferSize( window, &width, &height );
+    gl.u0 = x;                  // in pixels for now
+    gl.v0 = y;
 
-  float sx = 2.0 / (float) width;
-  float sy = 2.0 / (float) height;
+    x += gl.width + GLYPH_PADDING;
+    if (gl.rows > rowHeight)
+      rowHeight = gl.rows;
+  }
+
+  int atlasHeight = y + rowHeight;
+
+  // Copy the bitmaps into the atlas
+
+  unsigned char *atlas = (unsigned char *) calloc( ATLAS_WIDTH * atlasHeight, 1 );
 
-  // Postion the first character in world coordinates
+  for (int c=FIRST_GLYPH; c<=LAST_GLYPH; c++) {
 
-  float x = -1 + pixOriginX * sx;
-  float y = -1 + pixOriginY * sy;
+    Glyph &gl = glyphs[ c - FIRST_GLYPH ];
 
-  // Code common to all character textures
+    if (gl.width == 0 || FT_Load_Char(face, c, FT_LOAD_RENDER))
+      continue;
 
-  if (tex != 1)
-    cout << "Font using texture " << tex << endl;
+    for (int r=0; r<gl.rows; r++)
+      memcpy( atlas + ((int) gl.v0 + r) * ATLAS_WIDTH + (int) gl.u0,
+              g->bitmap.buffer + r * g->bitmap.pitch,
+              gl.width );
 
+    gl.u1 = (gl.u0 + gl.width) / (float) ATLAS_WIDTH;
+    gl.v1 = (gl.v0 + gl.rows)  / (float) atlasHeight;
+    gl.u0 = gl.u0 / (float) ATLAS_WIDTH;
+    gl.v0 = gl.v0 / (float) atlasHeight;
+  }
+
+  lineHeight = face->size->metrics.height / 64;
+
+  FT_Done_Face( face );
+  FT_Done_FreeType( ft );
+
+  // Upload the atlas
+
+  glGenTextures( 1, &tex );
   glActiveTexture( GL_TEXTURE1 );
   glBindTexture( GL_TEXTURE_2D, tex );
 
@@ -118,63 +192,175 @@ void render_text( const char *text, int pixOriginX, int pixOriginY, GLFWwindow*
   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
 
   glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+  glTexImage2D( GL_TEXTURE_2D, 0, GL_R8, ATLAS_WIDTH, atlasHeight, 0, GL_RED, GL_UNSIGNED_BYTE, atlas );
 
-  // GPU init
+  glBindTexture( GL_TEXTURE_2D, 0 );
 
-  gpu->activate();
-  gpu->setInt( "tex", 1 ); // texture is managed by texture unit 1 (= GL_TEXTURE1 above)
-  gpu->setVec4( "colour", vec4(0,0,0,1) ); // character colour
+  free( atlas );
 
-  // Code common to all VBO init
+  // One VAO and VBO per cache entry
 
-  glBindVertexArray( vao );
-  glBindBuffer( GL_ARRAY_BUFFER, vbo );
-  
-  glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, 0, 0 );
-  glEnableVertexAttribArray( 0 );
+  for (int i=0; i<TEXT_CACHE_SIZE; i++) {
 
-  // Each character is drawn with one texture that provides the opacity
+    CachedText &ct = cache[i];
 
-  glEnable( GL_BLEND );
-  glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+    glGenVertexArrays( 1, &ct.vao );
+    glGenBuffers( 1, &ct.vbo );
 
-  FT_GlyphSlot g = face->glyph;
+    glBindVertexArray( ct.vao );
+    glBindBuffer( GL_ARRAY_BUFFER, ct.vbo );
+    glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, 0, 0 );
+    glEnableVertexAttribArray( 0 );
+
+    ct.valid = false;
+    ct.lastUsed = 0;
+  }
+
+  glBindVertexArray( 0 );
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+  gpu = new GPUProgram();
+  gpu->init( vertexShader, fragmentShader, "in font.cpp" );
+}
+
+
+// Fill 'ct' with two triangles per character of 'text'.  A '\n'
+// starts a new line below.
+
+static void buildText( CachedText &ct, const char *text, int pixOriginX, int pixOriginY, int width, int height )
+
+{
+  // Size of a pixel in [-1,1]x[-1,1]
+
+  float sx = 2.0 / (float) width;
+  float sy = 2.0 / (float) height;
+
+  int len = strlen( text );
+
+  GLfloat *verts = frameArena->alloc<GLfloat>( 6 * 4 * len );
+  GLfloat *v = verts;
+
+  int penX = pixOriginX;
+  int penY = pixOriginY;
 
   for (const char *p=text; *p != '\0'; p++) {
-    
-    if ( FT_Load_Char(face, *p, FT_LOAD_RENDER) )
-      continue; // no texture available for this character
- 
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RED, g->bitmap.width, g->bitmap.rows, 0, GL_RED, GL_UNSIGNED_BYTE, g->bitmap.buffer );
- 
-    float x2 = x + g->bitmap_left * sx;
-    float y2 = -y - g->bitmap_top * sy;
-    float w = g->bitmap.width * sx;
-    float h = g->bitmap.rows * sy;
- 
-    GLfloat box[4][4] = {
-      {x2,     -y2    , 0, 0},
-      {x2 + w, -y2    , 1, 0},
-      {x2,     -y2 - h, 0, 1},
-      {x2 + w, -y2 - h, 1, 1},
-    };
-
-    glBufferData( GL_ARRAY_BUFFER, sizeof box, box, GL_DYNAMIC_DRAW );
-
-    glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
-
-    x += (g->advance.x/64) * sx;
-    y += (g->advance.y/64) * sy;
+
+    if (*p == '\n') {
+      penX = pixOriginX;
+      penY -= lineHeight;
+      continue;
+    }
+
+    if (*p < FIRST_GLYPH || *p > LAST_GLYPH)
+      continue; // no glyph available for this character
+
+    Glyph &gl = glyphs[ *p - FIRST_GLYPH ];
+
+    if (gl.width > 0) {
+
+      float x0 = -1 + (penX + gl.left) * sx;
+      float x1 = x0 + gl.width * sx;
+      float y1 = -1 + (penY + gl.top) * sy;
+      float y0 = y1 - gl.rows * sy;
+
+      GLfloat quad[6][4] = {
+        { x0, y1, gl.u0, gl.v0 },
+        { x1, y1, gl.u1, gl.v0 },
+        { x0, y0, gl.u0, gl.v1 },
+        { x0, y0, gl.u0, gl.v1 },
+        { x1, y1, gl.u1, gl.v0 },
+        { x1, y0, gl.u1, gl.v1 },
+      };
+
+      memcpy( v, quad, sizeof(quad) );
+      v += 6 * 4;
+    }
+
+    penX += gl.advance;
   }
 
-  // Disable everything
+  ct.nVerts = (v - verts) / 4;
 
-  glDisable( GL_BLEND );
-  glDisableVertexAttribArray( 0 );
+  glBindBuffer( GL_ARRAY_BUFFER, ct.vbo );
+  glBufferData( GL_ARRAY_BUFFER, (v - verts) * sizeof(GLfloat), verts, GL_STATIC_DRAW );
   glBindBuffer( GL_ARRAY_BUFFER, 0 );
-  gpu->deactivate();
 
+  // Keep the text if it fits, so that the next call can find it
+
+  if (len < MAX_CACHED_TEXT) {
+    strcpy( ct.text, text );
+    ct.x = pixOriginX;
+    ct.y = pixOriginY;
+    ct.fbWidth = width;
+    ct.fbHeight = height;
+    ct.valid = true;
+  } else
+    ct.valid = false;
+}
+
+
+// Print a string with its lower-left corner at pixel (pixOriginX,
+// pixOriginY) of the window
+
+
+void render_text( const char *text, int pixOriginX, int pixOriginY, GLFWwindow* window )
+
+{
+  PROFILE_GPU_SCOPE( "render_text" );
+
+  int width, height;
+  glfwGetFramebufferSize( window, &width, &height );
+
+  frameCounter++;
+
+  // Look for this string in the cache.  If it's not there, rebuild
+  // the least recently used entry.
+
+  CachedText *ct = NULL;
+  CachedText *oldest = &cache[0];
+
+  for (int i=0; i<TEXT_CACHE_SIZE; i++) {
+
+    CachedText &c = cache[i];
+
+    if (c.valid && c.x == pixOriginX && c.y == pixOriginY &&
+        c.fbWidth == width && c.fbHeight == height && strcmp( c.text, text ) == 0) {
+      ct = &c;
+      break;
+    }
+
+    if (c.lastUsed < oldest->lastUsed)
+      oldest = &c;
+  }
+
+  if (ct == NULL) {
+    ct = oldest;
+    buildText( *ct, text, pixOriginX, pixOriginY, width, height );
+  }
+
+  ct->lastUsed = frameCounter;
+
+  if (ct->nVerts == 0)
+    return;
+
+  // Draw
+
+  glActiveTexture( GL_TEXTURE1 );
+  glBindTexture( GL_TEXTURE_2D, tex );
+
+  gpu->activate();
+  gpu->setInt( "tex", 1 ); // texture is managed by texture unit 1 (= GL_TEXTURE1 above)
+  gpu->setVec4( "colour", vec4(0,0,0,1) ); // character colour
+
+  glEnable( GL_BLEND );
+  glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+
+  glBindVertexArray( ct->vao );
+  glDrawArrays( GL_TRIANGLES, 0, ct->nVerts );
   glBindVertexArray( 0 );
+
+  glDisable( GL_BLEND );
+  gpu->deactivate();
 }
 
 #endif
@@ -1,5 +1,10 @@
 // font.h
  
 void initFont( const char *ttf_file, int height_in_pixels );
+
+// Draw 'text' with its lower-left corner at the given pixel.  A '\n'
+// starts a new line.  Each string is drawn with one draw call, and a
+// string drawn at the same place as in a recent frame is not rebuilt.
+
 void render_text( const char *text, int pixOriginX, int pixOriginY, GLFWwindow* window );
 // void render_text_in_3D( const char *text, vec3 pos, GLFWwindow *window );
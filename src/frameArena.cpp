@@ -0,0 +1,82 @@
+// frameArena.cpp
+
+
+#include "headers.h"
+#include "frameArena.h"
+
+
+FrameArena::FrameArena( size_t initialCapacity )
+
+{
+  capacity = initialCapacity;
+  block = (char *) malloc( capacity );
+  used = 0;
+
+  maxOverflow = 16;
+  overflow = (void **) malloc( maxOverflow * sizeof(void *) );
+  numOverflow = 0;
+  overflowBytes = 0;
+
+  highWater = 0;
+}
+
+
+FrameArena::~FrameArena()
+
+{
+  for (int i=0; i<numOverflow; i++)
+    free( overflow[i] );
+
+  free( overflow );
+  free( block );
+}
+
+
+// The arena is full.  Take the memory from the heap for now.
+
+
+void *FrameArena::allocOverflow( size_t numBytes )
+
+{
+  if (numOverflow == maxOverflow) {
+    maxOverflow *= 2;
+    overflow = (void **) realloc( overflow, maxOverflow * sizeof(void *) );
+  }
+
+  void *p = malloc( numBytes + FRAME_ARENA_ALIGN );
+  overflow[ numOverflow++ ] = p;
+  overflowBytes += numBytes + FRAME_ARENA_ALIGN;
+
+  return (void *) (((size_t) p + FRAME_ARENA_ALIGN-1) & ~(size_t) (FRAME_ARENA_ALIGN-1));
+}
+
+
+// Release everything allocated this frame.  If the frame overflowed
+// the arena, grow the arena so that the next such frame fits.
+
+
+void FrameArena::reset()
+
+{
+  size_t frameBytes = used + overflowBytes;
+
+  if (frameBytes > highWater)
+    highWater = frameBytes;
+
+  if (numOverflow > 0) {
+
+    for (int i=0; i<numOverflow; i++)
+      free( overflow[i] );
+
+    numOverflow = 0;
+    overflowBytes = 0;
+
+    free( block );
+    capacity = highWater + highWater/2;
+    block = (char *) malloc( capacity );
+
+    cout << "Frame arena grown to " << capacity << " bytes (high-water mark " << highWater << " bytes)" << endl;
+  }
+
+  used = 0;
+}
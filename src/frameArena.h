@@ -0,0 +1,68 @@
+/* frameArena.h
+ *
+ * A linear allocator for geometry that lives for one frame.
+ *
+ *   T *p = frameArena->alloc<T>( n );   // n uninitialized T's
+ *
+ * Allocation just advances a pointer.  Nothing is freed individually:
+ * everything is released by reset(), which the main loop calls once
+ * per frame.  Use this only for plain data (vec3, float, ...) as no
+ * destructors are run.
+ *
+ * If a frame needs more than the arena holds, the extra is taken from
+ * the heap and the arena grows to the high-water mark at the next
+ * reset(), so that frames in the steady state do no heap allocation.
+ */
+
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstdlib>
+#include <cstddef>
+
+
+#define FRAME_ARENA_SIZE    (1 << 20) // initial size in bytes
+#define FRAME_ARENA_ALIGN   16
+
+
+class FrameArena {
+
+  char   *block;
+  size_t  capacity;
+  size_t  used;                 // bytes used from 'block' this frame
+
+  void  **overflow;             // heap blocks allocated this frame beyond 'block'
+  int     numOverflow, maxOverflow;
+  size_t  overflowBytes;
+
+  size_t  highWater;            // most bytes used in any frame
+
+  void *allocOverflow( size_t numBytes );
+
+ public:
+
+  FrameArena( size_t initialCapacity );
+  ~FrameArena();
+
+  void *allocBytes( size_t numBytes ) {
+    size_t start = (used + FRAME_ARENA_ALIGN-1) & ~(size_t) (FRAME_ARENA_ALIGN-1);
+    if (start + numBytes > capacity)
+      return allocOverflow( numBytes );
+    used = start + numBytes;
+    return block + start;
+  }
+
+  template<class T> T *alloc( int n ) {
+    return (T *) allocBytes( n * sizeof(T) );
+  }
+
+  void reset();                 // release everything; call once per frame
+
+  size_t bytesUsed()     { return used + overflowBytes; }
+  size_t bytesReserved() { return capacity; }
+  size_t highWaterMark() { return highWater; }
+};
+
+
+#endif
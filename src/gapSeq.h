@@ -0,0 +1,267 @@
+/* gapSeq.h
+ *
+ * A sequence stored as a gap buffer: the elements sit in one array
+ * with a gap of unused slots at the position of the last insertion or
+ * removal.  Inserting or removing at the gap doesn't move any
+ * elements, and moving the gap costs one element move per position.
+ * So edits near the previous edit are O(1), where seq::shift() and
+ * seq::remove(i) move everything after the edit.
+ *
+ *   CONSTRUCTORS
+ *
+ *     gapSeq()            Create an empty sequence
+ *     gapSeq( n )         Create an empty sequence with storage for n elements
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     add( x )            Add x to the end of the sequence
+ *     insert( i, x )      Insert x so that it becomes the i^{th} element
+ *     remove( i )         Remove the i^{th} element
+ *     remove()            Remove the last element
+ *     operator [i]        Returns the i^{th} element (starting from 0)
+ *     size()              Returns the number of elements
+ *     clear()             Empties the sequence, keeping its storage
+ *     reserve( n )        Makes room for at least n elements
+ *     capacity()          Returns the number of elements that fit without reallocating
+ *
+ *     moveGap( i )        Move the gap to just before the i^{th} element
+ *     gap()               Returns the index of the element after the gap
+ *     slot( i )           Returns the position in storage of the i^{th} element
+ *     index( s )          Returns the index of the element in storage position s
+ *
+ * An element's storage position only changes when the gap moves past
+ * it, or when the storage grows.  A caller that remembers positions
+ * (to find an element's index in O(1)) must update the positions of
+ * the elements between the old and new gap after moveGap(), and of
+ * all elements after the storage grows.
+ *
+ * As in seq, operator [] checks its index unless NDEBUG is defined.
+ */
+
+
+#ifndef GAP_SEQ_H
+#define GAP_SEQ_H
+
+#include "headers.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <utility>
+
+using namespace std;
+
+
+template<class T> class gapSeq {
+
+  int storageSize;
+  int gapStart, gapEnd;         // the gap is storage positions gapStart ... gapEnd-1
+  T  *elements;
+
+  void grow( int minSize );
+
+public:
+
+  gapSeq() {                    // constructor
+    storageSize = 0;
+    gapStart = gapEnd = 0;
+    elements = NULL;
+  }
+
+  gapSeq( int n ) {             // constructor
+    storageSize = n;
+    gapStart = 0;
+    gapEnd = n;
+    elements = (n > 0 ? new T[ storageSize ] : NULL);
+  }
+
+  ~gapSeq() {                   // destructor
+    delete [] elements;
+  }
+
+  gapSeq( const gapSeq<T> & source ) { // copy constructor
+
+    storageSize = source.size();
+    gapStart = gapEnd = storageSize;
+    elements = (storageSize > 0 ? new T[ storageSize ] : NULL);
+    for (int i=0; i<storageSize; i++)
+      elements[i] = source[i];
+  }
+
+  gapSeq<T> & operator = (const gapSeq<T> &source) { // assignment operator
+    if (this == &source)
+      return *this;
+    delete [] elements;
+    storageSize = source.size();
+    gapStart = gapEnd = storageSize;
+    elements = (storageSize > 0 ? new T[ storageSize ] : NULL);
+    for (int i=0; i<storageSize; i++)
+      elements[i] = source[i];
+    return *this;
+  }
+
+  int size() const {
+    return storageSize - (gapEnd - gapStart);
+  }
+
+  int capacity() const {
+    return storageSize;
+  }
+
+  int gap() const {
+    return gapStart;
+  }
+
+  int slot( int i ) const {
+    return (i < gapStart ? i : i + (gapEnd - gapStart));
+  }
+
+  int index( int s ) const {
+    return (s < gapStart ? s : s - (gapEnd - gapStart));
+  }
+
+  T & operator [] ( int i ) const {
+#ifndef NDEBUG
+    if (i >= size() || i < 0) {
+      cerr << "element: Tried to access an element beyond the range of the sequence: "
+           << i << "(numElements = " << size() << ")\n";
+      exit(-1);
+    }
+#endif
+    return elements[ slot(i) ];
+  }
+
+  void reserve( int n ) {
+    if (n > storageSize)
+      grow( n );
+  }
+
+  void clear() {
+    gapStart = 0;
+    gapEnd = storageSize;
+  }
+
+  void add( const T &x ) {
+    insert( size(), x );
+  }
+
+  void remove() {
+    remove( size()-1 );
+  }
+
+  void moveGap( int i );
+  void insert( int i, const T &x );
+  void remove( int i );
+};
+
+
+// Grow the storage to at least minSize elements, and at least double
+// its current size.  The gap stays at the same index.
+
+template<class T>
+void
+gapSeq<T>::grow( int minSize )
+
+{
+  int newSize = storageSize * 2;
+  if (newSize < minSize)
+    newSize = minSize;
+  if (newSize < 2)
+    newSize = 2;
+
+  int numAfter = storageSize - gapEnd;
+
+  T *newElements = new T[ newSize ];
+  for (int i=0; i<gapStart; i++)
+    newElements[i] = std::move( elements[i] );
+  for (int i=0; i<numAfter; i++)
+    newElements[ newSize-numAfter+i ] = std::move( elements[ gapEnd+i ] );
+
+  storageSize = newSize;
+  gapEnd = newSize - numAfter;
+  delete [] elements;
+  elements = newElements;
+}
+
+
+// Move the gap so that element i is the first after it
+
+template<class T>
+void
+gapSeq<T>::moveGap( int i )
+
+{
+  if (i < 0 || i > size()) {
+    cerr << "moveGap: Tried to move the gap to " << i
+         << " in a sequence of " << size() << " elements \n";
+    exit(-1);
+  }
+
+  int gapSize = gapEnd - gapStart;
+
+  if (i < gapStart) {
+
+    // Move elements i ... gapStart-1 to after the gap
+
+    for (int j=gapStart-1; j>=i; j--)
+      elements[ j+gapSize ] = std::move( elements[j] );
+
+  } else {
+
+    // Move elements gapStart ... i-1 (which are after the gap) to before it
+
+    for (int j=gapStart; j<i; j++)
+      elements[j] = std::move( elements[ j+gapSize ] );
+  }
+
+  gapStart = i;
+  gapEnd = i + gapSize;
+}
+
+
+// Insert x to become element i
+
+template<class T>
+void
+gapSeq<T>::insert( int i, const T &x )
+
+{
+  if (i < 0 || i > size()) {
+    cerr << "insert: Tried to insert element " << i
+         << " in a sequence of " << size() << " elements \n";
+    exit(-1);
+  }
+
+  // x might be one of our own elements, so copy it before anything moves
+
+  T copy( x );
+
+  if (gapStart == gapEnd)
+    grow( storageSize+1 );
+
+  moveGap( i );
+
+  elements[ gapStart ] = std::move( copy );
+  gapStart++;
+}
+
+
+// Remove element i
+
+template<class T>
+void
+gapSeq<T>::remove( int i )
+
+{
+  if (i < 0 || i >= size()) {
+    cerr << "remove: Tried to remove element " << i
+         << " from a sequence of " << size() << " elements \n";
+    exit(-1);
+  }
+
+  moveGap( i );
+
+  gapEnd++;
+}
+
+
+#endif
@@ -4,7 +4,10 @@
 #include "gpuProgram.h"
 
 
-seq<unsigned int> GPUProgram::active_programs;
+// Room for deeper nesting than is ever used, so that activate() never
+// has to grow the stack while drawing
+
+seq<unsigned int> GPUProgram::active_programs( 16 );
 
 
 
@@ -0,0 +1,374 @@
+// heightfield.cpp
+
+
+#include "heightfield.h"
+#include "lodepng.h"
+
+#include "seq.h"
+
+#include <fstream>
+#include <chrono>
+
+#define MIN(a,b)  ((a)<(b)?(a):(b))
+
+#ifndef _WIN32
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+#endif
+
+
+// Raw files are little-endian and are used in place, so they can only
+// be read or written on a little-endian machine
+
+static bool littleEndianHost()
+
+{
+  unsigned int one = 1;
+  unsigned char first;
+  memcpy( &first, &one, 1 );
+  return first == 1;
+}
+
+
+Heightfield::Heightfield()
+
+{
+  width = height = 0;
+  isRaw = false;
+  headerSize = 0;
+  tileSize = tilesX = tilesY = 0;
+  format = HEIGHTS_UINT16;
+  samples = NULL;
+  decoded = NULL;
+  mapped = NULL;
+  mappedSize = 0;
+  loadSeconds = 0;
+}
+
+
+Heightfield::~Heightfield()
+
+{
+  delete [] decoded;
+
+#ifndef _WIN32
+  if (mapped != NULL)
+    munmap( mapped, mappedSize );
+#else
+  free( mapped );
+#endif
+}
+
+
+// Read the width and height (and, for a raw file, the format) from
+// the file header.  A file that starts with HEIGHTFIELD_MAGIC is raw;
+// anything else is taken to be a PNG.
+
+
+bool Heightfield::readSize( string basePath, string filename )
+
+{
+  name = filename;
+  path = basePath + string("/") + filename;
+
+  unsigned char header[33];     // the PNG size is in the first 33 bytes
+
+  ifstream in( path.c_str(), ios::binary );
+  in.read( (char *) header, sizeof(header) );
+
+  if (in.gcount() < HEIGHTFIELD_HEADER_SIZE) {
+    cerr << "Could not read '" << path << "'." << endl;
+    return false;
+  }
+
+  bool tiled = (strncmp( (char *) header, TILED_HEIGHTFIELD_MAGIC, 4 ) == 0);
+
+  isRaw = tiled || (strncmp( (char *) header, HEIGHTFIELD_MAGIC, 4 ) == 0);
+
+  if (isRaw)
+    return readRawHeader( header, tiled );
+
+  format = HEIGHTS_UINT16;
+
+  lodepng::State state;
+  unsigned error = (in ? lodepng_inspect( &width, &height, &state, header, sizeof(header) ) : 27);
+
+  if (error) {
+    cerr << "Error loading '" << path << "': " << lodepng_error_text(error) << endl;
+    width = height = 0;
+    return false;
+  }
+
+  return true;
+}
+
+
+bool Heightfield::readRawHeader( const unsigned char *bytes, bool tiled )
+
+{
+  if (!littleEndianHost()) {
+    cerr << "Error loading '" << path << "': raw heightfields are little-endian, and this machine isn't." << endl;
+    width = height = 0;
+    return false;
+  }
+
+  unsigned int header[5];
+
+  memcpy( header, bytes, sizeof(header) );
+
+  width = header[1];
+  height = header[2];
+
+  headerSize = (tiled ? TILED_HEIGHTFIELD_HEADER_SIZE : HEIGHTFIELD_HEADER_SIZE);
+
+  if (tiled) {
+    tileSize = header[4];
+    if (tileSize == 0) {
+      cerr << "'" << path << "' has a tile size of zero." << endl;
+      width = height = 0;
+      return false;
+    }
+    tilesX = (width + tileSize-1) / tileSize;
+    tilesY = (height + tileSize-1) / tileSize;
+  }
+
+  if (header[3] != HEIGHTS_UINT16 && header[3] != HEIGHTS_FLOAT32) {
+    cerr << "'" << path << "' has unknown height format " << header[3] << "." << endl;
+    width = height = 0;
+    return false;
+  }
+
+  format = (HeightFormat) header[3];
+
+  return true;
+}
+
+
+bool Heightfield::load()
+
+{
+  auto startTime = std::chrono::steady_clock::now();
+
+  bool ok = (isRaw ? mapRaw() : loadPNG());
+
+  loadSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - startTime ).count();
+
+  return ok;
+}
+
+
+// Decode an 8 or 16-bit grayscale PNG as it is stored.  lodepng can't
+// convert anything else to gray, so for other PNGs take the red
+// channel of RGBA.
+
+
+bool Heightfield::loadPNG()
+
+{
+  std::vector<unsigned char> file;
+
+  unsigned error = lodepng::load_file( file, path );
+
+  lodepng::State state;
+  unsigned int w, h;
+
+  if (!error)
+    error = lodepng_inspect( &w, &h, &state, file.data(), file.size() );
+
+  unsigned int depth = state.info_png.color.bitdepth;
+  bool gray = (state.info_png.color.colortype == LCT_GREY && (depth == 8 || depth == 16));
+
+  if (gray) {
+    state.info_raw.colortype = LCT_GREY;
+    state.info_raw.bitdepth = depth;
+  }
+
+  unsigned char *image = NULL;
+
+  if (!error)
+    error = lodepng_decode( &image, &w, &h, &state, file.data(), file.size() );
+
+  if (error) {
+    cerr << "Error loading '" << path << "': " << lodepng_error_text(error) << endl;
+    free( image );
+    return false;
+  }
+
+  // width and height are from readSize(), and may be read on another
+  // thread while this runs, so they aren't changed
+
+  if (w != width || h != height) {
+    cerr << "Error loading '" << path << "': it is " << w << "x" << h << ", but its header was "
+         << width << "x" << height << "." << endl;
+    free( image );
+    return false;
+  }
+
+  decoded = new unsigned short[ w * h ];
+
+  if (gray && depth == 16)
+    for (unsigned int i=0; i<w*h; i++)   // samples are big-endian
+      decoded[i] = (image[2*i] << 8) | image[2*i+1];
+  else if (gray)
+    for (unsigned int i=0; i<w*h; i++)   // scaled from [0,255] to [0,65535]
+      decoded[i] = image[i] * 257;
+  else
+    for (unsigned int i=0; i<w*h; i++)   // red, scaled from [0,255] to [0,65535]
+      decoded[i] = image[4*i] * 257;
+
+  free( image );
+
+  samples = decoded;
+
+  return true;
+}
+
+
+// Map the raw file.  Its samples are used where they are.
+
+
+bool Heightfield::mapRaw()
+
+{
+  size_t sampleSize = (format == HEIGHTS_FLOAT32 ? sizeof(float) : sizeof(unsigned short));
+  size_t numSamples = (tileSize > 0 ? (size_t) tilesX * tilesY * tileSize * tileSize : (size_t) width * height);
+  size_t size = headerSize + numSamples * sampleSize;
+
+#ifndef _WIN32
+
+  int fd = open( path.c_str(), O_RDONLY );
+
+  struct stat st;
+
+  if (fd < 0 || fstat( fd, &st ) != 0 || (size_t) st.st_size < size) {
+    cerr << "Could not read " << width << "x" << height << " heights from '" << path << "'." << endl;
+    if (fd >= 0)
+      close( fd );
+    return false;
+  }
+
+  void *p = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+
+  if (p == MAP_FAILED) {
+    cerr << "Could not map '" << path << "'." << endl;
+    return false;
+  }
+
+#else
+
+  // No mmap here, so read the file
+
+  void *p = malloc( size );
+
+  ifstream in( path.c_str(), ios::binary );
+  in.read( (char *) p, size );
+
+  if (!in) {
+    cerr << "Could not read " << width << "x" << height << " heights from '" << path << "'." << endl;
+    free( p );
+    return false;
+  }
+
+#endif
+
+  mapped = p;
+  mappedSize = size;
+  samples = (char *) mapped + headerSize;
+
+  return true;
+}
+
+
+// Write the tiles one at a time, so that a heightfield that is
+// itself mapped never needs to be all in memory
+
+
+bool Heightfield::writeTiled( const char *filename, int size )
+
+{
+  if (!littleEndianHost()) {
+    cerr << "Tiled heightfields are little-endian, and this machine isn't." << endl;
+    return false;
+  }
+
+  ofstream out( filename, ios::binary );
+
+  if (!out)
+    return false;
+
+  unsigned int header[ TILED_HEIGHTFIELD_HEADER_SIZE / 4 ];
+
+  memset( header, 0, sizeof(header) );
+  memcpy( header, TILED_HEIGHTFIELD_MAGIC, 4 );
+  header[1] = width;
+  header[2] = height;
+  header[3] = format;
+  header[4] = size;
+
+  out.write( (char *) header, sizeof(header) );
+
+  int numTilesX = (width + size-1) / size;
+  int numTilesY = (height + size-1) / size;
+
+  seq<float>          floats( size*size );
+  seq<unsigned short> shorts( size*size );
+
+  for (int ty=0; ty<numTilesY; ty++)
+    for (int tx=0; tx<numTilesX; tx++) {
+
+      floats.clear();
+      shorts.clear();
+
+      for (int y=ty*size; y<(ty+1)*size; y++)
+        for (int x=tx*size; x<(tx+1)*size; x++) {
+          int cx = MIN( x, (int) width-1 );   // padding repeats the edge
+          int cy = MIN( y, (int) height-1 );
+          if (format == HEIGHTS_FLOAT32)
+            floats.add( at( cx, cy ) );
+          else
+            shorts.add( ((const unsigned short *) samples)[ index( cx, cy ) ] );
+        }
+
+      if (format == HEIGHTS_FLOAT32)
+        out.write( (char *) floats.data(), size*size * sizeof(float) );
+      else
+        out.write( (char *) shorts.data(), size*size * sizeof(unsigned short) );
+    }
+
+  return (bool) out;
+}
+
+
+int tileHeightfield( const char *inFilename, const char *outFilename, int tileSize )
+
+{
+  if (tileSize < 2) {
+    cerr << "The tile size must be at least 2." << endl;
+    return 1;
+  }
+
+  // readSize() wants the directory and the name separately
+
+  string in( inFilename );
+  size_t slash = in.find_last_of( "/\\" );
+  string dir = (slash == string::npos ? string(".") : in.substr( 0, slash ));
+  string name = (slash == string::npos ? in : in.substr( slash+1 ));
+
+  Heightfield h;
+
+  if (!h.readSize( dir, name ) || !h.load())
+    return 1;
+
+  if (!h.writeTiled( outFilename, tileSize )) {
+    cerr << "Could not write '" << outFilename << "'." << endl;
+    return 1;
+  }
+
+  cout << "Wrote " << h.width << "x" << h.height << " heights in "
+       << (h.width + tileSize-1) / tileSize << "x" << (h.height + tileSize-1) / tileSize
+       << " tiles of " << tileSize << "x" << tileSize << endl;
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+/* heightfield.h
+ *
+ * The heights of a terrain, from one of
+ *
+ *   - a PNG image.  An 8 or 16-bit grayscale PNG is decoded as gray,
+ *     without expanding it to RGBA.  For any other PNG, the red
+ *     channel is used, so there are only 256 levels.
+ *
+ *   - a raw file, which is memory-mapped and used in place, without
+ *     decoding or copying.  It has a 16-byte header
+ *
+ *       char[4]   "HFLD"
+ *       uint32    width
+ *       uint32    height
+ *       uint32    format: 1 = uint16, 2 = float32
+ *
+ *     followed by width*height samples, row by row starting at y = 0.
+ *     Everything is little-endian.  As the samples are used in place,
+ *     raw files can't be read on a big-endian machine.
+ *
+ *   - a tiled raw file, for heightfields too large to load.  It is
+ *     also memory-mapped, so only the parts that are used are read
+ *     from disk.  It has a 32-byte header
+ *
+ *       char[4]   "HTIL"
+ *       uint32    width
+ *       uint32    height
+ *       uint32    format
+ *       uint32    tile size (in samples)
+ *       12 bytes of zeros
+ *
+ *     followed by the tiles, row by row of tiles starting at y = 0.
+ *     Each tile is tileSize*tileSize samples, row by row.  The tiles
+ *     on the right and top edges are padded to the full size.
+ *     writeTiled() makes such a file from any heightfield.
+ *
+ * at(x,y) returns the sample at (x,y).  PNG and uint16 samples are in
+ * [0,1].  float32 samples are returned as stored.
+ *
+ * As with Texture, readSize() reads only the header, and load() does
+ * the rest (and may run on another thread).
+ */
+
+
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#include "headers.h"
+
+
+#define HEIGHTFIELD_MAGIC       "HFLD"
+#define HEIGHTFIELD_HEADER_SIZE 16
+
+#define TILED_HEIGHTFIELD_MAGIC       "HTIL"
+#define TILED_HEIGHTFIELD_HEADER_SIZE 32
+#define DEFAULT_TILE_SIZE             128
+
+enum HeightFormat {
+  HEIGHTS_UINT16 = 1,           // raw uint16, or a decoded PNG
+  HEIGHTS_FLOAT32 = 2
+};
+
+
+class Heightfield {
+
+  string        path;           // basePath/name
+  bool          isRaw;
+  size_t        headerSize;
+
+  HeightFormat  format;
+  const void   *samples;        // width*height samples in 'format'
+
+  unsigned short *decoded;      // PNG samples (owned), or NULL
+  void         *mapped;         // memory-mapped raw file, or NULL
+  size_t        mappedSize;
+
+  bool readRawHeader( const unsigned char *bytes, bool tiled );
+  bool loadPNG();
+  bool mapRaw();
+
+ public:
+
+  string        name;
+  unsigned int  width, height;
+  unsigned int  tileSize;       // 0 if not tiled
+  unsigned int  tilesX, tilesY;
+  double        loadSeconds;    // time to read (and decode) the file
+
+  Heightfield();
+  ~Heightfield();
+
+  bool readSize( string basePath, string filename );
+  bool load();
+
+  // The height of a sample of 1.0 when the scene file doesn't give one
+
+  float defaultScale() {
+    return (format == HEIGHTS_FLOAT32 ? 1 : 0.1 * width); // PNG: max height is 10% of width
+  }
+
+  bool isTiled() {
+    return tileSize > 0;
+  }
+
+  size_t index( int x, int y ) {
+    if (tileSize == 0)
+      return (size_t) y*width + x;
+    int tx = x / tileSize;
+    int ty = y / tileSize;
+    return (((size_t) ty*tilesX + tx) * tileSize + (y - ty*tileSize)) * tileSize + (x - tx*tileSize);
+  }
+
+  float at( int x, int y ) {
+    if (format == HEIGHTS_FLOAT32)
+      return ((const float *) samples)[ index(x,y) ];
+    else
+      return ((const unsigned short *) samples)[ index(x,y) ] / 65535.0f;
+  }
+
+  // Write this heightfield as a tiled raw file, in the same format
+  // (uint16 for a PNG)
+
+  bool writeTiled( const char *filename, int tileSize );
+};
+
+
+// Convert a heightfield to a tiled one (the -tile option)
+
+int tileHeightfield( const char *inFilename, const char *outFilename, int tileSize );
+
+
+#endif
@@ -0,0 +1,458 @@
+// journal.cpp
+
+
+#include "journal.h"
+
+#include <cstdio>
+
+
+// 64-bit FNV-1a of the control points, to tell whether a journal was
+// made for them
+
+
+static uint64_t pointsChecksum( const float *points, int numPoints )
+
+{
+  const unsigned char *bytes = (const unsigned char *) points;
+  size_t n = (size_t) numPoints * 4 * sizeof(float);
+
+  uint64_t h = 14695981039346656037ULL;
+
+  for (size_t i=0; i<n; i++)
+    h = (h ^ bytes[i]) * 1099511628211ULL;
+
+  return h;
+}
+
+
+// Rename 'from' to 'to', replacing 'to'
+
+
+static bool replaceFile( string &from, string &to )
+
+{
+#ifdef _WIN32
+  remove( to.c_str() );         // rename() doesn't replace on Windows
+#endif
+
+  return rename( from.c_str(), to.c_str() ) == 0;
+}
+
+
+// An edit as a journal record: the int32 type and index, and the
+// float32 x, y and z
+
+
+static void encodeEdit( InputEvent &e, char *record )
+
+{
+  memcpy( record, &e.type, sizeof(int) );
+  memcpy( record + sizeof(int), &e.index, sizeof(int) );
+  memcpy( record + 2*sizeof(int), &e.v, sizeof(vec3) );
+}
+
+
+static void decodeEdit( const char *record, InputEvent &e )
+
+{
+  memcpy( &e.type, record, sizeof(int) );
+  memcpy( &e.index, record + sizeof(int), sizeof(int) );
+  memcpy( &e.v, record + 2*sizeof(int), sizeof(vec3) );
+}
+
+
+SceneJournal::SceneJournal() : points( (Spline *) NULL, NULL )
+
+{
+  quit = false;
+  compactAfter = -1;
+  reportCompaction = false;
+  editsSinceCompaction = 0;
+  reportedLost = false;
+}
+
+
+SceneJournal::~SceneJournal()
+
+{
+  if (!writer.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> l( lock );
+    quit = true;
+  }
+
+  wake.notify_all();
+  writer.join();
+}
+
+
+int SceneJournal::open( const char *sceneFilename, SceneFile &file, CtrlPoints *ctrlPoints )
+
+{
+  this->sceneFilename = string( sceneFilename );
+  journalFilename = this->sceneFilename + string( ".journal" );
+
+  scene.hasTerrain = file.hasTerrain;
+  scene.heightfieldName = file.heightfieldName;
+  scene.textureName = file.textureName;
+  scene.heightScale = file.heightScale;
+  scene.friction = file.friction;
+  scene.drag = file.drag;
+  scene.binary = file.binary;
+
+  points.addPointsWithHeights( file.points, file.numPoints );
+
+  uint64_t checksum = pointsChecksum( file.points, file.numPoints );
+
+  // Replay the journal, if it's for these points
+
+  seq<InputEvent> replayed;
+  bool matches = false;         // true if the journal is for these points
+  bool complete = true;         // false if the journal ends badly
+
+  ifstream in( journalFilename, ios::binary );
+
+  if (in) {
+
+    char header[ JOURNAL_HEADER_SIZE ];
+    in.read( header, sizeof(header) );
+
+    uint32_t field[4];          // magic, version, points, zero
+    uint64_t sum;
+    memcpy( field, header, sizeof(field) );
+    memcpy( &sum, header + sizeof(field), sizeof(sum) );
+
+    if (!in || strncmp( header, JOURNAL_MAGIC, 4 ) != 0 || field[1] != JOURNAL_VERSION ||
+        field[2] != (uint32_t) file.numPoints || sum != checksum)
+
+      cerr << "Ignoring '" << journalFilename << "', which is not for the points in '"
+           << sceneFilename << "' (it may be from before the scene was last stored)." << endl;
+
+    else {
+
+      matches = true;
+
+      char record[ JOURNAL_RECORD_SIZE ];
+
+      while (in.read( record, sizeof(record) )) {
+
+        InputEvent e;
+        decodeEdit( record, e );
+
+        if (!isEdit( e ) || (e.type != INPUT_ADD_POINT && (e.index < 0 || e.index >= ctrlPoints->count()))) {
+          cerr << "'" << journalFilename << "' has a bad edit after " << replayed.size()
+               << " edits.  The rest are ignored." << endl;
+          complete = false;
+          break;
+        }
+
+        applyInputEvent( e, ctrlPoints, NULL );
+        applyInputEvent( e, &points, NULL );
+        replayed.add( e );
+      }
+
+      if (in.gcount() > 0)      // part of an edit
+        complete = false;
+
+      if (!complete || replayed.size() > 0)
+        cout << "Replayed " << replayed.size() << " edits from '" << journalFilename << "'." << endl;
+    }
+
+    in.close();
+  }
+
+  // Start a new journal if there's none for these points.  One that
+  // ends badly is written again with only its good edits, so that new
+  // edits can be appended to it.
+
+  bool canAppend = matches && complete;
+
+  if (!canAppend) {
+
+    string journalTemp = journalFilename + string( ".tmp" );
+
+    canAppend = startJournal( journalTemp.c_str(), file.points, file.numPoints, replayed.data(), replayed.size() ) &&
+                replaceFile( journalTemp, journalFilename );
+
+    if (!canAppend)
+      remove( journalTemp.c_str() );
+  }
+
+  if (!canAppend || !openJournal()) {
+    cerr << "Could not write '" << journalFilename << "'.  Edits will not be saved." << endl;
+    reportedLost = true;
+  }
+
+  // Write the replayed edits to the scene file
+
+  if (replayed.size() > 0)
+    compactAfter = 0;
+
+  editsSinceCompaction = 0;
+
+  writer = std::thread( &SceneJournal::run, this );
+
+  return replayed.size();
+}
+
+
+// Queue an edit that has just been applied to the points
+
+
+void SceneJournal::append( InputEvent &e )
+
+{
+  {
+    std::lock_guard<std::mutex> l( lock );
+    queued.add( e );
+  }
+
+  wake.notify_one();
+
+  editsSinceCompaction++;
+
+  if (editsSinceCompaction >= JOURNAL_COMPACT_EDITS)
+    compact( false );
+}
+
+
+// Have the writer store the points, as of the edits queued so far, in
+// the scene file.  If 'report' is true, the writer says when it's
+// done.
+
+
+void SceneJournal::compact( bool report )
+
+{
+  {
+    std::lock_guard<std::mutex> l( lock );
+
+    compactAfter = queued.size(); // replaces an earlier request not yet done
+    reportCompaction = reportCompaction || report;
+  }
+
+  wake.notify_one();
+
+  editsSinceCompaction = 0;
+}
+
+
+// The writer thread.  It takes all queued edits at once, so the main
+// thread only waits for the lock while the queue is swapped.  Edits
+// queued before a compaction are in the stored scene, so are only
+// written to the journal if the compaction fails.
+
+
+void SceneJournal::run()
+
+{
+  std::unique_lock<std::mutex> l( lock );
+
+  while (true) {
+
+    wake.wait( l, [this] { return quit || queued.size() > 0 || compactAfter >= 0; } );
+
+    if (queued.size() == 0 && compactAfter < 0)
+      return;                   // quit with nothing left to write
+
+    std::swap( queued, writing );
+
+    int before = compactAfter;
+    bool report = reportCompaction;
+
+    compactAfter = -1;
+    reportCompaction = false;
+
+    l.unlock();
+
+    if (before < 0) {
+
+      writeEdits( writing.data(), writing.size() );
+      applyEdits( writing.data(), writing.size() );
+
+    } else {
+
+      applyEdits( writing.data(), before );
+
+      if (writeCompacted()) {
+
+        writeEdits( writing.data() + before, writing.size() - before );
+
+        if (report)
+          cout << "Scene stored in '" << sceneFilename << "'." << endl;
+
+      } else {
+
+        writeEdits( writing.data(), writing.size() );
+
+        cerr << "FAILED to store scene in '" << sceneFilename << "'.";
+        if (out.is_open() && out)
+          cerr << "  Its edits are kept in '" << journalFilename << "'.";
+        cerr << endl;
+      }
+
+      applyEdits( writing.data() + before, writing.size() - before );
+    }
+
+    writing.clear();
+
+    l.lock();
+  }
+}
+
+
+// Apply edits to the writer's copy of the points
+
+
+void SceneJournal::applyEdits( InputEvent *edits, int n )
+
+{
+  for (int i=0; i<n; i++)
+    applyInputEvent( edits[i], &points, NULL );
+}
+
+
+// Append edits to the journal and flush them to the file.  If they
+// can't be written, say so (once, until the journal is opened again).
+
+
+void SceneJournal::writeEdits( InputEvent *edits, int n )
+
+{
+  if (n == 0)
+    return;
+
+  if (out.is_open()) {
+
+    for (int i=0; i<n; i++) {
+      char record[ JOURNAL_RECORD_SIZE ];
+      encodeEdit( edits[i], record );
+      out.write( record, sizeof(record) );
+    }
+
+    out.flush();
+
+    if (out)
+      return;
+  }
+
+  if (!reportedLost) {
+    cerr << "Could not write to '" << journalFilename << "'.  Edits are NOT being saved." << endl;
+    reportedLost = true;
+  }
+}
+
+
+// Write the points and an empty journal for them to temporary files,
+// and rename them over the old ones.  The scene file goes first: if
+// the program stops before the second rename, the old journal is
+// ignored when the scene is next read.
+//
+// Returns true if the scene file now has the points.  In any case,
+// 'out' is left open on a journal for the scene file on disk, or
+// closed if there's none.
+
+
+bool SceneJournal::writeCompacted()
+
+{
+  string sceneTemp = sceneFilename + string( ".tmp" );
+  string journalTemp = journalFilename + string( ".tmp" );
+
+  points.getPointsWithHeights( pointsToStore );
+
+  int numPoints = pointsToStore.size() / 4;
+
+  scene.setPoints( pointsToStore.data(), numPoints );
+
+  if (!scene.write( sceneTemp.c_str(), scene.binary ) ||
+      !startJournal( journalTemp.c_str(), pointsToStore.data(), numPoints )) {
+    remove( sceneTemp.c_str() );
+    remove( journalTemp.c_str() );
+    return false;               // 'out' is still open on the old journal
+  }
+
+  out.close();
+
+  if (!replaceFile( sceneTemp, sceneFilename )) {
+    remove( sceneTemp.c_str() );
+    remove( journalTemp.c_str() );
+    openJournal();              // the old journal, which is for the old scene
+    return false;
+  }
+
+  // The scene file has changed, so the old journal must not be
+  // appended to.  If the new one can't be renamed over it, write it
+  // in place.
+
+  if (!replaceFile( journalTemp, journalFilename )) {
+
+    remove( journalTemp.c_str() );
+
+    if (!startJournal( journalFilename.c_str(), pointsToStore.data(), numPoints )) {
+      cerr << "Could not replace '" << journalFilename << "' after storing the scene." << endl;
+      reportedLost = false;     // so that the next edits report that they're lost
+      return true;
+    }
+  }
+
+  if (!openJournal())
+    reportedLost = false;       // so that the next edits report that they're lost
+
+  return true;
+}
+
+
+// Open the journal to append edits.  Returns false if it can't be
+// opened.
+
+
+bool SceneJournal::openJournal()
+
+{
+  out.clear();
+  out.open( journalFilename, ios::binary | ios::app );
+
+  if (!out.is_open())
+    return false;
+
+  reportedLost = false;
+  return true;
+}
+
+
+// Write a journal header for the given points, followed by 'edits'
+
+
+bool SceneJournal::startJournal( const char *filename, const float *points, int numPoints,
+                                 InputEvent *edits, int numEdits )
+
+{
+  ofstream f( filename, ios::binary );
+
+  if (!f)
+    return false;
+
+  char header[ JOURNAL_HEADER_SIZE ];
+
+  uint32_t field[4] = { 0, JOURNAL_VERSION, (uint32_t) numPoints, 0 };
+  uint64_t sum = pointsChecksum( points, numPoints );
+
+  memcpy( header, field, sizeof(field) );
+  memcpy( header, JOURNAL_MAGIC, 4 );
+  memcpy( header + sizeof(field), &sum, sizeof(sum) );
+
+  f.write( header, sizeof(header) );
+
+  for (int i=0; i<numEdits; i++) {
+    char record[ JOURNAL_RECORD_SIZE ];
+    encodeEdit( edits[i], record );
+    f.write( record, sizeof(record) );
+  }
+
+  f.close();
+
+  return !f.fail();
+}
@@ -0,0 +1,129 @@
+/* journal.h
+ *
+ * Autosaving of track edits.
+ *
+ * Each track edit (INPUT_ADD_POINT, INPUT_DELETE_POINT,
+ * INPUT_MOVE_BASE and INPUT_SET_HEIGHT) is appended to a journal
+ * file beside the scene file ("scene.txt.journal" for "scene.txt").
+ * append() only queues the edit.  A writer thread writes the queued
+ * edits and flushes the file, so a crash loses only the edits made
+ * since the writer last woke up.
+ *
+ * The journal has a 24-byte header
+ *
+ *   char[4]   "RCJN"
+ *   uint32    version (1)
+ *   uint32    number of control points in the scene file
+ *   uint32    zero
+ *   uint64    checksum of the scene file's control points
+ *
+ * followed by 20 bytes per edit: the int32 type and index, and the
+ * float32 x, y and z of the InputEvent.  open() replays the edits on
+ * the points just read from the scene file, but only if the checksum
+ * matches them.  A partial edit at the end (from a crash during a
+ * write) is dropped.
+ *
+ * The writer keeps its own copy of the control points, and applies
+ * each edit to it as the edit is written.  After JOURNAL_COMPACT_EDITS
+ * edits, or when compact() is called, the writer writes its copy to a
+ * temporary scene file, then a new journal with no edits, and renames
+ * both over the old ones.  The calling thread only sets a flag.
+ *
+ * If the program stops between the two renames, the old journal's
+ * checksum doesn't match the new scene file, so it's ignored.  If the
+ * second rename fails, the journal is written again in place, so that
+ * later edits go to a journal for the scene on disk.  If that fails
+ * too, or the scene can't be stored, the failure is reported and the
+ * edits stay in whichever journal matches the scene file.
+ */
+
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "headers.h"
+#include "seq.h"
+#include "ctrlPoints.h"
+#include "recording.h"
+#include "sceneFile.h"
+
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+#define JOURNAL_MAGIC          "RCJN"
+#define JOURNAL_VERSION        1
+#define JOURNAL_HEADER_SIZE    24
+#define JOURNAL_RECORD_SIZE    (2*sizeof(int) + sizeof(vec3))
+#define JOURNAL_COMPACT_EDITS  10000  // edits in the journal before it's compacted
+
+
+class SceneJournal {
+
+  string        sceneFilename;
+  string        journalFilename;
+  SceneFile     scene;          // terrain and format of the scene file (no points)
+
+  // Shared with the writer, and guarded by 'lock'
+
+  std::mutex    lock;
+  std::condition_variable wake;
+  bool          quit;
+  seq<InputEvent> queued;       // edits not yet written
+  int           compactAfter;   // compact after this many of the 'queued' edits (-1 = don't)
+  bool          reportCompaction;
+
+  std::thread   writer;
+
+  // Writer thread only (and open(), before the writer starts)
+
+  ofstream      out;            // the journal, if it could be opened
+  seq<InputEvent> writing;
+  CtrlPoints    points;         // the points after the edits written so far
+  seq<float>    pointsToStore;  // 4 floats per point
+  bool          reportedLost;   // edits were dropped, and that was reported
+
+  void applyEdits( InputEvent *edits, int n );
+
+  // Calling thread only
+
+  int           editsSinceCompaction;
+
+  void run();
+  void writeEdits( InputEvent *edits, int n );
+  bool writeCompacted();
+  bool startJournal( const char *filename, const float *points, int numPoints,
+                     InputEvent *edits = NULL, int numEdits = 0 );
+  bool openJournal();
+
+ public:
+
+  SceneJournal();
+  ~SceneJournal();              // writes the queued edits, then stops the writer
+
+  // open() replays the journal (if any) on the points just read from
+  // 'file', and starts the writer.  It returns the number of edits
+  // replayed.  If there were any, the scene is compacted right away.
+
+  int  open( const char *sceneFilename, SceneFile &file, CtrlPoints *ctrlPoints );
+  void append( InputEvent &e );
+  void compact( bool report );
+
+  bool isEdit( InputEvent &e ) {
+    return e.type == INPUT_ADD_POINT || e.type == INPUT_DELETE_POINT ||
+           e.type == INPUT_MOVE_BASE || e.type == INPUT_SET_HEIGHT;
+  }
+
+  bool hasEdits() {
+    return editsSinceCompaction > 0;
+  }
+
+  const char *filename() {
+    return journalFilename.c_str();
+  }
+};
+
+
+#endif
@@ -3,6 +3,10 @@
 
 #include "linalg.h"
 
+#ifdef LINALG_SSE
+  #include <xmmintrin.h>
+#endif
+
 
 // ---------------- vec2 ----------------
 
@@ -327,7 +331,7 @@ mat4 operator * ( float k, mat4 const& m )
   return out;
 }
 
-vec4 operator * ( mat4 const& m, vec4 const& v )
+vec4 mulScalar( mat4 const& m, vec4 const& v )
 
 {
   vec4 out;
@@ -340,127 +344,138 @@ vec4 operator * ( mat4 const& m, vec4 const& v )
   return out;
 }
 
-mat4 operator * ( mat4 const& m, mat4 const& n )
+mat4 mulScalar( mat4 const& m, mat4 const& n )
 
 {
-  mat4 out;
+  return compose( m, n );
+}
 
-  for (int i=0; i<4; i++)
-    for (int j=0; j<4; j++) {
+void transformPointsScalar( mat4 const& M, vec3 *pts, int n )
 
-      float sum=0;
+{
+  for (int i=0; i<n; i++)
+    pts[i] = mulScalar( M, vec4( pts[i], 1 ) ).toVec3();
+}
 
-      for (int k=0; k<4; k++)
-        sum += m[i][k] * n[k][j];
 
-      out[i][j] = sum;
-    }
+#ifdef LINALG_SSE
 
-  return out;
-}
+// The SSE versions add the products in the same order as the scalar
+// versions, and don't use fused multiply-add, so the results are the
+// same to the bit.
+//
+// mat4 * vec4 works on the columns of the matrix: out = col0 * v.x +
+// col1 * v.y + col2 * v.z + col3 * v.w.
 
-mat4 scale( float x, float y, float z )
+
+vec4 operator * ( mat4 const& m, vec4 const& v )
 
 {
-  mat4 out;
+  __m128 c0 = _mm_loadu_ps( &m.rows[0].x );
+  __m128 c1 = _mm_loadu_ps( &m.rows[1].x );
+  __m128 c2 = _mm_loadu_ps( &m.rows[2].x );
+  __m128 c3 = _mm_loadu_ps( &m.rows[3].x );
+
+  _MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
 
-  out.rows[0] = vec4( x, 0, 0, 0 );
-  out.rows[1] = vec4( 0, y, 0, 0 );
-  out.rows[2] = vec4( 0, 0, z, 0 );
-  out.rows[3] = vec4( 0, 0, 0, 1 );
+  __m128 r = _mm_mul_ps( c0, _mm_set1_ps( v.x ) );
+  r = _mm_add_ps( r, _mm_mul_ps( c1, _mm_set1_ps( v.y ) ) );
+  r = _mm_add_ps( r, _mm_mul_ps( c2, _mm_set1_ps( v.z ) ) );
+  r = _mm_add_ps( r, _mm_mul_ps( c3, _mm_set1_ps( v.w ) ) );
 
+  vec4 out;
+  _mm_storeu_ps( &out.x, r );
   return out;
 }
 
-mat4 translate( float x, float y, float z )
+
+// Row i of the product is m[i][0] * n.rows[0] + ... + m[i][3] * n.rows[3].
+// The sum starts from zero, as in the scalar version, so that a sum
+// of -0 products is +0 in both.
+
+mat4 operator * ( mat4 const& m, mat4 const& n )
 
 {
+  __m128 n0 = _mm_loadu_ps( &n.rows[0].x );
+  __m128 n1 = _mm_loadu_ps( &n.rows[1].x );
+  __m128 n2 = _mm_loadu_ps( &n.rows[2].x );
+  __m128 n3 = _mm_loadu_ps( &n.rows[3].x );
+
   mat4 out;
 
-  out.rows[0] = vec4( 1, 0, 0, x );
-  out.rows[1] = vec4( 0, 1, 0, y );
-  out.rows[2] = vec4( 0, 0, 1, z );
-  out.rows[3] = vec4( 0, 0, 0, 1 );
+  for (int i=0; i<4; i++) {
+
+    const vec4 &row = m.rows[i];
+
+    __m128 r = _mm_add_ps( _mm_setzero_ps(), _mm_mul_ps( _mm_set1_ps( row.x ), n0 ) );
+    r = _mm_add_ps( r, _mm_mul_ps( _mm_set1_ps( row.y ), n1 ) );
+    r = _mm_add_ps( r, _mm_mul_ps( _mm_set1_ps( row.z ), n2 ) );
+    r = _mm_add_ps( r, _mm_mul_ps( _mm_set1_ps( row.w ), n3 ) );
+
+    _mm_storeu_ps( &out.rows[i].x, r );
+  }
 
   return out;
 }
 
 
-mat4 translate( vec3 v )
+void transformPoints( mat4 const& M, vec3 *pts, int n )
 
 {
-  mat4 out;
+  __m128 c0 = _mm_loadu_ps( &M.rows[0].x );
+  __m128 c1 = _mm_loadu_ps( &M.rows[1].x );
+  __m128 c2 = _mm_loadu_ps( &M.rows[2].x );
+  __m128 c3 = _mm_loadu_ps( &M.rows[3].x );
 
-  out.rows[0] = vec4( 1, 0, 0, v.x );
-  out.rows[1] = vec4( 0, 1, 0, v.y );
-  out.rows[2] = vec4( 0, 0, 1, v.z );
-  out.rows[3] = vec4( 0, 0, 0,   1 );
+  _MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
 
-  return out;
-}
+  float out[4];
 
+  for (int i=0; i<n; i++) {
 
-mat4 rotate( float theta, vec3 axis )
+    __m128 r = _mm_mul_ps( c0, _mm_set1_ps( pts[i].x ) );
+    r = _mm_add_ps( r, _mm_mul_ps( c1, _mm_set1_ps( pts[i].y ) ) );
+    r = _mm_add_ps( r, _mm_mul_ps( c2, _mm_set1_ps( pts[i].z ) ) );
+    r = _mm_add_ps( r, c3 );    // w = 1
 
-{
-  axis = axis.normalize();
-
-  float v1 = axis.x;
-  float v2 = axis.y;
-  float v3 = axis.z;
-  
-  float t1 =  cos(theta);
-  float t2 =  1 - t1;
-  float t3 =  v1*v1;
-  float t6 =  t2*v1;
-  float t7 =  t6*v2;
-  float t8 =  sin(theta);
-  float t9 =  t8*v3;
-  float t11 = t6*v3;
-  float t12 = t8*v2;
-  float t15 = v2*v2;
-  float t19 = t2*v2*v3;
-  float t20 = t8*v1;
-  float t24 = v3*v3;
+    __m128 w = _mm_shuffle_ps( r, r, _MM_SHUFFLE( 3, 3, 3, 3 ) );
 
-  mat4 out;
+    if (_mm_cvtss_f32( w ) != 0)
+      r = _mm_div_ps( r, w );
 
-  out.rows[0] = vec4( t1 + t2*t3,     t7 - t9,   t11 + t12, 0 );
-  out.rows[1] = vec4(    t7 + t9, t1 + t2*t15,   t19 - t20, 0 );
-  out.rows[2] = vec4(  t11 - t12,   t19 + t20, t1 + t2*t24, 0 );
-  out.rows[3] = vec4(          0,           0,           0, 1 );
+    _mm_storeu_ps( out, r );
 
-  return out;
+    pts[i] = vec3( out[0], out[1], out[2] );
+  }
 }
 
+#else
 
-mat4 identity4()
+vec4 operator * ( mat4 const& m, vec4 const& v )
 
 {
-  mat4 M;
+  return mulScalar( m, v );
+}
 
-  for (int i=0; i<4; i++)
-    for (int j=0; j<4; j++)
-      if (i==j)
-        M[i][j] = 1;
-      else
-        M[i][j] = 0;
+mat4 operator * ( mat4 const& m, mat4 const& n )
 
-  return M;
+{
+  return mulScalar( m, n );
 }
 
-
-mat4 frustum( float l, float r, float b, float t, float n, float f )
+void transformPoints( mat4 const& M, vec3 *pts, int n )
 
 {
-  mat4 out;
+  transformPointsScalar( M, pts, n );
+}
 
-  out.rows[0] = vec4( 2*n/(r-l),         0, (r+l)/(r-l),           0 );
-  out.rows[1] = vec4(         0, 2*n/(t-b), (t+b)/(t-b),           0 );
-  out.rows[2] = vec4(         0,         0, (f+n)/(n-f), 2*f*n/(n-f) );
-  out.rows[3] = vec4(         0,         0,          -1,           0 );
+#endif
 
-  return out;
+
+mat4 rotate( float theta, vec3 axis )
+
+{
+  return rotateCS( cos(theta), sin(theta), axis.normalize() );
 }
 
 
@@ -480,20 +495,6 @@ mat4 perspective( float fovy, float aspect, float n, float f )
 }
     
 
-mat4 ortho( float l, float r, float b, float t, float n, float f )
-
-{
-  mat4 out;
-
-  out.rows[0] = vec4( 2/(r-l),       0,       0, (l+r)/(l-r) );
-  out.rows[1] = vec4(       0, 2/(t-b),       0, (b+t)/(b-t) );
-  out.rows[2] = vec4(       0,       0, 2/(n-f), (n+f)/(n-f) );
-  out.rows[3] = vec4(       0,       0,       0,           1 );
-
-  return out;
-}
-    
-
 // I/O operators
 
 std::ostream& operator << ( std::ostream& stream, mat4 const& m )
@@ -519,11 +520,99 @@ std::istream& operator >> ( std::istream& stream, mat4 & m )
 }
 
 
+// A transformation is affine if its bottom row is 0 0 0 1, and a
+// translation if, in addition, the upper-left 3x3 is the identity.
+
+TransformClass mat4::classify() const
+
+{
+  if (rows[3] != vec4( 0, 0, 0, 1 ))
+    return TRANSFORM_PROJECTIVE;
+
+  if (rows[0].x == 1 && rows[0].y == 0 && rows[0].z == 0 &&
+      rows[1].x == 0 && rows[1].y == 1 && rows[1].z == 0 &&
+      rows[2].x == 0 && rows[2].y == 0 && rows[2].z == 1)
+    return TRANSFORM_TRANSLATION;
+
+  return TRANSFORM_AFFINE;
+}
+
+
+mat4 mat4::inverse() const
+
+{
+  return inverse( classify() );
+}
+
+
+// For M = [ A t ; 0 1 ], the inverse is [ A^-1  -A^-1 t ; 0 1 ].  A^-1
+// is I for a translation (so only t is negated), A^T for a rotation,
+// and the adjugate of A divided by its determinant for an affine
+// transformation.
+
+mat4 mat4::inverse( TransformClass type ) const
+
+{
+  if (type == TRANSFORM_PROJECTIVE)
+    return generalInverse();
+
+  mat4 r;
+
+  vec3 t( rows[0].w, rows[1].w, rows[2].w );
+
+  if (type == TRANSFORM_TRANSLATION) {
+
+    r.rows[0] = vec4( 1, 0, 0, -t.x );
+    r.rows[1] = vec4( 0, 1, 0, -t.y );
+    r.rows[2] = vec4( 0, 0, 1, -t.z );
+    r.rows[3] = vec4( 0, 0, 0, 1 );
+
+    return r;
+  }
+
+  vec3 a0( rows[0].x, rows[0].y, rows[0].z ); // rows of A
+  vec3 a1( rows[1].x, rows[1].y, rows[1].z );
+  vec3 a2( rows[2].x, rows[2].y, rows[2].z );
+
+  vec3 b0, b1, b2;              // rows of A^-1
+
+  if (type == TRANSFORM_RIGID) {
+
+    b0 = vec3( a0.x, a1.x, a2.x );
+    b1 = vec3( a0.y, a1.y, a2.y );
+    b2 = vec3( a0.z, a1.z, a2.z );
+
+  } else {
+
+    // The columns of the adjugate are the cross products of pairs of rows
+
+    vec3 c0 = a1 ^ a2;
+    vec3 c1 = a2 ^ a0;
+    vec3 c2 = a0 ^ a1;
+
+    float det = a0 * c0;
+
+    float k = 1.0 / det;
+
+    b0 = k * vec3( c0.x, c1.x, c2.x );
+    b1 = k * vec3( c0.y, c1.y, c2.y );
+    b2 = k * vec3( c0.z, c1.z, c2.z );
+  }
+
+  r.rows[0] = vec4( b0, -(b0 * t) );
+  r.rows[1] = vec4( b1, -(b1 * t) );
+  r.rows[2] = vec4( b2, -(b2 * t) );
+  r.rows[3] = vec4( 0, 0, 0, 1 );
+
+  return r;
+}
+
+
 // 4x4 inverse
 //
 // Code from the Mesa OpenGL library
 
-mat4 mat4::inverse()
+mat4 mat4::generalInverse() const
 
 {
   float m[16], invOut[16];
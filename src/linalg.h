@@ -13,6 +13,25 @@
 #endif
 
 
+// The vector and matrix constructors, and the builders for matrices
+// that don't need sin, cos or atan, are constexpr, so a constant
+// transformation can be built at compile time:
+//
+//   static constexpr mat4 M = compose( scale( 7, 4, 4 ), constRotate( 1.5, vec3(1,0,0) ) );
+//
+// constRotate() uses constSin() and constCos(), which the compiler can
+// evaluate; rotate() uses the library sin and cos at run time.  This
+// needs C++14 or later.
+//
+// mat4 products use SSE where the compiler targets it (all x86-64
+// compilers do), unless LINALG_NO_SIMD is defined.  The SSE and
+// scalar versions give bit-identical results.
+
+#if !defined(LINALG_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+  #define LINALG_SSE
+#endif
+
+
 class mat4;
 class vec4;
 
@@ -28,8 +47,8 @@ public:
 
   vec2() {}
 
-  vec2( float xx, float yy )
-    { x = xx; y = yy; }
+  constexpr vec2( float xx, float yy )
+    : x(xx), y(yy) {}
 
   bool operator == (const vec2 p) {
     return x == p.x && y == p.y;
@@ -85,8 +104,8 @@ public:
 
   vec3() {}
 
-  vec3( float xx, float yy, float zz )
-    { x = xx; y = yy; z = zz; }
+  constexpr vec3( float xx, float yy, float zz )
+    : x(xx), y(yy), z(zz) {}
 
   vec3( float *v )
     { x = v[0]; y = v[1]; z = v[2]; }
@@ -137,9 +156,6 @@ public:
 };
 
 
-mat4 identity4();
-
-
 // Scalar/vec3 multiplication
 
 vec3 operator * ( float k, vec3 const& p );
@@ -163,14 +179,14 @@ public:
 
   vec4() {}
 
-  vec4( float xx, float yy, float zz, float ww )
-    { x = xx; y = yy; z = zz; w = ww; }
+  constexpr vec4( float xx, float yy, float zz, float ww )
+    : x(xx), y(yy), z(zz), w(ww) {}
 
-  vec4( vec3 v, float ww )
-    { x = v.x; y = v.y; z = v.z; w = ww; }
+  constexpr vec4( vec3 v, float ww )
+    : x(v.x), y(v.y), z(v.z), w(ww) {}
 
-  vec4( vec3 v )
-    { x = v.x; y = v.y; z = v.z; w = 1; }
+  constexpr vec4( vec3 v )
+    : x(v.x), y(v.y), z(v.z), w(1) {}
 
   bool operator == (const vec4 p) const
   { return x == p.x && y == p.y && z == p.z && w == p.w; }
@@ -311,14 +327,30 @@ std::istream& operator >> ( std::istream& stream, mat3 & m );
 // ---------------- mat4 ----------------
 
 
+// Kinds of transformation, from the most specific.  The product of
+// two transformations is of the less specific of their kinds.
+
+enum TransformClass {
+  TRANSFORM_TRANSLATION,        // translation only (including the identity)
+  TRANSFORM_RIGID,              // rotation and translation
+  TRANSFORM_AFFINE,             // bottom row is 0 0 0 1
+  TRANSFORM_PROJECTIVE          // anything else
+};
+
+
 class mat4 {
 
+  mat4 generalInverse() const;
+
 public:
   
   vec4 rows[4];
 
   mat4() {}
 
+  constexpr mat4( vec4 r0, vec4 r1, vec4 r2, vec4 r3 )
+    : rows{ r0, r1, r2, r3 } {}
+
   float *data() {
     return & rows[0][0];
   }
@@ -327,7 +359,26 @@ public:
     return ((vec4*)(&rows[0]))[index];
   }
 
-  mat4 inverse();
+  bool operator == ( mat4 const& m ) const {
+    return rows[0] == m.rows[0] && rows[1] == m.rows[1] && rows[2] == m.rows[2] && rows[3] == m.rows[3];
+  }
+
+  bool operator != ( mat4 const& m ) const {
+    return !(*this == m);
+  }
+
+  // The kind of transformation, found from the entries.  A rotation
+  // can't be recognized exactly, so this returns TRANSFORM_AFFINE for
+  // a rigid transformation.
+
+  TransformClass classify() const;
+
+  // The inverse, computed in the cheapest way for the given kind of
+  // transformation.  The matrix must be of that kind.  inverse()
+  // without an argument uses classify().
+
+  mat4 inverse( TransformClass type ) const;
+  mat4 inverse() const;
 };
 
 
@@ -343,17 +394,149 @@ mat4 operator * (       float k, mat4 const& m );
 vec4 operator * ( mat4 const& m, vec4 const& v );
 mat4 operator * ( mat4 const& m, mat4 const& n );
 
-mat4 identity4();
+// pts[i] = (M * vec4( pts[i], 1 )).toVec3() for i = 0 ... n-1
 
-mat4 scale( float x, float y, float z );
-mat4 translate( float x, float y, float z );
-mat4 translate( vec3 v );
-mat4 rotate( float theta, vec3 axis );
+void transformPoints( mat4 const& M, vec3 *pts, int n );
+
+// The scalar versions of the above, used when there's no SSE
+
+vec4 mulScalar( mat4 const& m, vec4 const& v );
+mat4 mulScalar( mat4 const& m, mat4 const& n );
+void transformPointsScalar( mat4 const& M, vec3 *pts, int n );
+
+// m * n, computed as mulScalar() does (so with the same result as
+// m * n), but which can be evaluated at compile time
+
+constexpr vec4 composeRow( vec4 r, mat4 const& n )
+
+{
+  return vec4( 0 + r.x * n.rows[0].x + r.y * n.rows[1].x + r.z * n.rows[2].x + r.w * n.rows[3].x,
+               0 + r.x * n.rows[0].y + r.y * n.rows[1].y + r.z * n.rows[2].y + r.w * n.rows[3].y,
+               0 + r.x * n.rows[0].z + r.y * n.rows[1].z + r.z * n.rows[2].z + r.w * n.rows[3].z,
+               0 + r.x * n.rows[0].w + r.y * n.rows[1].w + r.z * n.rows[2].w + r.w * n.rows[3].w );
+}
+
+constexpr mat4 compose( mat4 const& m, mat4 const& n )
+
+{
+  return mat4( composeRow( m.rows[0], n ),
+               composeRow( m.rows[1], n ),
+               composeRow( m.rows[2], n ),
+               composeRow( m.rows[3], n ) );
+}
+
+
+// Builders
+
+constexpr mat4 identity4()
+
+{
+  return mat4( vec4( 1, 0, 0, 0 ),
+               vec4( 0, 1, 0, 0 ),
+               vec4( 0, 0, 1, 0 ),
+               vec4( 0, 0, 0, 1 ) );
+}
+
+constexpr mat4 scale( float x, float y, float z )
+
+{
+  return mat4( vec4( x, 0, 0, 0 ),
+               vec4( 0, y, 0, 0 ),
+               vec4( 0, 0, z, 0 ),
+               vec4( 0, 0, 0, 1 ) );
+}
+
+constexpr mat4 translate( float x, float y, float z )
+
+{
+  return mat4( vec4( 1, 0, 0, x ),
+               vec4( 0, 1, 0, y ),
+               vec4( 0, 0, 1, z ),
+               vec4( 0, 0, 0, 1 ) );
+}
+
+constexpr mat4 translate( vec3 v )
+
+{
+  return translate( v.x, v.y, v.z );
+}
+
+constexpr mat4 frustum( float l, float r, float b, float t, float n, float f )
+
+{
+  return mat4( vec4( 2*n/(r-l),         0, (r+l)/(r-l),           0 ),
+               vec4(         0, 2*n/(t-b), (t+b)/(t-b),           0 ),
+               vec4(         0,         0, (f+n)/(n-f), 2*f*n/(n-f) ),
+               vec4(         0,         0,          -1,           0 ) );
+}
+
+constexpr mat4 ortho( float l, float r, float b, float t, float n, float f )
+
+{
+  return mat4( vec4( 2/(r-l),       0,       0, (l+r)/(l-r) ),
+               vec4(       0, 2/(t-b),       0, (b+t)/(b-t) ),
+               vec4(       0,       0, 2/(n-f), (n+f)/(n-f) ),
+               vec4(       0,       0,       0,           1 ) );
+}
 
-mat4 frustum( float l, float r, float b, float t, float n, float f );
-mat4 ortho( float l, float r, float b, float t, float n, float f );
 mat4 perspective( float fovy, float aspect, float n, float f );
 
+
+// Rotation by an angle with cosine c and sine s about a unit-length
+// axis.  rotate() normalizes the axis and finds c and s at run time.
+
+constexpr mat4 rotateCS( float c, float s, vec3 axis )
+
+{
+  float t = 1 - c;
+  float x = axis.x, y = axis.y, z = axis.z;
+
+  return mat4( vec4( c + t*(x*x),   t*x*y - s*z,   t*x*z + s*y, 0 ),
+               vec4(   t*x*y + s*z, c + t*(y*y),   t*y*z - s*x, 0 ),
+               vec4(   t*x*z - s*y,   t*y*z + s*x, c + t*(z*z), 0 ),
+               vec4(             0,             0,           0, 1 ) );
+}
+
+mat4 rotate( float theta, vec3 axis );
+
+
+// sin and cos by Taylor series in double precision, after reducing
+// the angle to [-pi,pi].  These are for constant angles, which the
+// compiler evaluates; at run time, use sin() and cos().
+
+constexpr double constSin( double theta )
+
+{
+  const double twoPi = 6.283185307179586476925;
+
+  long long turns = (long long) (theta / twoPi + (theta < 0 ? -0.5 : 0.5));
+  double x = theta - turns * twoPi;
+
+  double term = x, sum = x;
+
+  for (int n=1; n<20; n++) {
+    term *= -x*x / ((2*n) * (2*n+1));
+    sum += term;
+  }
+
+  return sum;
+}
+
+constexpr double constCos( double theta )
+
+{
+  return constSin( theta + 1.570796326794896619231 );
+}
+
+
+// Rotation by a constant angle about a constant unit-length axis
+
+constexpr mat4 constRotate( float theta, vec3 axis )
+
+{
+  return rotateCS( constCos( theta ), constSin( theta ), axis );
+}
+
 // I/O operators
 
 std::ostream& operator << ( std::ostream& stream, mat4 const& m );
@@ -5,6 +5,11 @@
 #include "scene.h"
 #include "font.h"
 #include "main.h"
+#include "bench.h"
+#include "recording.h"
+#include "rideAnalysis.h"
+#include "allocTracker.h"
+#include "profiler.h"
 
 // window dimensions
 
@@ -22,6 +27,8 @@ Cylinder     *cube;
 Axes     *axes;
 Segs     *segs;
 
+FrameArena *frameArena;
+
 // Error callback
 
 void errorCallback( int error, const char* description )
@@ -53,10 +60,77 @@ void framebufferReshapeCallback( GLFWwindow* window, int width, int height )
 int main( int argc, char **argv )
 
 {
+  // Benchmarks run without a window
+
+  if (argc > 1 && strcmp( argv[1], "-bench" ) == 0)
+    return runBenchmark( argc-2, argv+2 );
+
+  // Replays run without a window
+
+  if (argc > 2 && strcmp( argv[1], "-replay" ) == 0)
+    return replayRecording( argv[2] );
+
+  // So does ride analysis
+
+  if (argc > 3 && strcmp( argv[1], "-analyze" ) == 0)
+    return analyzeRide( argv[2], argv[3], (argc > 4 ? argv[4] : NULL) );
+
+  // Converting a scene between text and binary
+
+  if (argc > 3 && strcmp( argv[1], "-convert" ) == 0)
+    return convertScene( argv[2], argv[3] );
+
+  // Converting a heightfield to a tiled one
+
+  if (argc > 3 && strcmp( argv[1], "-tile" ) == 0)
+    return tileHeightfield( argv[2], argv[3], (argc > 4 ? atoi(argv[4]) : DEFAULT_TILE_SIZE) );
+
+  // Recording?
+
+  char *recordingFilename = NULL;
+
+  if (argc > 3 && strcmp( argv[1], "-record" ) == 0) {
+    recordingFilename = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+
+  // Checking for allocations in the frame loop?  This runs the scene
+  // for a number of frames and fails if any frame after the warmup
+  // allocates.
+
+  int checkAllocFrames = 0;
+
+  if (argc > 3 && strcmp( argv[1], "-checkallocs" ) == 0) {
+    if (!allocTrackingEnabled()) {
+      cerr << "-checkallocs needs a build with -DTRACK_ALLOCS" << endl;
+      exit(1);
+    }
+    checkAllocFrames = atoi( argv[2] );
+    argc -= 2;
+    argv += 2;
+  }
+
+  // GPU memory budget for textures, in MB
+
+  if (argc > 3 && strcmp( argv[1], "-texmem" ) == 0) {
+    textureCache.setBudget( (size_t) (atof( argv[2] ) * 1024 * 1024) );
+    argc -= 2;
+    argv += 2;
+  }
+
   // Get scene file name
 
   if (argc < 2) {
-    cerr << "Usage: " << argv[0] << " scene_name" << endl;
+    cerr << "Usage: " << argv[0] << " scene_name" << endl
+         << "       " << argv[0] << " -record recording_name scene_name" << endl
+         << "       " << argv[0] << " -replay recording_name" << endl
+         << "       " << argv[0] << " -checkallocs num_frames scene_name" << endl
+         << "       " << argv[0] << " -texmem MB scene_name" << endl
+         << "       " << argv[0] << " -analyze scene_name output.csv|output.bin [spline_name]" << endl
+         << "       " << argv[0] << " -convert scene_name output_name  (text to binary, or binary to text)" << endl
+         << "       " << argv[0] << " -tile heightfield output.htl [tile_size]" << endl
+         << "       " << argv[0] << " -bench [name [args]]" << endl;
     exit(1);
   }
 
@@ -97,6 +171,8 @@ int main( int argc, char **argv )
   glfwSwapInterval( 1 );
   gladLoadGLLoader( (GLADloadproc) glfwGetProcAddress );
 
+  profiler.initGPU();
+
   glfwSetWindowSizeCallback( window, windowReshapeCallback );
   glfwSetFramebufferSizeCallback( window, framebufferReshapeCallback );
 
@@ -108,6 +184,11 @@ int main( int argc, char **argv )
 
   scene = new Scene( sceneFilename, window );
 
+  if (recordingFilename != NULL && !scene->startRecording( recordingFilename )) {
+    cerr << "Could not open recording '" << recordingFilename << "'." << endl;
+    exit(1);
+  }
+
   // Some basic objects
 
   sphere   = new Sphere(4);
@@ -115,14 +196,21 @@ int main( int argc, char **argv )
   cube     = new Cylinder(4);
   axes     = new Axes();
   segs     = new Segs();
+
+  frameArena = new FrameArena( FRAME_ARENA_SIZE );
   
   // Main loop
 
   struct timeb prevTime, thisTime; // record the last rendering time
   ftime( &prevTime );
 
+  AllocTracker allocTracker( ALLOC_WARMUP_FRAMES );
+
   while (!glfwWindowShouldClose( window )) {
 
+    allocTracker.beginFrame();
+    profiler.beginFrame();
+
     // Update the world state
 
     ftime( &thisTime );
@@ -130,15 +218,39 @@ int main( int argc, char **argv )
     prevTime = thisTime;
 
     scene->update( elapsedSeconds );
+
+    frameArena->reset();      // release last frame's geometry
     scene->draw( false ); // false = draw normally
 
     glfwPollEvents();
+
+    profiler.endFrame();
+
+    // Frames in the steady state should not allocate.  (This only
+    // reports anything when compiled with TRACK_ALLOCS.)
+
+    allocTracker.endFrame();
+
+    if (checkAllocFrames > 0 && allocTracker.frames() == checkAllocFrames)
+      break;
   }
 
   // Clean up
 
+  scene->stopRecording();
+  scene->closeJournal();
+
   glfwDestroyWindow( window );
   glfwTerminate();
 
+  if (checkAllocFrames > 0) {
+    if (allocTracker.badFrames() > 0) {
+      cerr << allocTracker.badFrames() << " of " << allocTracker.frames() - ALLOC_WARMUP_FRAMES
+           << " frames after warmup allocated" << endl;
+      return 1;
+    }
+    cout << "no allocations in " << allocTracker.frames() - ALLOC_WARMUP_FRAMES << " frames after warmup" << endl;
+  }
+
   return 0;
 }
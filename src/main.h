@@ -4,6 +4,7 @@
 #include "cylinder.h"
 #include "axes.h"
 #include "drawSegs.h"
+#include "frameArena.h"
 
 extern int windowWidth;
 extern int windowHeight;
@@ -13,3 +14,5 @@ extern Cylinder *cylinder;
 extern Cylinder     *cube;
 extern Axes     *axes;
 extern Segs     *segs;
+
+extern FrameArena *frameArena;  // for geometry that lives for one frame
@@ -0,0 +1,362 @@
+// profiler.cpp
+
+
+#include "profiler.h"
+#include "font.h"
+
+#include <fstream>
+#include <chrono>
+
+
+static std::chrono::steady_clock::time_point profileStartTime = std::chrono::steady_clock::now();
+
+Profiler profiler;
+
+
+Profiler::Profiler()
+
+{
+  numScopes = 0;
+
+  frameNum = 0;
+  curr = &frames[0];
+  curr->frameNum = 0;
+  curr->start = 0;
+  curr->duration = 0;
+  curr->numQueries = 0;
+  curr->numEvents = 0;
+  depth = 0;
+
+  gpuTiming = false;
+  numQueries = 0;
+
+  hudText[0] = '\0';
+  showHUD = false;
+}
+
+
+double Profiler::now()
+
+{
+  return std::chrono::duration<double, std::micro>( std::chrono::steady_clock::now() - profileStartTime ).count();
+}
+
+
+// GL timestamp queries are core in OpenGL 3.3.  They are not in
+// OpenGL ES 3.0, where the profiler reports CPU times only.
+
+
+void Profiler::initGPU()
+
+{
+  gpuTiming = (GLAD_GL_VERSION_3_3 && glad_glQueryCounter != NULL && glad_glGetQueryObjectui64v != NULL);
+
+  if (gpuTiming)
+    glGenQueries( GPU_QUERY_FRAMES * MAX_GPU_QUERIES, &queries[0][0] );
+  else
+    cout << "GPU timer queries are not available; profiling CPU time only" << endl;
+}
+
+
+// Return the index of a scope name, adding it if it's new
+
+int Profiler::scopeId( const char *name )
+
+{
+  for (int i=0; i<numScopes; i++)
+    if (strcmp( scopeNames[i], name ) == 0)
+      return i;
+
+  if (numScopes == MAX_PROFILE_SCOPES) {
+    cerr << "Too many profile scopes; increase MAX_PROFILE_SCOPES in profiler.h" << endl;
+    exit(1);
+  }
+
+  scopeNames[ numScopes ] = name;
+  return numScopes++;
+}
+
+
+void Profiler::beginFrame()
+
+{
+  frameNum++;
+
+  // The frame GPU_QUERY_FRAMES ago used the same queries as this
+  // frame will, so collect its results first.
+
+  if (gpuTiming && frameNum > GPU_QUERY_FRAMES)
+    resolveGPU( frames[ (frameNum - GPU_QUERY_FRAMES) % PROFILE_FRAMES ] );
+
+  curr = &frames[ frameNum % PROFILE_FRAMES ];
+
+  curr->frameNum = frameNum;
+  curr->start = now();
+  curr->duration = 0;
+  curr->numEvents = 0;
+
+  depth = 0;
+  numQueries = 0;
+
+  // Query 0 marks the start of the frame on the GPU
+
+  if (gpuTiming)
+    glQueryCounter( queries[ frameNum % GPU_QUERY_FRAMES ][ numQueries++ ], GL_TIMESTAMP );
+}
+
+
+void Profiler::endFrame()
+
+{
+  curr->duration = now() - curr->start;
+  curr->numQueries = numQueries;
+
+  if (showHUD && frameNum % PROFILE_HUD_INTERVAL == 0)
+    updateHUD();
+}
+
+
+// Start timing an event and return its index in the current frame
+
+int Profiler::begin( int scope, bool gpu )
+
+{
+  if (curr->numEvents == MAX_PROFILE_EVENTS)
+    return -1;
+
+  int i = curr->numEvents++;
+  ProfileEvent &e = curr->events[i];
+
+  e.scope = scope;
+  e.depth = depth++;
+  e.duration = -1;
+  e.gpuQuery = -1;
+  e.gpuStart = -1;
+  e.gpuDuration = -1;
+
+  if (gpu && gpuTiming && numQueries + 2 <= MAX_GPU_QUERIES) {
+    e.gpuQuery = numQueries;
+    glQueryCounter( queries[ frameNum % GPU_QUERY_FRAMES ][ numQueries ], GL_TIMESTAMP );
+    numQueries += 2;
+  }
+
+  e.start = now();
+
+  return i;
+}
+
+
+void Profiler::end( int event )
+
+{
+  if (event < 0)
+    return;
+
+  ProfileEvent &e = curr->events[event];
+
+  e.duration = now() - e.start;
+  depth--;
+
+  if (e.gpuQuery >= 0)
+    glQueryCounter( queries[ frameNum % GPU_QUERY_FRAMES ][ e.gpuQuery+1 ], GL_TIMESTAMP );
+}
+
+
+// Read the GPU timestamps of an earlier frame.  Timestamps complete
+// in order, so if the last one is available, they all are.  If not,
+// that frame's GPU times are left as -1 rather than waiting.
+
+
+void Profiler::resolveGPU( ProfileFrame &f )
+
+{
+  if (f.numQueries == 0)
+    return;
+
+  GLuint *q = queries[ f.frameNum % GPU_QUERY_FRAMES ];
+
+  GLuint available = 0;
+  glGetQueryObjectuiv( q[ f.numQueries-1 ], GL_QUERY_RESULT_AVAILABLE, &available );
+
+  if (!available)
+    return;
+
+  GLuint64 frameStart, start, end;
+
+  glGetQueryObjectui64v( q[0], GL_QUERY_RESULT, &frameStart );
+
+  for (int i=0; i<f.numEvents; i++) {
+
+    ProfileEvent &e = f.events[i];
+
+    if (e.gpuQuery < 0)
+      continue;
+
+    glGetQueryObjectui64v( q[ e.gpuQuery ],   GL_QUERY_RESULT, &start );
+    glGetQueryObjectui64v( q[ e.gpuQuery+1 ], GL_QUERY_RESULT, &end );
+
+    e.gpuStart    = (start - frameStart) / 1000.0;
+    e.gpuDuration = (end - start) / 1000.0;
+  }
+}
+
+
+// Summarize the completed frames in the ring buffer as text.  Times
+// are inclusive of nested scopes.
+
+
+void Profiler::updateHUD()
+
+{
+  double cpuTotal[ MAX_PROFILE_SCOPES ], cpuMax[ MAX_PROFILE_SCOPES ], gpuTotal[ MAX_PROFILE_SCOPES ];
+  double cpuFrame[ MAX_PROFILE_SCOPES ];
+  int    gpuFrames[ MAX_PROFILE_SCOPES ], calls[ MAX_PROFILE_SCOPES ];
+
+  for (int s=0; s<numScopes; s++) {
+    cpuTotal[s] = cpuMax[s] = gpuTotal[s] = 0;
+    gpuFrames[s] = calls[s] = 0;
+  }
+
+  double frameTotal = 0, frameMax = 0;
+  int    numFrames = 0;
+
+  for (int n=frameNum-1; n>0 && n>frameNum-PROFILE_FRAMES; n--) {
+
+    ProfileFrame &f = frames[ n % PROFILE_FRAMES ];
+
+    frameTotal += f.duration;
+    if (f.duration > frameMax)
+      frameMax = f.duration;
+    numFrames++;
+
+    double gpuFrame[ MAX_PROFILE_SCOPES ];
+    bool   hasGPU[ MAX_PROFILE_SCOPES ];
+
+    for (int s=0; s<numScopes; s++) {
+      cpuFrame[s] = 0;
+      gpuFrame[s] = 0;
+      hasGPU[s] = false;
+    }
+
+    for (int i=0; i<f.numEvents; i++) {
+      ProfileEvent &e = f.events[i];
+      cpuFrame[ e.scope ] += e.duration;
+      calls[ e.scope ]++;
+      if (e.gpuDuration >= 0) {
+        gpuFrame[ e.scope ] += e.gpuDuration;
+        hasGPU[ e.scope ] = true;
+      }
+    }
+
+    for (int s=0; s<numScopes; s++) {
+      cpuTotal[s] += cpuFrame[s];
+      if (cpuFrame[s] > cpuMax[s])
+        cpuMax[s] = cpuFrame[s];
+      if (hasGPU[s]) {
+        gpuTotal[s] += gpuFrame[s];
+        gpuFrames[s]++;
+      }
+    }
+  }
+
+  if (numFrames == 0)
+    return;
+
+  char *p = hudText;
+  char *end = hudText + sizeof(hudText);
+
+  p += snprintf( p, end-p, "frame  %.2f ms avg  %.2f ms max  (%d frames)\n",
+                 frameTotal / numFrames / 1000, frameMax / 1000, numFrames );
+
+  for (int s=0; s<numScopes && p<end; s++) {
+
+    p += snprintf( p, end-p, "%-20s cpu %6.2f ms (max %6.2f)  ",
+                   scopeNames[s], cpuTotal[s] / numFrames / 1000, cpuMax[s] / 1000 );
+
+    if (p >= end)
+      break;
+
+    if (gpuFrames[s] > 0)
+      p += snprintf( p, end-p, "gpu %6.2f ms", gpuTotal[s] / gpuFrames[s] / 1000 );
+    else
+      p += snprintf( p, end-p, "gpu    -    " );
+
+    if (p >= end)
+      break;
+
+    p += snprintf( p, end-p, "  %.1f calls\n", calls[s] / (float) numFrames );
+  }
+}
+
+
+// Draw the summary in the top-left corner of the window
+
+void Profiler::drawHUD( GLFWwindow *window )
+
+{
+  if (!showHUD)
+    return;
+
+  if (hudText[0] == '\0')
+    updateHUD();
+
+  int width, height;
+  glfwGetFramebufferSize( window, &width, &height );
+
+  render_text( hudText, 10, height - 30, window );
+}
+
+
+// Write the frames in the ring buffer in the Chrome trace event
+// format.  CPU events are on thread 1 and GPU events on thread 2.
+
+
+bool Profiler::writeTrace( const char *filename )
+
+{
+  ofstream out( filename );
+
+  if (!out)
+    return false;
+
+  out << "{\"traceEvents\":[" << endl
+      << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}}," << endl
+      << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+
+  char line[200];
+
+  int first = frameNum - PROFILE_FRAMES + 1;
+  if (first < 1)
+    first = 1;
+
+  for (int n=first; n<frameNum; n++) {
+
+    ProfileFrame &f = frames[ n % PROFILE_FRAMES ];
+
+    snprintf( line, sizeof(line), ",\n{\"name\":\"frame %d\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+              f.frameNum, f.start, f.duration );
+    out << line;
+
+    for (int i=0; i<f.numEvents; i++) {
+
+      ProfileEvent &e = f.events[i];
+
+      if (e.duration < 0)
+        continue;
+
+      snprintf( line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                scopeNames[ e.scope ], e.start, e.duration );
+      out << line;
+
+      if (e.gpuDuration >= 0) {
+        snprintf( line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":2}",
+                  scopeNames[ e.scope ], f.start + e.gpuStart, e.gpuDuration );
+        out << line;
+      }
+    }
+  }
+
+  out << endl << "]}" << endl;
+
+  return (bool) out;
+}
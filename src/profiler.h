@@ -0,0 +1,135 @@
+/* profiler.h
+ *
+ * Where the frame time goes.
+ *
+ * Mark a block of code to be timed with
+ *
+ *   PROFILE_SCOPE( "Train::advance" );       // CPU time only
+ *   PROFILE_GPU_SCOPE( "Terrain::draw" );    // CPU and GPU time
+ *
+ * at the start of the block.  The time is recorded when the block
+ * exits.  The main loop calls profiler.beginFrame() and
+ * profiler.endFrame() around each frame.  The last PROFILE_FRAMES
+ * frames of timings are kept in a ring buffer.
+ *
+ * GPU time comes from GL timestamp queries, which are only available
+ * on desktop OpenGL 3.3 (not on OpenGL ES 3.0).  The results are read
+ * GPU_QUERY_FRAMES frames later, so that reading them does not stall.
+ *
+ * The timings can be drawn as a text overlay (drawHUD) or written as
+ * a Chrome trace (writeTrace), which can be opened in chrome://tracing
+ * or https://ui.perfetto.dev.
+ *
+ * The profiler is meant for the main thread only.
+ */
+
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "headers.h"
+
+
+#define PROFILE_FRAMES        120   // frames of history kept
+#define MAX_PROFILE_SCOPES    32    // distinct scope names
+#define MAX_PROFILE_EVENTS    256   // timed blocks per frame (more are dropped)
+#define GPU_QUERY_FRAMES      4     // frames before GPU results are read
+#define MAX_GPU_QUERIES       128   // timestamp queries per frame
+#define PROFILE_HUD_INTERVAL  30    // frames between HUD updates
+
+#define PROFILE_TRACE_FILE    "profile.json"
+
+
+class ProfileEvent {
+ public:
+  int    scope;
+  int    depth;                 // nesting depth, 0 = outermost
+  double start, duration;       // CPU time in microseconds
+  int    gpuQuery;              // index of the first of two timestamp queries, or -1
+  double gpuStart, gpuDuration; // GPU time in microseconds from the frame's first
+                                // GPU timestamp, or -1 if not available
+};
+
+
+class ProfileFrame {
+ public:
+  int          frameNum;
+  double       start, duration;
+  int          numQueries;      // GPU timestamp queries issued
+  int          numEvents;
+  ProfileEvent events[ MAX_PROFILE_EVENTS ];
+};
+
+
+class Profiler {
+
+  const char  *scopeNames[ MAX_PROFILE_SCOPES ];
+  int          numScopes;
+
+  ProfileFrame frames[ PROFILE_FRAMES ];
+  int          frameNum;        // current frame
+  ProfileFrame *curr;
+  int          depth;
+
+  bool         gpuTiming;
+  GLuint       queries[ GPU_QUERY_FRAMES ][ MAX_GPU_QUERIES ];
+  int          numQueries;      // used in the current frame
+
+  char         hudText[ 100 * (MAX_PROFILE_SCOPES+3) ];
+
+  double       now();           // microseconds since the profiler started
+  void         resolveGPU( ProfileFrame &f );
+  void         updateHUD();
+
+ public:
+
+  bool         showHUD;
+
+  Profiler();
+
+  void initGPU();               // call once the GL context exists
+
+  int  scopeId( const char *name );
+
+  void beginFrame();
+  void endFrame();
+
+  int  begin( int scope, bool gpu );
+  void end( int event );
+
+  void drawHUD( GLFWwindow *window );
+  bool writeTrace( const char *filename );
+};
+
+
+extern Profiler profiler;
+
+
+// Times the enclosing block
+
+class ProfileScope {
+
+  int event;
+
+ public:
+
+  ProfileScope( int scope, bool gpu ) {
+    event = profiler.begin( scope, gpu );
+  }
+
+  ~ProfileScope() {
+    profiler.end( event );
+  }
+};
+
+
+#define PROFILE_SCOPE( name )                                     \
+  static int profileScopeId_ = profiler.scopeId( name );          \
+  ProfileScope profileScope_( profileScopeId_, false )
+
+#define PROFILE_GPU_SCOPE( name )                                 \
+  static int profileScopeId_ = profiler.scopeId( name );          \
+  ProfileScope profileScope_( profileScopeId_, true )
+
+
+#endif
@@ -0,0 +1,298 @@
+// recording.cpp
+
+
+#include "recording.h"
+
+#include <chrono>
+
+
+// Apply an input event to the simulation.  Both the interactive
+// program and the replay go through here, so that they make the
+// same changes.
+
+
+void applyInputEvent( InputEvent &e, CtrlPoints *ctrlPoints, Train *train )
+
+{
+  switch (e.type) {
+
+  case INPUT_ACCELERATE:
+    train->accelerate();
+    break;
+
+  case INPUT_BRAKE:
+    train->brake();
+    break;
+
+  case INPUT_NEXT_PHYSICS:
+    train->nextPhysicsModel();
+    break;
+
+  case INPUT_NEXT_COB:
+    ctrlPoints->spline->nextCOB();
+    break;
+
+  case INPUT_MORE_CARS:
+    train->setNumCars( train->getNumCars()+1 );
+    break;
+
+  case INPUT_FEWER_CARS:
+    train->setNumCars( train->getNumCars()-1 );
+    break;
+
+  case INPUT_ADD_POINT:
+    ctrlPoints->addPoint( e.v );
+    break;
+
+  case INPUT_DELETE_POINT:
+    ctrlPoints->deletePoint( e.index );
+    break;
+
+  case INPUT_MOVE_BASE:
+    ctrlPoints->moveBase( e.index, e.v );
+    break;
+
+  case INPUT_SET_HEIGHT:
+    ctrlPoints->setHeight( e.index, e.v.z );
+    break;
+  }
+}
+
+
+// ---------------- Recorder ----------------
+
+
+// Start a recording with the current control points, losses and
+// spline basis
+
+
+bool Recorder::start( const char *filename, CtrlPoints *ctrlPoints, Train *train )
+
+{
+  out.open( filename, ios::binary );
+
+  if (!out)
+    return false;
+
+  out.write( RECORDING_MAGIC, 8 );
+
+  int numPoints = ctrlPoints->count();
+  out.write( (char *) &numPoints, sizeof(int) );
+
+  for (int i=0; i<numPoints; i++) {
+    vec3 base = ctrlPoints->base(i);
+    vec3 top  = ctrlPoints->top(i);
+    out.write( (char *) &base, sizeof(vec3) );
+    out.write( (char *) &top,  sizeof(vec3) );
+  }
+
+  float losses[2] = { train->getFriction(), train->getDrag() };
+  out.write( (char *) losses, sizeof(losses) );
+
+  const char *basis = ctrlPoints->spline->name();
+  int nameLength = strlen( basis );
+  out.write( (char *) &nameLength, sizeof(int) );
+  out.write( basis, nameLength );
+
+  numSteps = 0;
+
+  return true;
+}
+
+
+void Recorder::writeRecord( int type, const void *data, int numBytes )
+
+{
+  char t = type;
+
+  out.write( &t, 1 );
+  out.write( (const char *) data, numBytes );
+}
+
+
+// Record a call to Train::advance( elapsedSeconds ).  This must be
+// called *after* the call, as it might record the resulting checksum.
+
+
+void Recorder::recordStep( float elapsedSeconds, Train *train )
+
+{
+  writeRecord( RECORD_STEP, &elapsedSeconds, sizeof(float) );
+
+  numSteps++;
+
+  if (numSteps % CHECKSUM_INTERVAL == 0) {
+    unsigned int checksum = train->stateChecksum();
+    writeRecord( RECORD_CHECKSUM, &checksum, sizeof(unsigned int) );
+  }
+}
+
+
+void Recorder::recordInput( InputEvent &e )
+
+{
+  char buff[ 2*sizeof(int) + sizeof(vec3) ];
+
+  memcpy( buff, &e.type, sizeof(int) );
+  memcpy( buff + sizeof(int), &e.index, sizeof(int) );
+  memcpy( buff + 2*sizeof(int), &e.v, sizeof(vec3) );
+
+  writeRecord( RECORD_INPUT, buff, sizeof(buff) );
+}
+
+
+void Recorder::finish()
+
+{
+  writeRecord( RECORD_END, NULL, 0 );
+  out.close();
+}
+
+
+// ---------------- Replay ----------------
+
+
+int replayRecording( const char *filename )
+
+{
+  ifstream in( filename, ios::binary );
+
+  if (!in) {
+    cerr << "Could not open recording '" << filename << "'." << endl;
+    return 1;
+  }
+
+  char magic[8];
+  in.read( magic, 8 );
+
+  if (!in || strncmp( magic, RECORDING_MAGIC, RECORDING_VERSION_AT ) != 0) {
+    cerr << "'" << filename << "' is not a recording." << endl;
+    return 1;
+  }
+
+  if (strncmp( magic, RECORDING_MAGIC, 8 ) != 0) {
+    cerr << "'" << filename << "' is a version " << string( magic + RECORDING_VERSION_AT, 3 )
+         << " recording, which can't be replayed exactly by this version ("
+         << RECORDING_MAGIC + RECORDING_VERSION_AT << ").  Record it again." << endl;
+    return 1;
+  }
+
+  // Rebuild the scene
+
+  Spline     spline;
+  CtrlPoints ctrlPoints( &spline, NULL );
+  Train      train( &spline );
+
+  int numPoints;
+  in.read( (char *) &numPoints, sizeof(int) );
+
+  for (int i=0; i<numPoints && in; i++) {
+    vec3 base, top;
+    in.read( (char *) &base, sizeof(vec3) );
+    in.read( (char *) &top, sizeof(vec3) );
+    if (in)
+      ctrlPoints.addPointWithTop( base, top );
+  }
+
+  float losses[2];
+  in.read( (char *) losses, sizeof(losses) );
+  train.setLosses( losses[0], losses[1] );
+
+  int nameLength = 0;
+  in.read( (char *) &nameLength, sizeof(int) );
+
+  string basis( (in && nameLength > 0 && nameLength < 256 ? nameLength : 0), '\0' );
+  in.read( &basis[0], basis.size() );
+
+  if (!in || !spline.setCOB( basis.c_str() )) {
+    cerr << "'" << filename << "' has an unknown spline basis '" << basis << "'." << endl;
+    return 1;
+  }
+
+  // Rerun the simulation.  A record whose payload is cut off ends the
+  // replay, which then fails, as does one that never reaches
+  // RECORD_END.
+
+  auto startTime = std::chrono::steady_clock::now();
+
+  int    numSteps = 0;
+  int    numChecksums = 0;
+  int    numMismatches = 0;
+  double simulatedSeconds = 0;
+  bool   done = false;
+
+  while (!done) {
+
+    char type;
+    in.read( &type, 1 );
+
+    if (!in)
+      break;
+
+    switch (type) {
+
+    case RECORD_STEP: {
+      float elapsedSeconds;
+      in.read( (char *) &elapsedSeconds, sizeof(float) );
+      if (!in)
+        break;
+      train.advance( elapsedSeconds );
+      simulatedSeconds += elapsedSeconds;
+      numSteps++;
+      break;
+    }
+
+    case RECORD_INPUT: {
+      InputEvent e;
+      in.read( (char *) &e.type, sizeof(int) );
+      in.read( (char *) &e.index, sizeof(int) );
+      in.read( (char *) &e.v, sizeof(vec3) );
+      if (!in)
+        break;
+      if ((e.type == INPUT_DELETE_POINT || e.type == INPUT_MOVE_BASE || e.type == INPUT_SET_HEIGHT) &&
+          (e.index < 0 || e.index >= ctrlPoints.count())) {
+        cerr << "Bad control point index " << e.index << " after step " << numSteps << "." << endl;
+        return 1;
+      }
+      applyInputEvent( e, &ctrlPoints, &train );
+      break;
+    }
+
+    case RECORD_CHECKSUM: {
+      unsigned int checksum;
+      in.read( (char *) &checksum, sizeof(unsigned int) );
+      if (!in)
+        break;
+      numChecksums++;
+      if (checksum != train.stateChecksum()) {
+        if (numMismatches == 0)
+          cerr << "Checksum mismatch at step " << numSteps << "." << endl;
+        numMismatches++;
+      }
+      break;
+    }
+
+    case RECORD_END:
+      done = true;
+      break;
+
+    default:
+      cerr << "Bad record type " << (int) type << " after step " << numSteps << "." << endl;
+      return 1;
+    }
+
+    if (!in)
+      break;
+  }
+
+  if (!done)
+    cerr << "Recording is truncated after step " << numSteps << "." << endl;
+
+  double wallSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - startTime ).count();
+
+  cout << "replayed " << numSteps << " steps (" << simulatedSeconds << " s simulated) in "
+       << wallSeconds << " s: " << simulatedSeconds / wallSeconds << "x real time" << endl
+       << numChecksums - numMismatches << " of " << numChecksums << " checksums match" << endl;
+
+  return (done && numMismatches == 0 ? 0 : 1);
+}
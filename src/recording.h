@@ -0,0 +1,118 @@
+/* recording.h
+ *
+ * Deterministic recording and replay of a simulation run.
+ *
+ * A recording holds the control points of the scene at the start of
+ * the run, the train's friction and drag, and the name of the spline's
+ * basis, followed by a stream of records in the order in which
+ * they happened:
+ *
+ *   RECORD_STEP      the elapsed time passed to Train::advance()
+ *   RECORD_INPUT     an input event (speed change, track edit, ...)
+ *   RECORD_CHECKSUM  Train::stateChecksum() after a step
+ *
+ * All values are stored in binary, so a replay performs exactly the
+ * same floating point operations as the original run.  The replay
+ * runs without a window and as fast as possible, and compares its
+ * checksums with the recorded ones.
+ *
+ * The magic string at the start includes a format version.  The
+ * version changes whenever the simulation changes in a way that
+ * changes the results of the same inputs (e.g. version 002, when arc
+ * lengths became fixed point sums), as older recordings can't be
+ * replayed exactly.  It also changes with the header (e.g. version
+ * 003, which added friction and drag).  Version 004 has the station
+ * booster in the speed profile, and 005 added the basis.
+ *
+ * The recording is made with
+ *
+ *   ./roller -record run.rec scene.txt
+ *
+ * and replayed with
+ *
+ *   ./roller -replay run.rec
+ */
+
+
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include "headers.h"
+#include "spline.h"
+#include "ctrlPoints.h"
+#include "train.h"
+
+#include <fstream>
+
+
+#define RECORDING_MAGIC     "RCREC005"
+#define RECORDING_VERSION_AT 5      // the version is after the first 5 characters of the magic
+#define CHECKSUM_INTERVAL   60      // steps between recorded checksums
+
+
+enum RecordType { RECORD_STEP, RECORD_INPUT, RECORD_CHECKSUM, RECORD_END };
+
+
+// Input events that change the simulation
+
+enum InputType {
+  INPUT_ACCELERATE, INPUT_BRAKE, INPUT_NEXT_PHYSICS, INPUT_NEXT_COB,
+  INPUT_MORE_CARS, INPUT_FEWER_CARS,
+  INPUT_ADD_POINT, INPUT_DELETE_POINT, INPUT_MOVE_BASE, INPUT_SET_HEIGHT
+};
+
+
+class InputEvent {
+ public:
+
+  int   type;                   // an InputType
+  int   index;                  // control point index (for track edits)
+  vec3  v;                      // new position or height (for track edits)
+
+  InputEvent() {}
+
+  InputEvent( InputType t ) {
+    type = t;
+    index = 0;
+    v = vec3(0,0,0);
+  }
+
+  InputEvent( InputType t, int i, vec3 vv ) {
+    type = t;
+    index = i;
+    v = vv;
+  }
+};
+
+
+// Apply an input event to the simulation
+
+void applyInputEvent( InputEvent &e, CtrlPoints *ctrlPoints, Train *train );
+
+
+class Recorder {
+
+  ofstream out;
+  int      numSteps;
+
+  void writeRecord( int type, const void *data, int numBytes );
+
+ public:
+
+  Recorder() {
+    numSteps = 0;
+  }
+
+  bool start( const char *filename, CtrlPoints *ctrlPoints, Train *train );
+  void recordStep( float elapsedSeconds, Train *train );
+  void recordInput( InputEvent &e );
+  void finish();
+};
+
+
+// Replay a recording.  Return 0 if all checksums match.
+
+int replayRecording( const char *filename );
+
+
+#endif
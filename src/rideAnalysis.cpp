@@ -0,0 +1,274 @@
+// rideAnalysis.cpp
+
+
+#include "rideAnalysis.h"
+#include "scene.h"
+
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+
+#define NUM_RIDE_FIELDS (sizeof(RideSample) / sizeof(float))
+
+
+void RideAnalysis::compute( Spline *spline, SpeedProfile *profile, float spacing, int numThreads )
+
+{
+  delete [] samples;
+  delete [] accels;
+
+  samples = NULL;
+  accels = NULL;
+  numSamples = 0;
+
+  // Build the arc length table now, as the threads may not modify the spline
+
+  float length = spline->totalArcLength();
+
+  if (length <= 0 || spacing <= 0)
+    return;
+
+  numSamples = (int) (length / spacing);
+  samples = new RideSample[ numSamples ];
+  accels  = new vec3[ numSamples ];
+
+  if (numThreads <= 0)
+    numThreads = std::thread::hardware_concurrency();
+  if (numThreads <= 0)
+    numThreads = 1;
+  if (numThreads > numSamples)
+    numThreads = numSamples;
+
+  // Each thread handles a contiguous range of samples.  Jerk needs the
+  // accelerations of neighbouring samples, so it is done in a second pass.
+
+  std::vector<std::thread> threads;
+
+  for (int pass=0; pass<2; pass++) {
+
+    for (int i=0; i<numThreads; i++) {
+
+      int first = (int) ((long long) numSamples * i / numThreads);
+      int last  = (int) ((long long) numSamples * (i+1) / numThreads);
+
+      if (pass == 0)
+        threads.push_back( std::thread( &RideAnalysis::computeRange, this, spline, profile, spacing, first, last ) );
+      else
+        threads.push_back( std::thread( &RideAnalysis::computeJerkRange, this, spacing, profile->gravity, first, last ) );
+    }
+
+    for (unsigned int i=0; i<threads.size(); i++)
+      threads[i].join();
+
+    threads.clear();
+  }
+}
+
+
+// Compute everything but jerk for samples first ... last-1
+
+
+void RideAnalysis::computeRange( Spline *spline, SpeedProfile *profile, float spacing, int first, int last )
+
+{
+  float g = profile->gravity;
+  float h = profile->sampleSpacing();
+  vec3  up(0,0,1);
+
+  for (int i=first; i<last; i++) {
+
+    RideSample &r = samples[i];
+
+    r.s = i * spacing;
+    r.t = spline->paramAtArcLength( r.s );
+
+    vec3 p, d1, d2;
+    spline->evalAll( r.t, p, d1, d2 );
+
+    // Unit tangent and the curvature vector (the part of d2
+    // perpendicular to the tangent, divided by |d1|^2)
+
+    float d1Len = d1.length();
+    vec3  T = (1/d1Len) * d1;
+    vec3  K = (1/(d1Len*d1Len)) * (d2 - (d2*T)*T);
+
+    r.curvature = K.length();
+
+    // Acceleration is v^2 K toward the centre of curvature plus
+    // (dv/dt) T = v (dv/ds) T along the track.
+
+    float v = profile->speedAt( r.s );
+    float dvds = (profile->speedAt( r.s + h ) - profile->speedAt( r.s - h )) / (2*h);
+
+    r.speed = v;
+
+    vec3 a = (v*v) * K + (v*dvds) * T;
+    accels[i] = a;
+
+    // The rider feels a - gravity.  Express that in the car's local
+    // system (as in Spline::findLocalSystem).
+
+    vec3 felt = a + g * up;
+
+    vec3 x = (T ^ up).normalize();
+    vec3 y = x ^ T;
+
+    r.verticalG     = (felt * y) / g;
+    r.lateralG      = (felt * x) / g;
+    r.longitudinalG = (felt * T) / g;
+
+    r.bankAngle = atan2( felt * x, felt * y ) * 180 / M_PI;
+  }
+}
+
+
+// Jerk by central differences of the acceleration, with the time
+// between samples equal to distance / speed.
+
+
+void RideAnalysis::computeJerkRange( float spacing, float gravity, int first, int last )
+
+{
+  for (int i=first; i<last; i++) {
+
+    int prev = (i + numSamples - 1) % numSamples;
+    int next = (i + 1) % numSamples;
+
+    float v = samples[i].speed;
+
+    if (v <= 0) {
+      samples[i].jerk = 0;
+      continue;
+    }
+
+    float dt = 2 * spacing / v;
+
+    samples[i].jerk = (accels[next] - accels[prev]).length() / dt / gravity;
+  }
+}
+
+
+bool RideAnalysis::writeCSV( const char *filename )
+
+{
+  ofstream out( filename );
+
+  if (!out)
+    return false;
+
+  out << "s,t,speed,curvature,vertical_g,lateral_g,longitudinal_g,jerk,bank_deg" << endl;
+
+  for (int i=0; i<numSamples; i++) {
+    RideSample &r = samples[i];
+    out << r.s << "," << r.t << "," << r.speed << "," << r.curvature << ","
+        << r.verticalG << "," << r.lateralG << "," << r.longitudinalG << ","
+        << r.jerk << "," << r.bankAngle << "\n";
+  }
+
+  return (bool) out;
+}
+
+
+bool RideAnalysis::writeBinary( const char *filename )
+
+{
+  ofstream out( filename, ios::binary );
+
+  if (!out)
+    return false;
+
+  int numFields = NUM_RIDE_FIELDS;
+
+  out.write( RIDE_ANALYSIS_MAGIC, 8 );
+  out.write( (char *) &numSamples, sizeof(int) );
+  out.write( (char *) &numFields, sizeof(int) );
+  out.write( (char *) samples, numSamples * sizeof(RideSample) );
+
+  return (bool) out;
+}
+
+
+// Print the extreme values over the track
+
+
+void RideAnalysis::printSummary( ostream &out )
+
+{
+  if (numSamples == 0) {
+    out << "no samples" << endl;
+    return;
+  }
+
+  float minVert = MAXFLOAT, maxVert = -MAXFLOAT;
+  float maxLat = 0, maxJerk = 0, maxCurv = 0;
+
+  for (int i=0; i<numSamples; i++) {
+    RideSample &r = samples[i];
+    if (r.verticalG < minVert) minVert = r.verticalG;
+    if (r.verticalG > maxVert) maxVert = r.verticalG;
+    if (fabs(r.lateralG) > maxLat) maxLat = fabs(r.lateralG);
+    if (r.jerk > maxJerk) maxJerk = r.jerk;
+    if (r.curvature > maxCurv) maxCurv = r.curvature;
+  }
+
+  out << numSamples << " samples over " << samples[numSamples-1].s << " units" << endl
+      << "  vertical g      " << minVert << " to " << maxVert << endl
+      << "  max lateral g   " << maxLat << endl
+      << "  max jerk (g/s)  " << maxJerk << endl
+      << "  max curvature   " << maxCurv << " (min radius " << (maxCurv > 0 ? 1/maxCurv : MAXFLOAT) << ")" << endl;
+}
+
+
+int analyzeRide( const char *sceneFilename, const char *outFilename, const char *cobName )
+
+{
+  Spline     spline;
+  CtrlPoints ctrlPoints( &spline, NULL );
+  SceneFile  file;
+
+  if (cobName != NULL && !spline.setCOB( cobName )) {
+    cerr << "Unknown spline '" << cobName << "'." << endl;
+    return 1;
+  }
+
+  if (!Scene::readTrack( sceneFilename, &ctrlPoints, file )) {
+    cerr << "Could not open file '" << sceneFilename << "'." << endl;
+    return 1;
+  }
+
+  if (ctrlPoints.count() < 2) {
+    cerr << "The track in '" << sceneFilename << "' has fewer than two points." << endl;
+    return 1;
+  }
+
+  SpeedProfile profile;
+  profile.setLosses( file.friction, file.drag ); // as Scene::read() does for the train
+  profile.compute( &spline );
+
+  RideAnalysis analysis;
+
+  auto start = std::chrono::steady_clock::now();
+  analysis.compute( &spline, &profile, profile.sampleSpacing(), 0 );
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+  cout << "using " << spline.name() << endl;
+  analysis.printSummary( cout );
+  cout << "analyzed in " << seconds << " s" << endl;
+
+  int len = strlen( outFilename );
+  bool ok;
+
+  if (len > 4 && strcmp( outFilename + len - 4, ".bin" ) == 0)
+    ok = analysis.writeBinary( outFilename );
+  else
+    ok = analysis.writeCSV( outFilename );
+
+  if (!ok) {
+    cerr << "FAILED to write '" << outFilename << "'." << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,101 @@
+/* rideAnalysis.h
+ *
+ * Loads on the riders along the whole track, for safety review.
+ *
+ * Given a spline and a speed profile, sample the track at even arc
+ * length spacing and compute, at each sample:
+ *
+ *   curvature         1/radius of the track
+ *   vertical g        felt force along the car's up axis, in g
+ *                     (1 = sitting at rest, 0 = weightless)
+ *   lateral g         felt force along the car's sideways axis, in g
+ *   longitudinal g    felt force along the track, in g
+ *   jerk              rate of change of acceleration, in g/s
+ *   bank angle        roll of the track that would cancel the
+ *                     lateral g, in degrees
+ *
+ * The samples are evaluated in parallel.  The results can be written
+ * as CSV (one row per sample) or as a binary file:
+ *
+ *   "RIDE0001", int numSamples, int numFields,
+ *   numSamples * numFields floats in the order of the CSV columns.
+ */
+
+
+#ifndef RIDE_ANALYSIS_H
+#define RIDE_ANALYSIS_H
+
+#include "headers.h"
+#include "spline.h"
+#include "speedProfile.h"
+
+
+#define RIDE_ANALYSIS_MAGIC "RIDE0001"
+
+
+class RideSample {
+ public:
+  float s;                      // arc length
+  float t;                      // spline parameter
+  float speed;
+  float curvature;
+  float verticalG;
+  float lateralG;
+  float longitudinalG;
+  float jerk;
+  float bankAngle;
+};
+
+
+class RideAnalysis {
+
+  RideSample *samples;
+  vec3       *accels;           // world acceleration at each sample (for jerk)
+  int         numSamples;
+
+  void computeRange( Spline *spline, SpeedProfile *profile, float spacing, int first, int last );
+  void computeJerkRange( float spacing, float gravity, int first, int last );
+
+ public:
+
+  RideAnalysis() {
+    samples = NULL;
+    accels = NULL;
+    numSamples = 0;
+  }
+
+  ~RideAnalysis() {
+    delete [] samples;
+    delete [] accels;
+  }
+
+  // Analyze with 'spacing' between samples, using 'numThreads' threads
+  // (0 = one per hardware thread)
+
+  void compute( Spline *spline, SpeedProfile *profile, float spacing, int numThreads );
+
+  int count() {
+    return numSamples;
+  }
+
+  RideSample &operator [] ( int i ) {
+    return samples[i];
+  }
+
+  bool writeCSV( const char *filename );
+  bool writeBinary( const char *filename );
+  void printSummary( ostream &out );
+};
+
+
+// Analyze the track in a scene file and write the results to
+// 'outFilename' (binary if it ends in ".bin", otherwise CSV).  The
+// spline uses the change-of-basis matrix named 'cobName', or the
+// default if it is NULL.  This is run as
+//
+//   ./roller -analyze scene.txt ride.csv [Catmull-Rom|B-spline|linear]
+
+int analyzeRide( const char *sceneFilename, const char *outFilename, const char *cobName );
+
+
+#endif
@@ -6,18 +6,24 @@
 #include "font.h"
 #include "main.h"
 #include "linalg.h"
+#include "profiler.h"
 
-#include <strstream>
 #include <fstream>
 #include <iomanip>
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define LIGHT_DIR 1,1,3
 
+#define TILE_PREFETCH_POINTS 4  // points along the track ahead of the train, a tile apart, to prefetch terrain tiles around
+
 Scene::Scene( char *sceneFilename, GLFWwindow *w )
 
 {
   window = w;
+  recorder = NULL;
+  journal = NULL;
+  newTerrain = NULL;
+  haveCCStoVCS = false;
 
   glfwSetWindowUserPointer( window, this );
   
@@ -80,14 +86,30 @@ Scene::Scene( char *sceneFilename, GLFWwindow *w )
 void Scene::draw( bool useItemTags )
 
 {
+  PROFILE_GPU_SCOPE( "Scene::draw" );
+
   glClearColor( 0,0,0, 0 );
 
   glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
   glEnable( GL_DEPTH_TEST );
 
+  // Switch to a reloaded terrain once it's ready.  If it failed (which
+  // it reports), keep the current one.
+
+  if (newTerrain != NULL) {
+    if (newTerrain->finishLoading()) {
+      delete terrain;
+      terrain = newTerrain;
+      newTerrain = NULL;
+    } else if (newTerrain->hasFailed()) {
+      delete newTerrain;
+      newTerrain = NULL;
+    }
+  }
+
   // model-view transform (i.e. OCS-to-VCS)
 
-  float diag = sqrt( terrain->texture->width*terrain->texture->width + terrain->texture->height*terrain->texture->height );
+  float diag = sqrt( terrain->heightfield->width*terrain->heightfield->width + terrain->heightfield->height*terrain->heightfield->height );
   
   VCStoCCS = perspective( fovy, 
                           windowWidth/(float)windowHeight, 
@@ -108,7 +130,7 @@ void Scene::draw( bool useItemTags )
   }
 
 
-  mat4 M = translate( -1*(int)(terrain->texture->width)/2, -1*(int)(terrain->texture->height)/2, 0 );
+  mat4 M = translate( -1*(int)(terrain->heightfield->width)/2, -1*(int)(terrain->heightfield->height)/2, 0 );
   mat4 V = arcball->V;
 
   mat4 MV = V * M;
@@ -116,6 +138,9 @@ void Scene::draw( bool useItemTags )
   
   vec3 lightDir = vec3( LIGHT_DIR ).normalize();
 
+  if (terrain->isTiled())
+    focusTiles( M );
+
   // Draw control points
 
   ctrlPoints->draw( drawTrack, MV, MVP, lightDir, POST_COLOUR );
@@ -158,9 +183,17 @@ void Scene::draw( bool useItemTags )
 
   // Draw status message
 
-  ostrstream message;
-  message << "using " << spline->name() << "        speed " << std::setprecision(2) << train->getSpeed() << '\0';
-  render_text( message.str(), 10, 10, window );
+  char message[200];
+  snprintf( message, sizeof(message), "using %s        %s physics        speed %.2g",
+            spline->name(), train->physicsName(), train->getSpeed() );
+  render_text( message, 10, 10, window );
+
+  if (terrain->isTiled()) {
+    terrain->tileStats( message, sizeof(message) );
+    render_text( message, 10, 35, window );
+  }
+
+  profiler.drawHUD( window );
 
   // Done
   
@@ -169,6 +202,44 @@ void Scene::draw( bool useItemTags )
 
 
 
+// Tell a tiled terrain where to draw: around the eye, the point
+// looked at and the train.  Prefetch tiles along the track ahead of
+// the train.
+
+
+void Scene::focusTiles( mat4 &M )
+
+{
+  mat4 Minv = M.inverse();
+  mat4 VMinv = Minv * arcball->Vinverse();  // VCS to terrain coordinates
+
+  tileFocus.clear();
+  tilePrefetch.clear();
+
+  tileFocus.add( (VMinv * vec4( 0, 0, 0, 1 )).toVec3() );
+  tileFocus.add( (VMinv * vec4( 0, 0, -arcball->distToCentre, 1 )).toVec3() );
+
+  if (ctrlPoints->count() > 1) {
+
+    float length = spline->totalArcLength();
+    float s = train->getPos();
+    float step = (train->getSpeed() < 0 ? -1 : 1) * (float) terrain->heightfield->tileSize;
+
+    tileFocus.add( spline->value( spline->paramAtArcLength( s ) ) );
+
+    for (int i=1; i<=TILE_PREFETCH_POINTS; i++) {
+      float ahead = fmod( s + i*step, length );
+      if (ahead < 0)
+        ahead += length;
+      tilePrefetch.add( spline->value( spline->paramAtArcLength( ahead ) ) );
+    }
+  }
+
+  terrain->setFocus( tileFocus, tilePrefetch );
+}
+
+
+
 // Key callback
 
 
@@ -210,25 +281,38 @@ void Scene::keyCallback( GLFWwindow* window, int key, int scancode, int action,
       flag = !flag;  // general purpose
       break;
 
-    case 'S':                   // store the scene
-      if (write())
-        cout << "Scene stored in '" << sceneFile << "'." << endl;
-      else
-        cerr << "FAILED to store scene in '" << sceneFile << "'." << endl;
+    case 'S':                   // store the scene (on the journal's writer thread)
+      journal->compact( true );
+      break;
+
+    case 'L':                   // reload the terrain
+      reloadTerrain();
       break;
 
     case 'M':                   // change the change-of-basis matrix
-      spline->nextCOB();
+      input( InputEvent( INPUT_NEXT_COB ) );
+      break;
+
+    case 'E':                   // change the physical model of the train
+      input( InputEvent( INPUT_NEXT_PHYSICS ) );
+      break;
+
+    case '[':                   // fewer train cars
+      input( InputEvent( INPUT_FEWER_CARS ) );
+      break;
+
+    case ']':                   // more train cars
+      input( InputEvent( INPUT_MORE_CARS ) );
       break;
 
     case '+':
     case '=':
-      train->accelerate();
+      input( InputEvent( INPUT_ACCELERATE ) );
       break;
 
     case '-':
     case '_':
-      train->brake();
+      input( InputEvent( INPUT_BRAKE ) );
       break;
 
     case 'R':
@@ -247,6 +331,17 @@ void Scene::keyCallback( GLFWwindow* window, int key, int scancode, int action,
       carView = !carView;
       break;
 
+    case 'H':
+      profiler.showHUD = !profiler.showHUD;
+      break;
+
+    case 'J':                   // dump the recent frame timings
+      if (profiler.writeTrace( PROFILE_TRACE_FILE ))
+        cout << "Profile trace stored in '" << PROFILE_TRACE_FILE << "'." << endl;
+      else
+        cerr << "FAILED to store profile trace in '" << PROFILE_TRACE_FILE << "'." << endl;
+      break;
+
     case '/':  // = ?
       cout << "Click to add a control point." << endl
            << "Ctrl-click to delete a control point." << endl
@@ -254,14 +349,19 @@ void Scene::keyCallback( GLFWwindow* window, int key, int scancode, int action,
            << "Change a control point's height by dragging its top." << endl
            << endl
 	   << "-/+ change train speed" << endl
+           << "[/] change number of train cars" << endl
            << "a - toggle arc length parameterization" << endl
            << "c - toggle coaster drawing" << endl
            << "d - toggle debug mode (shows local coordinate frame on track)" << endl
+           << "e - cycle through train physics models" << endl
            << "f - toggle flag (useful for debugging)" << endl
+           << "h - toggle profiler display" << endl
+           << "j - write profile of recent frames to '" << PROFILE_TRACE_FILE << "' (open in chrome://tracing)" << endl
+           << "l - reload the terrain (unchanged textures are reused)" << endl
            << "m - cycle through CoB matrices" << endl
            << "p - toggle pause" << endl
            << "r - read initial view" << endl
-           << "s - store scene in '" << sceneFile << "'" << endl
+           << "s - store scene in '" << sceneFile << "' (edits are also saved as they are made, in '" << journal->filename() << "')" << endl
            << "t - toggle track drawing" << endl
            << "u - toggle underside of terrain" << endl
            << "v - toggle car view" << endl
@@ -312,8 +412,17 @@ void Scene::writeView()
 void Scene::getMouseRay( int mouseX, int mouseY, vec3 &rayStart, vec3 &rayDir )
 
 {
+  // The inverse projection is only recomputed when the projection
+  // changes (VCStoCCS is rebuilt every frame, but rarely differs)
+
+  if (!haveCCStoVCS || CCStoVCSof != VCStoCCS) {
+    CCStoVCS = VCStoCCS.inverse( TRANSFORM_PROJECTIVE );
+    CCStoVCSof = VCStoCCS;
+    haveCCStoVCS = true;
+  }
+
   vec4 ccsMouse( mouseX/(float)windowWidth*2-1, -1 * (mouseY/(float)windowHeight*2-1), 0, 1 );  // [-1,1]x[-1,1]x0x1
-  vec3 wcsMouse = ((VCStoCCS * arcball->V).inverse() * ccsMouse).toVec3();
+  vec3 wcsMouse = (arcball->Vinverse() * (CCStoVCS * ccsMouse)).toVec3();
   
   rayStart = arcball->eyePosition();
   rayDir   = (wcsMouse - rayStart).normalize();
@@ -364,7 +473,7 @@ void Scene::mouseButtonCallback( GLFWwindow* window, int button, int action, int
       vec3 start,dir;
       getMouseRay( xpos, ypos, start, dir ); // sets 'start' and 'dir'
 
-      mat4 M = translate( -1*(int)(terrain->texture->width)/2, -1*(int)(terrain->texture->height)/2, 0 );
+      mat4 M = translate( -1*(int)(terrain->heightfield->width)/2, -1*(int)(terrain->heightfield->height)/2, 0 );
 
       int hitID = ctrlPoints->findSelectedPoint( start, dir, M );
 
@@ -378,7 +487,7 @@ void Scene::mouseButtonCallback( GLFWwindow* window, int button, int action, int
 
         selectedCtrlPoint = hitID / 2;
         movingSelectedBase = ((hitID % 2) == 0); // base names are even; top names are odd
-        startCtrlPointPos = ctrlPoints->points[selectedCtrlPoint];
+        startCtrlPointPos = ctrlPoints->top( selectedCtrlPoint );
       }
     }
 
@@ -421,7 +530,7 @@ void Scene::mouseMovementCallback( GLFWwindow* window, double xpos, double ypos
   vec3 updir = arcball->upDirection();
   vec3 n     = (dir ^ updir).normalize();
 
-  mat4 M = translate( -1*(int)(terrain->texture->width)/2, -1*(int)(terrain->texture->height)/2, 0 );
+  mat4 M = translate( -1*(int)(terrain->heightfield->width)/2, -1*(int)(terrain->heightfield->height)/2, 0 );
 
   // Perform the action
 
@@ -433,7 +542,7 @@ void Scene::mouseMovementCallback( GLFWwindow* window, double xpos, double ypos
     bool found = terrain->findIntPoint( start, dir, n, intPoint, M );
 
     if (found)
-      ctrlPoints->moveBase( selectedCtrlPoint, intPoint );
+      input( InputEvent( INPUT_MOVE_BASE, selectedCtrlPoint, intPoint ) );
     
   } else {
 
@@ -448,7 +557,7 @@ void Scene::mouseMovementCallback( GLFWwindow* window, double xpos, double ypos
     //
     // Solve for t in n*(base + t*vertical) = d
 
-    vec3 base = (M * vec4( ctrlPoints->bases[ selectedCtrlPoint ], 1 )).toVec3();
+    vec3 base = (M * vec4( ctrlPoints->base( selectedCtrlPoint ), 1 )).toVec3();
     vec3 vertical(0,0,1);
 
     if (fabs(n*vertical) < 0.001)
@@ -459,7 +568,7 @@ void Scene::mouseMovementCallback( GLFWwindow* window, double xpos, double ypos
     if (t < 1)
       return;
 
-    ctrlPoints->setHeight( selectedCtrlPoint, t );
+    input( InputEvent( INPUT_SET_HEIGHT, selectedCtrlPoint, vec3(0,0,t) ) );
   }
 }
 
@@ -478,7 +587,7 @@ void Scene::mouseClick( vec3 mousePosition, int keyModifiers )
 {
   // Find ray from eye through mouse
 
-  mat4 M = translate( -1*(int)(terrain->texture->width)/2, -1*(int)(terrain->texture->height)/2, 0 );
+  mat4 M = translate( -1*(int)(terrain->heightfield->width)/2, -1*(int)(terrain->heightfield->height)/2, 0 );
 
   vec3 start,dir;
   getMouseRay( mousePosition.x, mousePosition.y, start, dir ); // sets 'start' and 'dir'
@@ -493,7 +602,7 @@ void Scene::mouseClick( vec3 mousePosition, int keyModifiers )
     int hitID = ctrlPoints->findSelectedPoint( start, dir, M );
 
     if (hitID >= 0)
-      ctrlPoints->deletePoint( hitID/2 ); // IDs i and i+1 are for the bottom/top of a post.  Post ID is i/2.
+      input( InputEvent( INPUT_DELETE_POINT, hitID/2, vec3(0,0,0) ) ); // IDs i and i+1 are for the bottom/top of a post.  Post ID is i/2.
 
   } else {
 
@@ -502,8 +611,53 @@ void Scene::mouseClick( vec3 mousePosition, int keyModifiers )
     vec3 intPoint;
 
     if (terrain->findIntPoint( start, dir, n, intPoint, M ))
-      ctrlPoints->addPoint( intPoint );
+      input( InputEvent( INPUT_ADD_POINT, 0, intPoint ) );
+  }
+}
+
+
+
+// Apply an input event that changes the simulation.  All such
+// changes go through here so that they can be recorded.
+
+
+void Scene::input( InputEvent e )
+
+{
+  if (recorder != NULL)
+    recorder->recordInput( e );
+
+  applyInputEvent( e, ctrlPoints, train );
+
+  if (journal != NULL && journal->isEdit( e ))
+    journal->append( e );
+}
+
+
+bool Scene::startRecording( const char *filename )
+
+{
+  recorder = new Recorder();
+
+  if (!recorder->start( filename, ctrlPoints, train )) {
+    delete recorder;
+    recorder = NULL;
+    return false;
   }
+
+  return true;
+}
+
+
+void Scene::stopRecording()
+
+{
+  if (recorder == NULL)
+    return;
+
+  recorder->finish();
+  delete recorder;
+  recorder = NULL;
 }
 
 
@@ -530,70 +684,107 @@ void Scene::read( const char *filename )
       basePath[0] = '\0';
   }
 
-  // Open file
-  
-  ifstream in( filename );
+  // Read the file, text or binary
+
+  SceneFile file;
 
-  if (!in) {
+  if (!file.read( filename )) {
     cerr << "Could not open file '" << filename << "'." << endl;
     exit(1);
   }
 
-  string cmd;
-  in >> cmd;
-  while (in) {
+  if (file.hasTerrain) {
+    terrain = new Terrain( string(basePath), file.heightfieldName, file.textureName, file.heightScale );
+    if (terrain->hasFailed())   // no header, so nothing to show
+      exit(1);
+  }
 
-    if (cmd == "terrain") {
+  train->setLosses( file.friction, file.drag );
 
-      string heightFile, textureFile;
-      in >> heightFile >> textureFile;
+  ctrlPoints->clear();
+  ctrlPoints->addPointsWithHeights( file.points, file.numPoints );
 
-      terrain = new Terrain( string(basePath), heightFile, textureFile );
-      in >> cmd;
+  // Apply the edits saved since the scene was last stored
 
-    } else if (cmd == "points") {
+  delete journal;
+  journal = new SceneJournal();
+  journal->open( filename, file, ctrlPoints );
 
-      ctrlPoints->clear();
+  free( basePath ); 
+}
 
-      in >> cmd;
 
-      while (in && (isdigit(cmd.c_str()[0]) || cmd.c_str()[0] == '-' || cmd.c_str()[0] == '.')) {
-        float y, z, h;
-        in >> y >> z >> h;
-        ctrlPoints->addPointWithHeight( vec3( atof(cmd.c_str()), y, z ), h );
-        in >> cmd;
+// Store any edits in the scene file, and wait for the journal's
+// writer to finish
 
-      }
-    }
-  }
 
-  free( basePath ); 
+void Scene::closeJournal()
+
+{
+  if (journal == NULL)
+    return;
+
+  if (journal->hasEdits())
+    journal->compact( false );
+
+  delete journal;
+  journal = NULL;
 }
 
 
-// Write to the scenefile
+// Reload the terrain from its files, e.g. after they have been
+// edited.  The texture comes from the texture cache if it hasn't
+// changed.  The current terrain is drawn until the new one is ready,
+// and is kept if the new one can't be loaded.
 
 
-bool Scene::write()
+void Scene::reloadTerrain()
 
 {
-  ofstream out( sceneFile );
+  string basePath = terrain->basePath;
+  string heightFile = terrain->heightfield->name;
+  string textureFile = terrain->textureName; // the handle might still be loading
+  float heightScale = (terrain->defaultHeightScale ? 0 : terrain->heightScale);
+
+  delete newTerrain;            // an earlier reload that hasn't finished
+
+  newTerrain = new Terrain( basePath, heightFile, textureFile, heightScale );
+}
+
+
+// Read only the track from a scene file (no terrain and no OpenGL
+// needed).  The rest of the scene (e.g. the losses) is left in 'file'.
+
 
-  if (!out)
+bool Scene::readTrack( const char *filename, CtrlPoints *ctrlPoints, SceneFile &file )
+
+{
+  if (!file.read( filename ))
     return false;
 
-  out << "terrain" << endl;
-  out << "  " << terrain->heightfield->name << endl;
-  out << "  " << terrain->texture->name << endl;
-  out << endl;
-  out << "points" << endl;
-  for (int i=0; i<ctrlPoints->bases.size(); i++)
-    out << "  " << ctrlPoints->bases[i] << " " << ctrlPoints->points[i].z - ctrlPoints->bases[i].z << endl;
+  ctrlPoints->clear();
+  ctrlPoints->addPointsWithHeights( file.points, file.numPoints );
 
   return true;
 }
 
 
+// Write the control points to a scene file, along with the terrain
+// given in 'file' (if any)
+
+
+bool Scene::writeTrack( SceneFile &file, CtrlPoints *ctrlPoints, const char *filename, bool binary )
+
+{
+  seq<float> points;
+  ctrlPoints->getPointsWithHeights( points );
+
+  file.setPoints( points.data(), points.size() / 4 );
+
+  return file.write( filename, binary );
+}
+
+
 // Draw the track
 
 
@@ -603,6 +794,8 @@ bool Scene::write()
 
 void Scene::drawAllTrack( mat4 &MV, mat4 &MVP, vec3 lightDir )
 {
+  PROFILE_GPU_SCOPE( "drawAllTrack" );
+
   int divs_per_seg = 20;
 
   vec3 color = vec3(0.2,1.0,0.4);
@@ -615,37 +808,43 @@ void Scene::drawAllTrack( mat4 &MV, mat4 &MVP, vec3 lightDir )
   
 
   float trackLength = spline->totalArcLength();
-  int numPoints = trackLength;
-  float posIncrement = 1;
+
+  // Sample the track adaptively: few samples on straights, more on
+  // tight turns
+
+  int numPoints = spline->tessellate( DEFAULT_CHORD_TOLERANCE, DEFAULT_ANGLE_TOLERANCE );
 
   vec3 maxPointY = vec3(0,0,0);
   vec3 minPointY = vec3(100000,100000,1000000);
 
-  vec3 points[numPoints];
-  vec3 leftPoints[numPoints];
-  vec3 rightPoints[numPoints];
-  vec3 colours[numPoints];
-  for (int i = 0; i < numPoints; i++) {
-    float pos = i * posIncrement;
-    float t = spline->paramAtArcLength(pos);
-    vec3 point = spline->value(t);
-    points[i] = point;
-    colours[i] = color;
+  vec3 *points = frameArena->alloc<vec3>( numPoints );
+  vec3 *leftPoints = frameArena->alloc<vec3>( numPoints );
+  vec3 *rightPoints = frameArena->alloc<vec3>( numPoints );
+  vec3 *colours = frameArena->alloc<vec3>( numPoints );
+  int i = 0;
+  for (int seg = 0; seg < spline->data.size(); seg++) {
+    seq<float> &u = spline->tessSamples(seg);
+    for (int j = 0; j < u.size(); j++, i++) {
+      float t = seg + u[j];
+      vec3 o, x, y, z;
+      spline->findLocalSystem(t, o, x, y, z);
+
+      vec3 point = o;
+      points[i] = point;
+      colours[i] = color;
+
+      if (point.y > maxPointY.y) {
+        maxPointY = point;
+      }
+      if (point.y < minPointY.y) {
+        minPointY = point;
+      }
 
-    if (point.y > maxPointY.y) {
-      maxPointY = point;
+      vec3 leftPoint = point + distanceBetweenRails / 2 * x + triangleHeight * y;
+      vec3 rightPoint = point - distanceBetweenRails / 2 * x + triangleHeight * y;
+      leftPoints[i] = leftPoint;
+      rightPoints[i] = rightPoint;
     }
-    if (point.y < minPointY.y) {
-      minPointY = point;
-    }
-
-    vec3 o, x, y, z;
-    spline->findLocalSystem(t, o, x, y, z);
-
-    vec3 leftPoint = point + distanceBetweenRails / 2 * x + triangleHeight * y;
-    vec3 rightPoint = point - distanceBetweenRails / 2 * x + triangleHeight * y;
-    leftPoints[i] = leftPoint;
-    rightPoints[i] = rightPoint;
   }
   
   // draw main track
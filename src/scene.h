@@ -12,6 +12,9 @@
 #include "spline.h"
 #include "ctrlPoints.h"
 #include "train.h"
+#include "recording.h"
+#include "sceneFile.h"
+#include "journal.h"
 
 
 #define TRACK_PIECES_PER_SEG  20
@@ -25,6 +28,7 @@ class Scene {
   static const char *vertexShader;
 
   Terrain    *terrain;
+  Terrain    *newTerrain;       // being loaded by reloadTerrain(), or NULL
   Spline     *spline;
   CtrlPoints *ctrlPoints;
   char       *sceneFile;
@@ -34,9 +38,18 @@ class Scene {
 
   GLFWwindow *window;
 
+  Recorder   *recorder;         // non-NULL while recording
+  SceneJournal *journal;        // saves track edits as they're made
+
   mat4       VCStoCCS;
+  mat4       CCStoVCS;          // inverse of VCStoCCS when it was 'CCStoVCSof'
+  mat4       CCStoVCSof;
+  bool       haveCCStoVCS;
   float      fovy;
 
+  seq<vec3>  tileFocus;         // for a tiled terrain
+  seq<vec3>  tilePrefetch;
+
   // user-settable flags
 
   bool       drawTrack;
@@ -65,7 +78,9 @@ class Scene {
   Scene( char *sceneFilename, GLFWwindow *w );
 
   void read( const char *filename );
-  bool write();
+  static bool readTrack( const char *filename, CtrlPoints *ctrlPoints, SceneFile &file );
+  static bool writeTrack( SceneFile &file, CtrlPoints *ctrlPoints, const char *filename, bool binary );
+  void closeJournal();
 
   void draw( bool useItemTags );
 
@@ -77,12 +92,22 @@ class Scene {
   void mouseClick( vec3 v, int keyModifiers );
 
   void drawAllTrack( mat4 &MV, mat4 &MVP, vec3 lightDir );
+  void focusTiles( mat4 &M );
+  void reloadTerrain();
 
   void update( float elapsedSeconds ) {
-    if (ctrlPoints->count() > 1 && !pause)
+    if (ctrlPoints->count() > 1 && !pause) {
       train->advance( elapsedSeconds );
+      if (recorder != NULL)
+        recorder->recordStep( elapsedSeconds, train );
+    }
   }
 
+  void input( InputEvent e );   // apply (and record and journal) an input event
+
+  bool startRecording( const char *filename );
+  void stopRecording();
+
   void getMouseRay( int mouseX, int mouseY, vec3 &rayStart, vec3 &rayDir );
 
   void readView();
@@ -0,0 +1,364 @@
+// sceneFile.cpp
+
+
+#include "sceneFile.h"
+
+#include <fstream>
+#include <charconv>
+
+#define MIN(a,b)  ((a)<(b)?(a):(b))
+
+
+// A binary file is little-endian.  On a big-endian machine, its 32-bit
+// words are reversed after they are read and before they are written.
+
+static bool bigEndianHost()
+
+{
+  uint32_t one = 1;
+  unsigned char first;
+  memcpy( &first, &one, 1 );
+  return first == 0;
+}
+
+
+static void reverseWords( char *bytes, size_t numWords )
+
+{
+  for (size_t i=0; i<numWords; i++, bytes+=4) {
+    std::swap( bytes[0], bytes[3] );
+    std::swap( bytes[1], bytes[2] );
+  }
+}
+
+
+SceneFile::SceneFile()
+
+{
+  contents = NULL;
+  hasTerrain = false;
+  heightScale = 0;
+  friction = -1;
+  drag = -1;
+  numPoints = 0;
+  points = NULL;
+  binary = false;
+}
+
+
+SceneFile::~SceneFile()
+
+{
+  delete [] contents;
+}
+
+
+// Read a text or binary scene file.  Returns false if it can't be
+// opened or (with a message) if it is not a valid binary file.
+
+
+bool SceneFile::read( const char *filename )
+
+{
+  char magic[4];
+
+  ifstream in( filename, ios::binary );
+
+  if (!in)
+    return false;
+
+  in.read( magic, sizeof(magic) );
+
+  binary = (in.gcount() == sizeof(magic) && strncmp( magic, SCENE_MAGIC, 4 ) == 0);
+
+  in.close();
+
+  if (binary)
+    return readBinary( filename );
+  else
+    return readText( filename );
+}
+
+
+// Unknown commands are skipped.  A second "points" command replaces
+// the points of the first.
+
+
+bool SceneFile::readText( const char *filename )
+
+{
+  ifstream in( filename );
+
+  if (!in)
+    return false;
+
+  string cmd;
+  in >> cmd;
+  while (in) {
+
+    if (cmd == "terrain") {
+
+      // terrain heightfield texture [scale s]
+      //
+      // where s is the height of a heightfield sample of 1.0 (by
+      // default, 10% of the width for a PNG and 1 for float heights)
+
+      in >> heightfieldName >> textureName >> cmd;
+
+      heightScale = 0;
+      if (in && cmd == "scale")
+        in >> heightScale >> cmd;
+
+      hasTerrain = true;
+
+    } else if (cmd == "physics") {
+
+      // physics [friction f] [drag d]
+      //
+      // Losses in the speed profile and the coupled train physics
+
+      in >> cmd;
+
+      while (in && (cmd == "friction" || cmd == "drag")) {
+        in >> (cmd == "friction" ? friction : drag) >> cmd;
+      }
+
+    } else if (cmd == "points") {
+
+      parsed.clear();
+
+      in >> cmd;
+
+      while (in && (isdigit(cmd.c_str()[0]) || cmd.c_str()[0] == '-' || cmd.c_str()[0] == '.')) {
+        float y, z, h;
+        in >> y >> z >> h;
+        parsed.add( atof(cmd.c_str()) );
+        parsed.add( y );
+        parsed.add( z );
+        parsed.add( h );
+        in >> cmd;
+      }
+
+    } else
+
+      in >> cmd;
+  }
+
+  setPoints( (parsed.size() > 0 ? &parsed[0] : NULL), parsed.size() / 4 );
+
+  return true;
+}
+
+
+bool SceneFile::readBinary( const char *filename )
+
+{
+  ifstream in( filename, ios::binary | ios::ate );
+
+  if (!in)
+    return false;
+
+  size_t size = in.tellg();
+  in.seekg( 0 );
+
+  if (size < SCENE_HEADER_SIZE) {
+    cerr << "Error loading '" << filename << "': the header is incomplete." << endl;
+    return false;
+  }
+
+  contents = new char[ size ];
+
+  if (!in.read( contents, size )) {
+    cerr << "Could not read '" << filename << "'." << endl;
+    return false;
+  }
+
+  bool swap = bigEndianHost();
+
+  if (swap)                     // all but the magic
+    reverseWords( contents + 4, SCENE_HEADER_SIZE/4 - 1 );
+
+  uint32_t field[5];            // magic, version, points, name lengths
+  memcpy( field, contents, sizeof(field) );
+  memcpy( &heightScale, contents + sizeof(field), sizeof(float) );
+
+  if (field[1] < 1 || field[1] > SCENE_VERSION) {
+    cerr << "Error loading '" << filename << "': it is version " << field[1]
+         << ", not 1 to " << SCENE_VERSION << "." << endl;
+    return false;
+  }
+
+  if (field[1] >= 2) {
+    memcpy( &friction, contents + sizeof(field) + sizeof(float), sizeof(float) );
+    memcpy( &drag, contents + sizeof(field) + 2*sizeof(float), sizeof(float) );
+  }
+
+  size_t namesSize = ((size_t) field[3] + field[4] + 3) & ~(size_t) 3;
+  size_t pointsOffset = SCENE_HEADER_SIZE + namesSize;
+
+  if (size < pointsOffset || (size - pointsOffset) / (4 * sizeof(float)) < field[2]) {
+    cerr << "Error loading '" << filename << "': it is shorter than its header says." << endl;
+    return false;
+  }
+
+  if (swap)
+    reverseWords( contents + pointsOffset, 4 * (size_t) field[2] );
+
+  hasTerrain = (field[3] > 0);
+  heightfieldName = string( contents + SCENE_HEADER_SIZE, field[3] );
+  textureName = string( contents + SCENE_HEADER_SIZE + field[3], field[4] );
+
+  setPoints( (const float *) (contents + pointsOffset), field[2] );
+
+  return true;
+}
+
+
+bool SceneFile::write( const char *filename, bool asBinary )
+
+{
+  if (asBinary)
+    return writeBinary( filename );
+  else
+    return writeText( filename );
+}
+
+
+// The shortest text that reads back as the same float
+
+static string exactText( float x )
+
+{
+  char buffer[ 32 ];
+  return string( buffer, std::to_chars( buffer, buffer + sizeof(buffer), x ).ptr );
+}
+
+
+// Numbers are written with to_chars(), which gives the shortest text
+// that reads back as the same float, and is much faster than ostream.
+
+
+bool SceneFile::writeText( const char *filename )
+
+{
+  ofstream out( filename );
+
+  if (!out)
+    return false;
+
+  if (hasTerrain) {
+    out << "terrain" << endl;
+    out << "  " << heightfieldName << endl;
+    out << "  " << textureName << endl;
+    if (heightScale != 0)
+      out << "  scale " << exactText( heightScale ) << endl;
+    out << endl;
+  }
+
+  if (friction >= 0 || drag >= 0) {
+    out << "physics" << endl;
+    if (friction >= 0)
+      out << "  friction " << exactText( friction ) << endl;
+    if (drag >= 0)
+      out << "  drag " << exactText( drag ) << endl;
+    out << endl;
+  }
+
+  out << "points" << endl;
+
+  char buffer[ 65536 ];
+  char *end = buffer + sizeof(buffer);
+  char *p = buffer;
+
+  for (int i=0; i<numPoints; i++) {
+
+    if (end - p < 4 * 20) {     // no room for a line
+      out.write( buffer, p - buffer );
+      p = buffer;
+    }
+
+    *p++ = ' ';
+
+    for (int j=0; j<4; j++) {
+      *p++ = ' ';
+      p = std::to_chars( p, end, points[4*i+j] ).ptr;
+    }
+
+    *p++ = '\n';
+  }
+
+  out.write( buffer, p - buffer );
+
+  return (bool) out;
+}
+
+
+bool SceneFile::writeBinary( const char *filename )
+
+{
+  ofstream out( filename, ios::binary );
+
+  if (!out)
+    return false;
+
+  string names = (hasTerrain ? heightfieldName + textureName : string(""));
+  names.resize( (names.size() + 3) & ~(size_t) 3, '\0' );
+
+  char header[ SCENE_HEADER_SIZE ];
+  memset( header, 0, sizeof(header) );
+
+  uint32_t field[5] = { 0, SCENE_VERSION, (uint32_t) numPoints,
+                        (uint32_t) (hasTerrain ? heightfieldName.size() : 0),
+                        (uint32_t) (hasTerrain ? textureName.size() : 0) };
+
+  memcpy( header, field, sizeof(field) );
+  memcpy( header, SCENE_MAGIC, 4 );
+  memcpy( header + sizeof(field), &heightScale, sizeof(float) );
+  memcpy( header + sizeof(field) + sizeof(float), &friction, sizeof(float) );
+  memcpy( header + sizeof(field) + 2*sizeof(float), &drag, sizeof(float) );
+
+  bool swap = bigEndianHost();
+
+  if (swap)
+    reverseWords( header + 4, SCENE_HEADER_SIZE/4 - 1 );
+
+  out.write( header, sizeof(header) );
+  out.write( names.data(), names.size() );
+
+  if (!swap)
+    out.write( (const char *) points, numPoints * 4 * sizeof(float) );
+  else {
+    char buffer[ 65536 ];
+    size_t size = numPoints * 4 * sizeof(float);
+    for (size_t offset=0; offset<size; offset+=sizeof(buffer)) {
+      size_t n = MIN( sizeof(buffer), size - offset );
+      memcpy( buffer, (const char *) points + offset, n );
+      reverseWords( buffer, n/4 );
+      out.write( buffer, n );
+    }
+  }
+
+  return (bool) out;
+}
+
+
+int convertScene( const char *inFilename, const char *outFilename )
+
+{
+  SceneFile scene;
+
+  if (!scene.read( inFilename )) {
+    cerr << "Could not read '" << inFilename << "'." << endl;
+    return 1;
+  }
+
+  if (!scene.write( outFilename, !scene.binary )) {
+    cerr << "Could not write '" << outFilename << "'." << endl;
+    return 1;
+  }
+
+  cout << "Wrote " << scene.numPoints << " control points to '" << outFilename << "' as "
+       << (scene.binary ? "text" : "binary") << endl;
+
+  return 0;
+}
@@ -0,0 +1,98 @@
+/* sceneFile.h
+ *
+ * The contents of a scene file: the terrain's files and the control
+ * points.  A scene file is either text,
+ *
+ *   terrain
+ *     heightfield
+ *     texture
+ *     [scale s]
+ *
+ *   physics
+ *     [friction f]
+ *     [drag d]
+ *
+ *   points
+ *     x y z height
+ *     ...
+ *
+ * or binary, for large tracks.  A binary file is read with a single
+ * read, and its points are used in place.  It has a 32-byte header
+ *
+ *   char[4]   "RCSN"
+ *   uint32    version (2)
+ *   uint32    number of control points
+ *   uint32    length of the heightfield name (0 = no terrain)
+ *   uint32    length of the texture name
+ *   float32   height scale (0 = the default)
+ *   float32   friction (negative = the default)
+ *   float32   drag (negative = the default)
+ *
+ * (In version 1, the last two were zeros, and meant the defaults.)
+ *
+ * followed by the two names (without terminators), padded with zeros
+ * to a multiple of four bytes, and then four float32s per control
+ * point: the base x, y, z and the height.  Everything is
+ * little-endian, and is converted as it is read on a big-endian
+ * machine.
+ *
+ * read() tells the two apart from the first bytes of the file.
+ * Text is written with the fewest digits that read back exactly.
+ */
+
+
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "headers.h"
+#include "seq.h"
+
+
+#define SCENE_MAGIC        "RCSN"
+#define SCENE_VERSION      2
+#define SCENE_HEADER_SIZE  32
+
+
+class SceneFile {
+
+  char      *contents;          // of a binary file
+  seq<float> parsed;            // points of a text file
+
+  bool readText( const char *filename );
+  bool readBinary( const char *filename );
+  bool writeText( const char *filename );
+  bool writeBinary( const char *filename );
+
+ public:
+
+  bool   hasTerrain;
+  string heightfieldName;
+  string textureName;
+  float  heightScale;           // 0 = the default
+  float  friction;              // coefficient of rolling friction (negative = the default)
+  float  drag;                  // air drag per unit of arc length (negative = the default)
+
+  int    numPoints;
+  const float *points;          // 4 floats per point: base x, y, z and height
+
+  bool   binary;                // read from a binary file
+
+  SceneFile();
+  ~SceneFile();
+
+  bool read( const char *filename );
+  bool write( const char *filename, bool asBinary );
+
+  void setPoints( const float *p, int n ) {
+    points = p;
+    numPoints = n;
+  }
+};
+
+
+// Convert a scene file to the other format (the -convert option)
+
+int convertScene( const char *inFilename, const char *outFilename );
+
+
+#endif
@@ -1,249 +1,343 @@
-/* seq.h
- *
- * A structure to hold a sequence of elements.
- *
- *   PUBLIC VARIABLES
- *
- *     none!
- *
- *   CONSTRUCTORS
- *
- *     seq()               Create an empty sequence
- *
- *   PUBLIC FUNCTIONS
- *
- *     add( x )            Add x to the end of the sequence
- *     remove()            Remove the last element of the sequence
- *     remove( i )         Remove the i^{th} element of the sequence (expensive)
- *     shift( i )          Shift right everything starting at position i
- *     operator [i]        Returns the i^{th} element (starting from 0)
- *     exists( x )         Return true if x exists in sequence, false otherwise
- *     clear()             Deletes the whole sequence
- *     findIndex( x )      Find the index of element x, or -1 if it doesn't exist
- */
-
-
-#ifndef SEQ_H
-#define SEQ_H
-
-#include "headers.h"
-
-#include <iostream>
-#include <stdlib.h>
-
-using namespace std;
-
-
-template<class T> class seq {
-
-  int storageSize;
-  int numElements;
-  T  *data;
-
-public:
-
-  seq() {                       // constructor
-    storageSize = 2;
-    numElements = 0;
-    data = new T[ storageSize ];
-  }
-
-  seq( int n ) {                // constructor
-    storageSize = n;
-    numElements = 0;
-    data = new T[ storageSize ];
-  }
-
-  ~seq() {                      // destructor
-    delete [] data;
-  }
-
-  seq( const seq<T> & source ) { // copy constructor
-
-    storageSize = source.storageSize;
-    numElements = source.numElements;
-    data = new T[ storageSize ];
-    for (int i=0; i<numElements; i++)
-      data[i] = source.data[i];
-  }
-
-  void remove() {
-    if (numElements == 0) {
-      cerr << "remove: Tried to remove element from empty sequence\n";
-      exit(-1);
-    }
-
-    numElements = numElements - 1;
-  }
-
-  void remove( int i );
-  void shift( int i );
-  void compress();
-
-  int size() const {
-    return numElements;
-  }
-
-  T & operator [] ( int i ) const {
-    if (i >= numElements || i < 0) {
-      cerr << "element: Tried to access an element beyond the range of the sequence: "
-           << i << "(numElements = " << numElements << ")\n";
-      exit(-1);
-    }
-    return data[ i ];
-  }
-
-  void clear() {
-    delete [] data;
-    storageSize = 1;
-    numElements = 0;
-    data = new T[ storageSize ];
-  }
-
-  seq<T> & operator = (const seq<T> &source) { // assignment operator
-    storageSize = source.storageSize;
-    numElements = source.numElements;
-    delete [] data;
-    data = new T[ storageSize ];
-    for (int i=0; i<numElements; i++)
-      data[i] = source.data[i];
-    return *this;
-  }
-
-  void add( const T &x );
-  int findIndex( const T &x );
-  bool exists( const T &x );
-};
-
-
-// Add an element to the end of the sequence
-
-template<class T>
-void 
-seq<T>::add( const T &x )
-
-{
-  // No storage left?  If so, double the storage
-
-  if (numElements == storageSize) {
-    T *newData;
-
-    newData = new T[ storageSize * 2 ];
-    for (int i=0; i<storageSize; i++)
-      newData[i] = data[i];
-    storageSize = storageSize * 2;
-    delete [] data;
-    data = newData;
-  }
-
-  // Store the element in the next available position
-
-  data[ numElements ] = x;
-  numElements++;
-}
-
-
-// Compress the array
-
-template<class T>
-void 
-seq<T>::compress()
-
-{
-  T *newData;
-
-  if (numElements == storageSize)
-    return;
-
-  newData = new T[ numElements ];
-  for (int i=0; i<numElements; i++)
-    newData[i] = data[i];
-  storageSize = numElements;
-  delete [] data;
-  data = newData;
-}
-
-
-// Find and return an element
-
-template<class T>
-bool 
-seq<T>::exists( const T &x )
-
-{
-  for (int i=0; i<numElements; i++)
-    if (data[i] == x)
-      return true;
-
-  return false;
-}
-
-
-// Find and return the *index* of an element
-
-template<class T>
-int 
-seq<T>::findIndex( const T &x )
-
-{
-  for (int i=0; i<numElements; i++)
-    if (data[i] == x)
-      return i;
-
-  return -1;
-}
-
-
-// Shift a suffix of the sequence to the right by one
-
-template<class T>
-void 
-seq<T>::shift( int i )
-
-{
-  if (i < 0 || i >= numElements) {
-    cerr << "remove: Tried to shift element " << i
-         << " from a sequence of " << numElements << " elements \n";
-    exit(-1);
-  }
-
-  if (numElements == storageSize) {
-    T *newData;
-
-    newData = new T[ storageSize * 2 ];
-    for (int i=0; i<storageSize; i++)
-      newData[i] = data[i];
-    storageSize = storageSize * 2;
-    delete [] data;
-    data = newData;
-  }
-
-  for (int j=numElements; j>i; j--)
-    data[j] = data[j-1];
-
-  numElements++;
-}
-
-
-// Shift a suffix of the sequence to the left by one
-
-template<class T>
-void 
-seq<T>::remove( int i )
-
-{
-  if (i < 0 || i >= numElements) {
-    cerr << "remove: Tried to remove element " << i
-         << " from a sequence of " << numElements << " elements \n";
-    exit(-1);
-  }
-
-  for (int j=i; j<numElements-1; j++)
-    data[j] = data[j+1];
-
-  numElements--;
-}
-
-
-
-#endif
+/* seq.h
+ *
+ * A structure to hold a sequence of elements.
+ *
+ *   PUBLIC VARIABLES
+ *
+ *     none!
+ *
+ *   CONSTRUCTORS
+ *
+ *     seq()               Create an empty sequence (no storage until the first add)
+ *     seq( n )            Create an empty sequence with storage for n elements
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     add( x )            Add x to the end of the sequence (x is moved if it's a temporary)
+ *     remove()            Remove the last element of the sequence
+ *     remove( i )         Remove the i^{th} element of the sequence (expensive)
+ *     shift( i )          Shift right everything starting at position i
+ *     operator [i]        Returns the i^{th} element (starting from 0)
+ *     exists( x )         Return true if x exists in sequence, false otherwise
+ *     clear()             Empties the sequence, keeping its storage
+ *     compress()          Shrinks the storage to fit the elements
+ *     reserve( n )        Makes room for at least n elements
+ *     capacity()          Returns the number of elements that fit without reallocating
+ *     findIndex( x )      Find the index of element x, or -1 if it doesn't exist
+ *
+ *     data()              Returns a pointer to the elements, for hot loops.
+ *     begin(), end()      There is no bounds check, and the pointer is only
+ *                         valid until the sequence next grows.  begin() and
+ *                         end() allow 'for (T &x : s)'.
+ *
+ * operator [] checks its index and exits if it's out of range.  The
+ * check is compiled out if NDEBUG is defined (as in a release build).
+ *
+ * The storage doubles when it fills up, and the elements are moved,
+ * not copied, to the new storage.  Sequences can be moved, which
+ * takes their storage rather than copying it.
+ */
+
+
+#ifndef SEQ_H
+#define SEQ_H
+
+#include "headers.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <utility>
+
+using namespace std;
+
+
+template<class T> class seq {
+
+  int storageSize;
+  int numElements;
+  T  *elements;
+
+  void grow( int minSize );
+
+public:
+
+  seq() {                       // constructor
+    storageSize = 0;
+    numElements = 0;
+    elements = NULL;
+  }
+
+  seq( int n ) {                // constructor
+    storageSize = n;
+    numElements = 0;
+    elements = (n > 0 ? new T[ storageSize ] : NULL);
+  }
+
+  ~seq() {                      // destructor
+    delete [] elements;
+  }
+
+  seq( const seq<T> & source ) { // copy constructor
+
+    storageSize = source.numElements;
+    numElements = source.numElements;
+    elements = (storageSize > 0 ? new T[ storageSize ] : NULL);
+    for (int i=0; i<numElements; i++)
+      elements[i] = source.elements[i];
+  }
+
+  seq( seq<T> && source ) {     // move constructor
+
+    storageSize = source.storageSize;
+    numElements = source.numElements;
+    elements = source.elements;
+
+    source.storageSize = 0;
+    source.numElements = 0;
+    source.elements = NULL;
+  }
+
+  void remove() {
+#ifndef NDEBUG
+    if (numElements == 0) {
+      cerr << "remove: Tried to remove element from empty sequence\n";
+      exit(-1);
+    }
+#endif
+    numElements = numElements - 1;
+  }
+
+  void remove( int i );
+  void shift( int i );
+  void compress();
+
+  int size() const {
+    return numElements;
+  }
+
+  int capacity() const {
+    return storageSize;
+  }
+
+  void reserve( int n ) {
+    if (n > storageSize)
+      grow( n );
+  }
+
+  T & operator [] ( int i ) const {
+#ifndef NDEBUG
+    if (i >= numElements || i < 0) {
+      cerr << "element: Tried to access an element beyond the range of the sequence: "
+           << i << "(numElements = " << numElements << ")\n";
+      exit(-1);
+    }
+#endif
+    return elements[ i ];
+  }
+
+  T * data() const {            // unchecked access
+    return elements;
+  }
+
+  T * begin() const {
+    return elements;
+  }
+
+  T * end() const {
+    return elements + numElements;
+  }
+
+  void clear() {
+    numElements = 0;
+  }
+
+  seq<T> & operator = (const seq<T> &source) { // assignment operator
+    if (this == &source)
+      return *this;
+    if (storageSize < source.numElements) {
+      delete [] elements;
+      storageSize = source.numElements;
+      elements = new T[ storageSize ];
+    }
+    numElements = source.numElements;
+    for (int i=0; i<numElements; i++)
+      elements[i] = source.elements[i];
+    return *this;
+  }
+
+  seq<T> & operator = (seq<T> &&source) { // move assignment operator
+    if (this == &source)
+      return *this;
+    delete [] elements;
+    storageSize = source.storageSize;
+    numElements = source.numElements;
+    elements = source.elements;
+    source.storageSize = 0;
+    source.numElements = 0;
+    source.elements = NULL;
+    return *this;
+  }
+
+  void add( const T &x );
+  void add( T &&x );
+  int findIndex( const T &x );
+  bool exists( const T &x );
+};
+
+
+// Grow the storage to at least minSize elements, and at least double
+// its current size, moving the elements over
+
+template<class T>
+void 
+seq<T>::grow( int minSize )
+
+{
+  int newSize = storageSize * 2;
+  if (newSize < minSize)
+    newSize = minSize;
+  if (newSize < 2)
+    newSize = 2;
+
+  T *newElements = new T[ newSize ];
+  for (int i=0; i<numElements; i++)
+    newElements[i] = std::move( elements[i] );
+  storageSize = newSize;
+  delete [] elements;
+  elements = newElements;
+}
+
+
+// Add an element to the end of the sequence
+
+template<class T>
+void 
+seq<T>::add( const T &x )
+
+{
+  // No storage left?  If so, double the storage.  x might be one of
+  // our own elements, so copy it before the old storage goes away.
+
+  if (numElements == storageSize) {
+    T copy( x );
+    grow( storageSize+1 );
+    elements[ numElements ] = std::move( copy );
+  } else
+    elements[ numElements ] = x;
+
+  numElements++;
+}
+
+
+template<class T>
+void 
+seq<T>::add( T &&x )
+
+{
+  if (numElements == storageSize) {
+    T moved( std::move( x ) );
+    grow( storageSize+1 );
+    elements[ numElements ] = std::move( moved );
+  } else
+    elements[ numElements ] = std::move( x );
+
+  numElements++;
+}
+
+
+// Compress the array
+
+template<class T>
+void 
+seq<T>::compress()
+
+{
+  T *newElements;
+
+  if (numElements == storageSize)
+    return;
+
+  newElements = (numElements > 0 ? new T[ numElements ] : NULL);
+  for (int i=0; i<numElements; i++)
+    newElements[i] = std::move( elements[i] );
+  storageSize = numElements;
+  delete [] elements;
+  elements = newElements;
+}
+
+
+// Find and return an element
+
+template<class T>
+bool 
+seq<T>::exists( const T &x )
+
+{
+  for (int i=0; i<numElements; i++)
+    if (elements[i] == x)
+      return true;
+
+  return false;
+}
+
+
+// Find and return the *index* of an element
+
+template<class T>
+int 
+seq<T>::findIndex( const T &x )
+
+{
+  for (int i=0; i<numElements; i++)
+    if (elements[i] == x)
+      return i;
+
+  return -1;
+}
+
+
+// Shift a suffix of the sequence to the right by one
+
+template<class T>
+void 
+seq<T>::shift( int i )
+
+{
+  if (i < 0 || i >= numElements) {
+    cerr << "remove: Tried to shift element " << i
+         << " from a sequence of " << numElements << " elements \n";
+    exit(-1);
+  }
+
+  if (numElements == storageSize)
+    grow( storageSize+1 );
+
+  for (int j=numElements; j>i; j--)
+    elements[j] = std::move( elements[j-1] );
+
+  numElements++;
+}
+
+
+// Shift a suffix of the sequence to the left by one
+
+template<class T>
+void 
+seq<T>::remove( int i )
+
+{
+  if (i < 0 || i >= numElements) {
+    cerr << "remove: Tried to remove element " << i
+         << " from a sequence of " << numElements << " elements \n";
+    exit(-1);
+  }
+
+  for (int j=i; j<numElements-1; j++)
+    elements[j] = std::move( elements[j+1] );
+
+  numElements--;
+}
+
+
+
+#endif
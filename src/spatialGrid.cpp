@@ -0,0 +1,312 @@
+// spatialGrid.cpp
+
+
+#include "spatialGrid.h"
+
+
+#define MIN(a,b)  ((a)<(b)?(a):(b))
+#define MAX(a,b)  ((a)>(b)?(a):(b))
+
+
+SpatialGrid::SpatialGrid( float size )
+
+{
+  cellSize = size;
+  buckets = NULL;
+  collectOut = NULL;
+  clear();
+}
+
+
+SpatialGrid::~SpatialGrid()
+
+{
+  delete [] buckets;
+}
+
+
+void SpatialGrid::clear()
+
+{
+  delete [] buckets;
+
+  numBuckets = MIN_GRID_BUCKETS;
+  buckets = new seq<GridEntry>[ numBuckets ];
+  numEntries = 0;
+
+  empty = true;
+}
+
+
+void SpatialGrid::reserve( int n )
+
+{
+  while (n > 2 * numBuckets)
+    grow();
+}
+
+
+void SpatialGrid::addEntry( int id, int ix, int iy )
+
+{
+  buckets[ bucket( ix, iy ) ].add( GridEntry( id, ix, iy ) );
+  numEntries++;
+
+  if (empty) {
+    minX = maxX = ix;
+    minY = maxY = iy;
+    empty = false;
+  } else {
+    if (ix < minX) minX = ix;
+    if (ix > maxX) maxX = ix;
+    if (iy < minY) minY = iy;
+    if (iy > maxY) maxY = iy;
+  }
+
+  if (numEntries > 2 * numBuckets)
+    grow();
+}
+
+
+void SpatialGrid::removeEntry( int id, int ix, int iy )
+
+{
+  seq<GridEntry> &b = buckets[ bucket( ix, iy ) ];
+
+  for (int i=0; i<b.size(); i++)
+    if (b[i].id == id && b[i].ix == ix && b[i].iy == iy) {
+      b[i] = b[ b.size()-1 ];   // order within a bucket doesn't matter
+      b.remove();
+      numEntries--;
+      return;
+    }
+}
+
+
+// Double the number of buckets and rehash
+
+void SpatialGrid::grow()
+
+{
+  seq<GridEntry> *oldBuckets = buckets;
+  int oldNumBuckets = numBuckets;
+
+  numBuckets *= 2;
+  buckets = new seq<GridEntry>[ numBuckets ];
+
+  for (int i=0; i<oldNumBuckets; i++)
+    for (int j=0; j<oldBuckets[i].size(); j++) {
+      GridEntry &e = oldBuckets[i][j];
+      buckets[ bucket( e.ix, e.iy ) ].add( e );
+    }
+
+  delete [] oldBuckets;
+}
+
+
+// Visit the cells crossed by segment ab in order (Amanatides & Woo).
+// The same a and b always visit the same cells, so remove() finds
+// exactly the entries that insert() made.
+
+
+void SpatialGrid::walk( vec3 a, vec3 b, int id, void (SpatialGrid::*fn)( int, int, int ) )
+
+{
+  float x0 = a.x / cellSize, y0 = a.y / cellSize;
+  float x1 = b.x / cellSize, y1 = b.y / cellSize;
+
+  int ix = (int) floor( x0 ), iy = (int) floor( y0 );
+  int ex = (int) floor( x1 ), ey = (int) floor( y1 );
+
+  float dx = fabs( x1 - x0 );
+  float dy = fabs( y1 - y0 );
+
+  int stepX = (x1 > x0 ? 1 : -1);
+  int stepY = (y1 > y0 ? 1 : -1);
+
+  float tMaxX   = (dx > 0 ? (stepX > 0 ? ix+1 - x0 : x0 - ix) / dx : MAXFLOAT);
+  float tMaxY   = (dy > 0 ? (stepY > 0 ? iy+1 - y0 : y0 - iy) / dy : MAXFLOAT);
+  float tDeltaX = (dx > 0 ? 1 / dx : MAXFLOAT);
+  float tDeltaY = (dy > 0 ? 1 / dy : MAXFLOAT);
+
+  (this->*fn)( id, ix, iy );
+
+  int numSteps = abs( ex - ix ) + abs( ey - iy );
+
+  for (int i=0; i<numSteps; i++) {
+
+    if (tMaxX < tMaxY) {
+      ix += stepX;
+      tMaxX += tDeltaX;
+    } else {
+      iy += stepY;
+      tMaxY += tDeltaY;
+    }
+
+    (this->*fn)( id, ix, iy );
+  }
+}
+
+
+void SpatialGrid::insert( int id, vec3 a, vec3 b )
+
+{
+  bool first = empty;
+
+  walk( a, b, id, &SpatialGrid::addEntry );
+
+  if (first) {
+    minZ = MIN( a.z, b.z );
+    maxZ = MAX( a.z, b.z );
+  } else {
+    minZ = MIN( minZ, MIN( a.z, b.z ) );
+    maxZ = MAX( maxZ, MAX( a.z, b.z ) );
+  }
+}
+
+
+void SpatialGrid::remove( int id, vec3 a, vec3 b )
+
+{
+  walk( a, b, id, &SpatialGrid::removeEntry );
+}
+
+
+void SpatialGrid::collectCell( int ix, int iy, seq<int> &ids )
+
+{
+  seq<GridEntry> &b = buckets[ bucket( ix, iy ) ];
+
+  for (int i=0; i<b.size(); i++)
+    if (b[i].ix == ix && b[i].iy == iy)
+      ids.add( b[i].id );
+}
+
+
+// Collect the cells within 'collectMargin' cells of cell (ix,iy).
+// This has the signature of walk()'s callback; 'id' is unused.
+
+void SpatialGrid::collectAround( int id, int ix, int iy )
+
+{
+  for (int x=ix-collectMargin; x<=ix+collectMargin; x++)
+    for (int y=iy-collectMargin; y<=iy+collectMargin; y++)
+      collectCell( x, y, *collectOut );
+}
+
+
+void SpatialGrid::collectAlong( vec3 a, vec3 b, float radius, seq<int> &ids )
+
+{
+  if (empty)
+    return;
+
+  collectOut = &ids;
+  collectMargin = (int) ceil( radius / cellSize );
+
+  // Clip the line to the occupied cells, expanded by the margin, and
+  // to the slab of z within 'radius' of the objects.  A point within
+  // 'radius' of an object is in both.
+
+  float xmin = (minX - collectMargin) * cellSize, xmax = (maxX + 1 + collectMargin) * cellSize;
+  float ymin = (minY - collectMargin) * cellSize, ymax = (maxY + 1 + collectMargin) * cellSize;
+  float zmin = minZ - radius, zmax = maxZ + radius;
+
+  float dx = b.x - a.x;
+  float dy = b.y - a.y;
+  float dz = b.z - a.z;
+
+  if (fabs(dx) < 1e-6 * cellSize && fabs(dy) < 1e-6 * cellSize) {
+
+    // The line is vertical, so it passes through one cell
+
+    if (a.x >= xmin && a.x <= xmax && a.y >= ymin && a.y <= ymax)
+      collectAround( 0, cellCoord( a.x ), cellCoord( a.y ) );
+    return;
+  }
+
+  float t0 = -MAXFLOAT, t1 = MAXFLOAT;
+
+  float p[6] = { -dx, dx, -dy, dy, -dz, dz };
+  float q[6] = { a.x - xmin, xmax - a.x, a.y - ymin, ymax - a.y, a.z - zmin, zmax - a.z };
+
+  for (int i=0; i<6; i++) {
+    if (p[i] == 0) {
+      if (q[i] < 0)
+        return;                 // parallel to and outside this side
+    } else {
+      float t = q[i] / p[i];
+      if (p[i] < 0) {
+        if (t > t0) t0 = t;
+      } else {
+        if (t < t1) t1 = t;
+      }
+    }
+  }
+
+  if (t0 > t1)
+    return;
+
+  vec3 d( dx, dy, 0 );
+
+  walk( a + t0 * d, a + t1 * d, 0, &SpatialGrid::collectAround );
+}
+
+
+// Only the part of the ring inside the occupied cells is searched
+
+void SpatialGrid::collectRing( vec3 p, int r, seq<int> &ids )
+
+{
+  if (empty)
+    return;
+
+  int cx = cellCoord( p.x );
+  int cy = cellCoord( p.y );
+
+  if (r == 0) {
+    collectCell( cx, cy, ids );
+    return;
+  }
+
+  int x0 = MAX( cx-r, minX ), x1 = MIN( cx+r, maxX );
+  int y0 = MAX( cy-r+1, minY ), y1 = MIN( cy+r-1, maxY );
+
+  for (int x=x0; x<=x1; x++) {
+    if (cy-r >= minY) collectCell( x, cy-r, ids );
+    if (cy+r <= maxY) collectCell( x, cy+r, ids );
+  }
+
+  for (int y=y0; y<=y1; y++) {
+    if (cx-r >= minX) collectCell( cx-r, y, ids );
+    if (cx+r <= maxX) collectCell( cx+r, y, ids );
+  }
+}
+
+
+// The rings before this one around p are outside the occupied cells
+
+int SpatialGrid::firstRing( vec3 p )
+
+{
+  if (empty)
+    return 0;
+
+  int cx = cellCoord( p.x );
+  int cy = cellCoord( p.y );
+
+  return MAX( 0, MAX( MAX( minX - cx, cx - maxX ), MAX( minY - cy, cy - maxY ) ) );
+}
+
+
+bool SpatialGrid::ringCoversAll( vec3 p, int r )
+
+{
+  if (empty)
+    return true;
+
+  int cx = cellCoord( p.x );
+  int cy = cellCoord( p.y );
+
+  return (cx-r <= minX && cx+r >= maxX && cy-r <= minY && cy+r >= maxY);
+}
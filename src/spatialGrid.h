@@ -0,0 +1,106 @@
+/* spatialGrid.h
+ *
+ * A uniform grid over the xy plane that holds integer IDs of points
+ * and line segments, for finding nearby objects without looking at
+ * all of them.
+ *
+ * Objects are stored in every cell that their xy projection passes
+ * through.  z is ignored, so a vertical post is just a point, except
+ * that the range of z of all the objects is kept, to clip lines to.  The
+ * grid is unbounded: cells are stored in a hash table keyed by cell
+ * coordinates, which grows with the number of entries.
+ *
+ *   insert( id, a, b )       store 'id' in the cells of segment ab (a == b for a point)
+ *   remove( id, a, b )       remove it again (a and b must be as inserted)
+ *   reserve( n )             make room for n entries without rehashing
+ *
+ *   collectAlong( a, b, radius, ids )
+ *                            append to 'ids' the IDs in cells within 'radius'
+ *                            of the infinite line through a and b (clipped
+ *                            to the occupied cells, and to where the line
+ *                            is within 'radius' of the objects' z range)
+ *   collectRing( p, r, ids ) append the IDs in the cells at distance r
+ *                            (in cells) from the cell of p
+ *   ringCoversAll( p, r )    true if rings 0..r around p cover all occupied cells
+ *   firstRing( p )           the first ring around p that has occupied cells
+ *
+ * The collected IDs may contain duplicates, and may include objects
+ * that are not near enough; the caller makes the exact test.
+ */
+
+
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include "headers.h"
+#include "seq.h"
+
+
+#define MIN_GRID_BUCKETS  64
+
+
+class GridEntry {
+ public:
+  int id;
+  int ix, iy;                   // cell
+  GridEntry() {}
+  GridEntry( int i, int x, int y ) { id = i; ix = x; iy = y; }
+};
+
+
+class SpatialGrid {
+
+  float           cellSize;
+
+  seq<GridEntry> *buckets;
+  int             numBuckets;   // a power of two
+  int             numEntries;
+
+  bool            empty;        // bounds of occupied cells (grows only)
+  int             minX, maxX, minY, maxY;
+  float           minZ, maxZ;   // of the objects inserted (grows only)
+
+  int  cellCoord( float v ) {
+    return (int) floor( v / cellSize );
+  }
+
+  int  bucket( int ix, int iy ) {
+    return ((unsigned int) ix * 73856093u ^ (unsigned int) iy * 19349663u) & (numBuckets-1);
+  }
+
+  void addEntry( int id, int ix, int iy );
+  void removeEntry( int id, int ix, int iy );
+  void collectCell( int ix, int iy, seq<int> &ids );
+
+  seq<int>       *collectOut;   // used by collectAlong()
+  int             collectMargin;
+  void collectAround( int id, int ix, int iy );
+  void grow();
+
+  // Call (this->*fn)( id, ix, iy ) for each cell crossed by segment ab
+
+  void walk( vec3 a, vec3 b, int id, void (SpatialGrid::*fn)( int, int, int ) );
+
+ public:
+
+  SpatialGrid( float size );
+  ~SpatialGrid();
+
+  void clear();
+  void reserve( int n );
+
+  void insert( int id, vec3 a, vec3 b );
+  void remove( int id, vec3 a, vec3 b );
+
+  void collectAlong( vec3 a, vec3 b, float radius, seq<int> &ids );
+  void collectRing( vec3 p, int r, seq<int> &ids );
+  bool ringCoversAll( vec3 p, int r );
+  int  firstRing( vec3 p );
+
+  float size() {
+    return cellSize;
+  }
+};
+
+
+#endif
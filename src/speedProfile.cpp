@@ -0,0 +1,97 @@
+// speedProfile.cpp
+
+
+#include "speedProfile.h"
+
+
+// Rebuild the speed table for 'spline'.
+//
+// Work with the energy per unit mass, e = v^2/2.  Between consecutive
+// samples, the train gains g*(h_prev - h_next) from gravity and loses
+// friction*g*ds to friction and drag*v^2*ds to air resistance.
+//
+// The energy is integrated once around the loop from the station.  The
+// difference between the energy at the end of the lap and at the start
+// is then added in over the booster, growing linearly from nothing at
+// its start to all of it at the station.
+
+
+void SpeedProfile::compute( Spline *spline )
+
+{
+  delete [] speeds;
+  delete [] heights;
+
+  speeds = NULL;
+  heights = NULL;
+  numSamples = 0;
+
+  length = spline->totalArcLength();
+
+  if (length <= 0)
+    return;
+
+  // Samples at arc lengths 0, spacing, 2*spacing, ..., length
+
+  numSamples = (int) ceil( length / PROFILE_SPACING ) + 1;
+  spacing = length / (float) (numSamples-1);
+
+  speeds  = new float[ numSamples ];
+  heights = new float[ numSamples ];
+
+  for (int i=0; i<numSamples-1; i++)
+    heights[i] = spline->value( spline->paramAtArcLength( i*spacing ) ).z;
+
+  heights[numSamples-1] = heights[0]; // the same point
+
+  // Integrate energy along the track
+
+  float minEnergy = 0.5 * minSpeed * minSpeed;
+  float e = 0.5 * initialSpeed * initialSpeed;
+
+  if (e < minEnergy)
+    e = minEnergy;
+
+  float startEnergy = e;
+
+  speeds[0] = e;                // energies until the end
+
+  for (int i=1; i<numSamples; i++) {
+
+    e += gravity * (heights[i-1] - heights[i]); // potential energy
+    e -= friction * gravity * spacing;           // rolling friction
+    e -= drag * 2*e * spacing;                   // air drag (= drag * v^2)
+
+    if (e < minEnergy)                           // chain lift
+      e = minEnergy;
+
+    speeds[i] = e;
+  }
+
+  // The booster makes up the difference over its length (or half the
+  // track, if that's shorter)
+
+  int boosterSamples = (int) (BOOSTER_LENGTH / spacing);
+
+  if (boosterSamples > (numSamples-1) / 2)
+    boosterSamples = (numSamples-1) / 2;
+  if (boosterSamples < 1)
+    boosterSamples = 1;
+
+  int   first = numSamples-1 - boosterSamples;
+  float boost = startEnergy - speeds[numSamples-1];
+
+  for (int i=first+1; i<numSamples-1; i++) {
+    speeds[i] += boost * (i-first) / (float) boosterSamples;
+    if (speeds[i] < minEnergy)
+      speeds[i] = minEnergy;
+  }
+
+  speeds[numSamples-1] = startEnergy;
+
+  for (int i=0; i<numSamples; i++)
+    speeds[i] = sqrt( 2*speeds[i] );
+
+  splineRevision = spline->revision();
+  mustRecompute = false;
+}
@@ -0,0 +1,159 @@
+/* speedProfile.h
+ *
+ * A table of train speed as a function of arc length along a spline.
+ *
+ * The speed comes from conservation of energy,
+ *
+ *     v^2 = v0^2 + 2g(h0 - h)
+ *
+ * with losses to rolling friction and air drag integrated along the
+ * track.  Where the train would slow below 'minSpeed' (e.g. on a
+ * climb), a chain lift holds it at 'minSpeed'.
+ *
+ * The track is a closed loop.  The train leaves the station (arc
+ * length 0) at 'initialSpeed', and a booster (or brake) on the last
+ * BOOSTER_LENGTH of track before the station makes up the energy
+ * gained or lost around the lap, so that the train is back at
+ * 'initialSpeed' when it arrives.  The table is then the same at both
+ * ends, and the speed doesn't jump when a lap is completed.
+ *
+ * The table is rebuilt only when the spline changes, so finding the
+ * speed at a position costs a single table lookup.
+ */
+
+
+#ifndef SPEED_PROFILE_H
+#define SPEED_PROFILE_H
+
+#include "headers.h"
+#include "spline.h"
+
+
+#define PROFILE_SPACING     1.0   // arc length between table samples
+#define DEFAULT_GRAVITY     40    // in scene units per second^2
+#define DEFAULT_FRICTION    0.015 // coefficient of rolling friction
+#define DEFAULT_DRAG        0.0001 // air drag per unit of arc length
+#define DEFAULT_MIN_SPEED   20    // chain lift speed
+#define BOOSTER_LENGTH      100   // arc length of the booster before the station
+
+
+class SpeedProfile {
+
+  float *speeds;                // speeds[i] = speed at arc length i*spacing (the last is the first)
+  float *heights;               // heights[i] = track height at arc length i*spacing (the last is the first)
+  int    numSamples;
+  float  spacing;
+  float  length;                // total arc length of the spline
+  int    splineRevision;        // spline revision used to build the table
+  bool   mustRecompute;
+
+ public:
+
+  // physical parameters (call invalidate() after changing these)
+
+  float initialSpeed;           // speed at arc length 0 (the station)
+  float gravity;
+  float friction;
+  float drag;
+  float minSpeed;
+
+  SpeedProfile() {
+    speeds = NULL;
+    heights = NULL;
+    numSamples = 0;
+    spacing = PROFILE_SPACING;
+    length = 0;
+    splineRevision = -1;
+    mustRecompute = true;
+
+    initialSpeed = 70;
+    gravity = DEFAULT_GRAVITY;
+    friction = DEFAULT_FRICTION;
+    drag = DEFAULT_DRAG;
+    minSpeed = DEFAULT_MIN_SPEED;
+  }
+
+  ~SpeedProfile() {
+    delete [] speeds;
+    delete [] heights;
+  }
+
+  void invalidate() {
+    mustRecompute = true;
+  }
+
+  // Set the losses as a scene file gives them, where a negative value
+  // means the default
+
+  void setLosses( float f, float d ) {
+    friction = (f >= 0 ? f : DEFAULT_FRICTION);
+    drag = (d >= 0 ? d : DEFAULT_DRAG);
+    invalidate();
+  }
+
+  bool isStale( Spline *spline ) {
+    return mustRecompute || spline->mustRecomputeArcLength || spline->revision() != splineRevision;
+  }
+
+  void compute( Spline *spline );
+
+  // Speed at arc length s (one table lookup, linearly interpolated)
+
+  float speedAt( float s ) {
+    return lookup( speeds, s );
+  }
+
+  float heightAt( float s ) {
+    return lookup( heights, s );
+  }
+
+  // Track slope dh/ds at arc length s
+
+  float slopeAt( float s ) {
+    float p;
+    int i = sampleIndex( s, p );
+    if (i < 0)
+      return 0;
+    return (heights[i+1] - heights[i]) / spacing;
+  }
+
+  // Raw table access (for analytics)
+
+  int count()            { return numSamples; }
+  float sampleSpacing()  { return spacing; }
+  float totalLength()    { return length; }
+  const float *speedTable()  { return speeds; }
+  const float *heightTable() { return heights; }
+
+ private:
+
+  // Find i and p such that s is a fraction p of the way from sample i
+  // to sample i+1.  Return -1 if the table is empty.
+
+  int sampleIndex( float s, float &p ) {
+    if (numSamples < 2)
+      return -1;
+    if (s < 0 || s >= length) {
+      s = fmod( s, length );
+      if (s < 0)
+        s += length;
+    }
+    float x = s / spacing;
+    int i = (int) x;
+    if (i > numSamples-2)
+      i = numSamples-2;
+    p = x - i;
+    return i;
+  }
+
+  float lookup( float *table, float s ) {
+    float p;
+    int i = sampleIndex( s, p );
+    if (i < 0)
+      return 0;
+    return (1-p) * table[i] + p * table[i+1];
+  }
+};
+
+
+#endif
@@ -92,8 +92,10 @@ void Sphere::setupVAO()
 
   GLfloat *vertexBuffer = new GLfloat[ nVerts * 3 ];
 
+  const vec3 *v = verts.data();
+
   for (int i=0; i<nVerts; i++)
-    ((vec3 *) vertexBuffer)[i] = verts[i];
+    ((vec3 *) vertexBuffer)[i] = v[i];
 
   // copy normals
   //
@@ -104,7 +106,7 @@ void Sphere::setupVAO()
   GLfloat *normalBuffer = new GLfloat[ nVerts * 3 ];
 
   for (int i=0; i<nVerts; i++)
-    ((vec3 *) normalBuffer)[i] = verts[i];
+    ((vec3 *) normalBuffer)[i] = v[i];
 
   // copy faces
 
@@ -112,9 +114,11 @@ void Sphere::setupVAO()
 
   GLuint *indexBuffer = new GLuint[ nFaces * 3 ];
 
-  for (int i=0; i<faces.size(); i++)
+  const SphereFace *f = faces.data();
+
+  for (int i=0; i<nFaces; i++)
     for (int j=0; j<3; j++) 
-      indexBuffer[3*i+j] = faces[i].v[j]; 
+      indexBuffer[3*i+j] = f[i].v[j]; 
 
   // Create a VAO
 
@@ -7,7 +7,12 @@
 #include "linalg.h"
 
 
-#define DIVS_PER_SEG 20         // number of samples of on each spline segment (for arc length parameterization)
+#define MAX_TESSELLATION_DEPTH 10 // at most 2^10 tessellation samples per spline segment
+#define ARC_LENGTH_SCALE 4294967296.0 // fixed point arc length units per unit of length (2^32)
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#define ARC_SAMPLES SplineSegment::ARC_SAMPLES
 
 float Spline::M[][4][4] = {
 
@@ -38,8 +43,8 @@ const char * Spline::MName[] = {
 
 
 // Evaluate the spline at parameter 't'.  Return the value, tangent
-// (i.e. first derivative), or binormal, depending on the
-// 'returnDerivative' parameter.
+// (i.e. first derivative), or acceleration (i.e. second derivative),
+// depending on the 'type' parameter.
 // 
 // The spline is continuous, so the first data point appears again
 // after the last data point.  t=0 at the first data point and t=n-1
@@ -52,10 +57,13 @@ vec3 operator*(vec3 v, float f) {
   return vec3(v.x*f, v.y*f, v.z*f);
 }
 
-vec3 Spline::eval( float t, evalType type )
+// Find the polynomial coefficients of the segment containing t, so
+// that the spline is Mv[0] u^3 + Mv[1] u^2 + Mv[2] u + Mv[3] there.
+// Return u, the position of t within that segment, in [0,1).
 
-{
+float Spline::segmentCoeffs( float t, vec3 Mv[4] )
 
+{
   int maxT = data.size();
   
   // YOUR CODE HERE
@@ -82,26 +90,198 @@ vec3 Spline::eval( float t, evalType type )
   // Calculate Mv matrix
   
   vec3 v[4] = { q0, q1, q2, q3 };
-  vec3 Mv[4] = { vec3(0,0,0), vec3(0,0,0), vec3(0,0,0), vec3(0,0,0) }; 
   for (int i = 0; i < 4; i++) {
+    Mv[i] = vec3(0,0,0);
     for (int j = 0; j < 4; j++) {
       Mv[i] = Mv[i] + M[currSpline][i][j] * v[j];
     }
   }
-  float u = t - floor(t);
-  
 
+  return t - floor(t);
+}
+
+
+// The coefficients of segment [i,i+1]
+
+void Spline::segmentCoeffsAt( int i, vec3 Mv[4] )
+
+{
+  int n = data.size();
+
+  vec3 v[4] = { data[ (i-1+n) % n ], data[i], data[ (i+1) % n ], data[ (i+2) % n ] };
+
+  for (int r=0; r<4; r++) {
+    Mv[r] = vec3(0,0,0);
+    for (int j=0; j<4; j++)
+      Mv[r] = Mv[r] + M[currSpline][r][j] * v[j];
+  }
+}
+
+
+// Value, tangent and acceleration at u of the polynomial with
+// coefficients Mv
+
+void Spline::evalCoeffs( vec3 Mv[4], float u, vec3 &value, vec3 &tangent, vec3 &accel )
+
+{
+  value   = u*u*u*Mv[0] + u*u*Mv[1] + u*Mv[2] + Mv[3];
+  tangent = 3*u*u*Mv[0] + 2*u*Mv[1] + Mv[2];
+  accel   = 6*u*Mv[0] + 2*Mv[1];
+}
+
+
+vec3 Spline::eval( float t, evalType type )
+
+{
+  vec3 Mv[4];
+  float u = segmentCoeffs( t, Mv );
   
   if (type == VALUE) {
     return u*u*u*Mv[0] + u*u*Mv[1] + u*Mv[2] + Mv[3];
   } else if (type == TANGENT) {
     return 3*u*u*Mv[0] + 2*u*Mv[1] + Mv[2];
+  } else if (type == ACCELERATION) {
+    return 6*u*Mv[0] + 2*Mv[1];
   } else {
     return vec3(0,0,0);
   }
 }
 
 
+// Evaluate the value, tangent, and acceleration at t together, with
+// one fetch of the segment's coefficients.
+
+void Spline::evalAll( float t, vec3 &value, vec3 &tangent, vec3 &accel )
+
+{
+  vec3 Mv[4];
+  float u = segmentCoeffs( t, Mv );
+
+  evalCoeffs( Mv, u, value, tangent, accel );
+}
+
+
+// Curvature at t, which is |P' x P''| / |P'|^3.  This is 1/radius
+// of the circle that best fits the curve at t.
+
+float Spline::curvature( float t )
+
+{
+  vec3 Mv[4];
+  float u = segmentCoeffs( t, Mv );
+
+  vec3 d1 = 3*u*u*Mv[0] + 2*u*Mv[1] + Mv[2];
+  vec3 d2 = 6*u*Mv[0] + 2*Mv[1];
+
+  return curvatureFromDerivs( d1, d2 );
+}
+
+
+float Spline::curvatureFromDerivs( vec3 d1, vec3 d2 )
+
+{
+  float len = d1.length();
+
+  if (len == 0)
+    return 0;
+
+  return (d1 ^ d2).length() / (len*len*len);
+}
+
+
+// Tessellate the spline adaptively.  Each spline segment [i,i+1] is
+// split in half until, on each piece, both
+//
+//   chordal error  ~  k L^2 / 8        <= chordTol
+//   turning angle  ~  k L              <= angleTol
+//
+// where L is the chord length and k is the largest curvature at the
+// ends and middle of the piece.  The actual distance of the middle
+// of the piece from its chord is also checked.  Straight parts of
+// the track get a single piece per segment; tight turns get many.
+//
+// Each segment's samples are cached, as positions within the segment,
+// so only the segments in 'tessQueue' are subdivided again (or all of
+// them, if the tolerances change).
+
+
+int Spline::tessellate( float chordTol, float angleTol )
+
+{
+  if (tessChordTol != chordTol || tessAngleTol != angleTol) {
+
+    for (int i=0; i<segments.size(); i++) {
+      segments[i].tessValid = false;
+      queueSegment( i );
+    }
+
+    tessChordTol = chordTol;
+    tessAngleTol = angleTol;
+  }
+
+  vec3 p0, p1, d1, d2;
+
+  for (int q=0; q<tessQueue.size(); q++) {
+
+    if (tessQueue[q] < 0)       // removed
+      continue;
+
+    int i = segments.index( tessQueue[q] );
+    SplineSegment &seg = segments[i];
+
+    vec3 Mv[4];
+    segmentCoeffsAt( i, Mv );
+
+    evalCoeffs( Mv, 0, p0, d1, d2 );
+    float k0 = curvatureFromDerivs( d1, d2 );
+
+    evalCoeffs( Mv, 1, p1, d1, d2 );
+    float k1 = curvatureFromDerivs( d1, d2 );
+
+    numTessSamples -= seg.tessParams.size();
+
+    seg.tessParams.clear();
+    subdivide( Mv, 0, p0, k0, 1, p1, k1, chordTol, angleTol, 0, seg.tessParams );
+
+    numTessSamples += seg.tessParams.size();
+
+    seg.tessValid = true;
+    seg.tessQueued = -1;
+  }
+
+  tessQueue.clear();
+
+  return numTessSamples;
+}
+
+
+// Add the tessellation samples of [t0,t1) to 'params'.  t0 and t1
+// are positions in the segment with coefficients Mv.
+
+
+void Spline::subdivide( vec3 Mv[4], float t0, vec3 p0, float k0, float t1, vec3 p1, float k1,
+                        float chordTol, float angleTol, int depth, seq<float> &params )
+
+{
+  float tm = 0.5 * (t0 + t1);
+
+  vec3 pm, d1, d2;
+  evalCoeffs( Mv, tm, pm, d1, d2 );
+  float km = curvatureFromDerivs( d1, d2 );
+
+  float k = MAX( k0, MAX( km, k1 ) );
+  float len = (p1 - p0).length();
+
+  float chordErr = MAX( k*len*len/8, (pm - 0.5*(p0+p1)).length() );
+
+  if (depth < MAX_TESSELLATION_DEPTH && (chordErr > chordTol || k*len > angleTol)) {
+    subdivide( Mv, t0, p0, k0, tm, pm, km, chordTol, angleTol, depth+1, params );
+    subdivide( Mv, tm, pm, km, t1, p1, k1, chordTol, angleTol, depth+1, params );
+  } else
+    params.add( t0 );
+}
+
+
 // Find a local coordinate system at t.  Return the axes x,y,z.  y
 // should point as much up as possible and z should point in the
 // direction of increasing position on the curve.
@@ -112,10 +292,12 @@ void Spline::findLocalSystem( float t, vec3 &o, vec3 &x, vec3 &y, vec3 &z )
 {
 #if 1
   // YOUR CODE HERE
-  o = eval(t, VALUE);
+  vec3 Mv[4];
+  float u = segmentCoeffs( t, Mv );
 
+  o = u*u*u*Mv[0] + u*u*Mv[1] + u*Mv[2] + Mv[3];
 
-  z = eval(t, TANGENT);
+  z = 3*u*u*Mv[0] + 2*u*Mv[1] + Mv[2];
   z = z.normalize();
 
   x = z ^ vec3(0, 0, 1);
@@ -181,26 +363,29 @@ void Spline::draw( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawIntervals )
 {
   // Draw the spline
   
-  vec3 *points = new vec3[ data.size()*DIVS_PER_SEG + 1 ];
-  vec3 *colours = new vec3[ data.size()*DIVS_PER_SEG + 1 ];
-
-  int i = 0;
-  for (float t=0; t<data.size()-1; t+=1/(float)DIVS_PER_SEG) {
-    points[i] = value( t );
-    colours[i] = SPLINE_COLOUR;
-    i++;
+  int numSamples = tessellate( DEFAULT_CHORD_TOLERANCE, DEFAULT_ANGLE_TOLERANCE );
+
+  vec3 *points = frameArena->alloc<vec3>( numSamples );
+  vec3 *colours = frameArena->alloc<vec3>( numSamples );
+
+  int k = 0;
+
+  for (int i=0; i<data.size(); i++) {
+    seq<float> &u = segments[i].tessParams;
+    for (int j=0; j<u.size(); j++) {
+      points[k] = value( i + u[j] );
+      colours[k] = SPLINE_COLOUR;
+      k++;
+    }
   }
 
-  segs->drawSegs( GL_LINE_LOOP, points, colours, i, MV, MVP, lightDir );
+  segs->drawSegs( GL_LINE_LOOP, points, colours, numSamples, MV, MVP, lightDir );
 
   // Draw points evenly spaced in the parameter
 
   if (drawIntervals)
-    for (float t=0; t<data.size(); t+=1/(float)DIVS_PER_SEG)
+    for (float t=0; t<data.size(); t+=1/(float)ARC_SAMPLES)
       drawLocalSystem( t, MVP );
-
-  delete[] points;
-  delete[] colours;
 }
 
 
@@ -212,17 +397,23 @@ void Spline::drawWithArcLength( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawInt
 {
   // Draw the spline
   
-  vec3 *points = new vec3[ data.size()*DIVS_PER_SEG + 1 ];
-  vec3 *colours =  new vec3[ data.size()*DIVS_PER_SEG + 1 ];
-
-  int i = 0;
-  for (float t=0; t<data.size(); t+=1/(float)DIVS_PER_SEG) {
-    points[i] = value( t );
-    colours[i] = SPLINE_COLOUR;
-    i++;
+  int numSamples = tessellate( DEFAULT_CHORD_TOLERANCE, DEFAULT_ANGLE_TOLERANCE );
+
+  vec3 *points = frameArena->alloc<vec3>( numSamples );
+  vec3 *colours = frameArena->alloc<vec3>( numSamples );
+
+  int k = 0;
+
+  for (int i=0; i<data.size(); i++) {
+    seq<float> &u = segments[i].tessParams;
+    for (int j=0; j<u.size(); j++) {
+      points[k] = value( i + u[j] );
+      colours[k] = SPLINE_COLOUR;
+      k++;
+    }
   }
 
-  segs->drawSegs( GL_LINE_LOOP, points, colours, i, MV, MVP, lightDir );
+  segs->drawSegs( GL_LINE_LOOP, points, colours, numSamples, MV, MVP, lightDir );
 
   // Draw points evenly spaced in arc length
 
@@ -230,107 +421,138 @@ void Spline::drawWithArcLength( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawInt
     
     float totalLength = totalArcLength();
 
-    for (float s=0; s<totalLength; s+=totalLength/(float)(data.size()*DIVS_PER_SEG)) {
+    for (float s=0; s<totalLength; s+=totalLength/(float)(data.size()*ARC_SAMPLES)) {
       float t = paramAtArcLength( s );
       drawLocalSystem( t, MVP );
     }
   }
+}
+
+
+// A length in fixed point
 
-  delete[] points;
-  delete[] colours;
+
+static int64_t fixedLength( float len )
+
+{
+  return llround( len * ARC_LENGTH_SCALE );
 }
 
 
-// Fill in an arcLength array such that arcLength[i] is the estimated
-// arc length up to the i^th sample (using DIVS_PER_SEG samples per
-// spline segment).
+// Sample the segments in 'lengthQueue' at ARC_SAMPLES points each,
+// and update their lengths in the tree.  Each segment is sampled from
+// its own coefficients, so a segment's samples don't depend on its
+// index, and are the same whether they were cached or not.
 
 
 void Spline::computeArcLengthParameterization()
 
 {
-  if (data.size() == 0)
-    return;
+  bool rebuild = lengths.rebuildIsCheaper( lengthQueue.size() );
 
-  if (arcLength != NULL)
-    delete [] arcLength;
+  for (int q=0; q<lengthQueue.size(); q++) {
 
-  arcLength = new float[ data.size() * DIVS_PER_SEG + 1 ];
+    int slot = lengthQueue[q];
 
-  // first sample at length 0
+    if (slot < 0)               // removed
+      continue;
 
-  arcLength[0] = 0;
-  vec3 prev = value(0);
+    int i = segments.index( slot );
+    SplineSegment &seg = segments[i];
 
-  maxHeight = prev.z;
+    vec3 Mv[4];
+    segmentCoeffsAt( i, Mv );
 
-  // Compute intermediate lengths
+    vec3 prev = Mv[3];          // u = 0
+    seg.maxZ = prev.z;
 
-  int k = 1;
-  
-  for (int i=0; i<data.size(); i++)
-    for (int j=(i>0?0:1); j<DIVS_PER_SEG; j++) {
+    int64_t length = 0;
 
-      vec3 next = value( i + j/(float)DIVS_PER_SEG );
+    for (int j=1; j<=ARC_SAMPLES; j++) {
 
-      arcLength[k] = arcLength[k-1] + (next-prev).length();
+      float u = j/(float)ARC_SAMPLES;
+      vec3 next = u*u*u*Mv[0] + u*u*Mv[1] + u*Mv[2] + Mv[3];
+
+      seg.arcSteps[j-1] = (next-prev).length();
+      length += fixedLength( seg.arcSteps[j-1] );
       prev = next;
-      k++;
 
-      if (next.z > maxHeight)
-        maxHeight = next.z;
+      if (next.z > seg.maxZ)
+        seg.maxZ = next.z;
     }
 
-  // last sample at full length
+    if (!rebuild)
+      lengths.add( slot, length - seg.length );
 
-  vec3 next = value( data.size() );
-  arcLength[k] = arcLength[k-1] + (next-prev).length();
+    seg.length = length;
+    seg.lengthValid = true;
+    seg.lengthQueued = -1;
+  }
+
+  if (rebuild)                  // e.g. after loading a track
+    lengths.build( [this]( int slot ) {
+      int i = segments.index( slot );
+      return (segments.slot( i ) == slot && i < segments.size() ? segments[i].length : (int64_t) 0);
+    } );
+
+  lengthQueue.clear();
 
-  if (next.z > maxHeight)
-    maxHeight = next.z;
-  
   mustRecomputeArcLength = false;
+  currRevision++;
 }
 
 
-// Find the spline parameter at a particular arc length, s.
+// Find the spline parameter at a particular arc length, s.  The tree
+// gives the segment containing s, and the remaining length is found
+// among the segment's samples.
 
 
 float Spline::paramAtArcLength( float s )
 
 {
+  if (data.size() == 0)
+    return 0;
+
   if (mustRecomputeArcLength)
     computeArcLengthParameterization();
 
-  // Do binary search on arc lengths to find l such that 
-  //
-  //        arcLength[l] <= s < arcLength[l+1].
+  int64_t total = lengths.total();
+  int64_t x = fixedLength( s );
+
+  if (x < 0)
+    x += total;
+
+  if (x < 0)
+    return 0.5 / (float) ARC_SAMPLES;
+
+  int64_t rem;
+  int slot = lengths.find( x, rem );
+
+  if (slot >= lengths.size())
+    return data.size() - 0.5 / (float) ARC_SAMPLES;
+
+  int i = segments.index( slot );
+  SplineSegment &seg = segments[i];
 
-  if (s < 0)
-    s += arcLength[ data.size() * DIVS_PER_SEG ];
+  // Find the sample interval j with rem in [0,step j).  The steps sum
+  // to more than rem, so there is one.
 
-  int l = 0;
-  int r = data.size()*DIVS_PER_SEG;
+  int j = 0;
+  int64_t step = fixedLength( seg.arcSteps[0] );
 
-  while (r-l > 1) {
-    int m = (l+r)/2;
-    if (arcLength[m] <= s)
-      l = m;
-    else
-      r = m;
+  while (rem >= step && j < ARC_SAMPLES-1) {
+    rem -= step;
+    j++;
+    step = fixedLength( seg.arcSteps[j] );
   }
 
-  if (arcLength[l] > s || arcLength[l+1] <= s)
-    return (l + 0.5) / (float) DIVS_PER_SEG;
-  
-  // Do linear interpolation in arcLength[l] ... arcLength[l+1] to
-  // find position of s.
+  // Do linear interpolation within the interval
 
-  float p = (s - arcLength[l]) / (arcLength[l+1] - arcLength[l]);
+  double p = (step > 0 ? rem / (double) step : 0);
 
   // Return the curve parameter at s
 
-  return (l+p) / (float) DIVS_PER_SEG;
+  return i + (j + p) / ARC_SAMPLES;
 }
 
 
@@ -344,13 +566,200 @@ float Spline::totalArcLength()
   if (mustRecomputeArcLength)
     computeArcLengthParameterization();
 
-  return arcLength[ data.size() * DIVS_PER_SEG ];
+  return lengths.total() / ARC_LENGTH_SCALE;
+}
+
+
+float Spline::getMaxHeight()
+
+{
+  if (mustRecomputeArcLength)
+    computeArcLengthParameterization();
+
+  float maxHeight = -MAXFLOAT;
+
+  for (int i=0; i<segments.size(); i++)
+    if (segments[i].maxZ > maxHeight)
+      maxHeight = segments[i].maxZ;
+
+  return maxHeight;
 }
 
 
 void Spline::addPoint( vec3 p )
 
 {
-  data.add( p );
+  insertPoint( data.size(), p );
+}
+
+
+// Point i affects the four segments that use it, segments i-2 ... i+1.
+// Inserting or removing a point changes the same segments around it.
+//
+// A segment is inserted or removed at the gap in 'segments', where it
+// is the only one whose storage position changes.
+
+
+void Spline::insertPoint( int i, vec3 p )
+
+{
+  data.insert( i, p );
+
+  if (segments.size() == segments.capacity())
+    growSegments( segments.size()+1 );
+
+  moveSegmentGap( i );
+  segments.insert( i, SplineSegment() ); // of length 0, as its slot was in the tree
+
+  segmentsChanged( i-2, i+1 );
+}
+
+
+void Spline::removePoint( int i )
+
+{
+  data.remove( i );
+
+  moveSegmentGap( i );
+
+  SplineSegment &seg = segments[i];
+
+  lengths.add( segments.slot( i ), -seg.length );
+  numTessSamples -= seg.tessParams.size();
+
+  if (seg.lengthQueued >= 0)
+    lengthQueue[ seg.lengthQueued ] = -1;
+  if (seg.tessQueued >= 0)
+    tessQueue[ seg.tessQueued ] = -1;
+
+  segments.remove( i );
+
+  segmentsChanged( i-2, i+1 );
+}
+
+
+void Spline::movePoint( int i, vec3 p )
+
+{
+  data[i] = p;
+
+  segmentsChanged( i-2, i+1 );
+}
+
+
+void Spline::segmentsChanged( int first, int last )
+
+{
+  int n = segments.size();
+
   mustRecomputeArcLength = true;
-}
\ No newline at end of file
+
+  if (n == 0)
+    return;
+
+  if (last - first >= n) {
+    first = 0;
+    last = n-1;
+  }
+
+  for (int s=first; s<=last; s++) {
+    int i = ((s % n) + n) % n;
+    segments[i].lengthValid = false;
+    segments[i].tessValid = false;
+    queueSegment( i );
+  }
+}
+
+
+// Add segment i to the queues that it isn't already in
+
+
+void Spline::queueSegment( int i )
+
+{
+  SplineSegment &seg = segments[i];
+
+  if (!seg.lengthValid && seg.lengthQueued < 0) {
+    seg.lengthQueued = lengthQueue.size();
+    lengthQueue.add( segments.slot( i ) );
+  }
+
+  if (!seg.tessValid && seg.tessQueued < 0) {
+    seg.tessQueued = tessQueue.size();
+    tessQueue.add( segments.slot( i ) );
+  }
+}
+
+
+// Move the gap in 'segments' to just before segment i.  The segments
+// that the gap passes over have new storage positions, so their
+// lengths move in the tree, and their entries in the queues change.
+// If many segments move, the tree is rebuilt instead.
+
+
+void Spline::moveSegmentGap( int i )
+
+{
+  int gap = segments.gap();
+
+  if (i == gap)
+    return;
+
+  int first = MIN( i, gap );
+  int last  = MAX( i, gap );
+  int gapSize = segments.capacity() - segments.size();
+
+  bool rebuild = lengths.rebuildIsCheaper( 2 * (last-first) );
+
+  segments.moveGap( i );
+
+  for (int k=first; k<last; k++) {
+
+    SplineSegment &seg = segments[k];
+
+    int newSlot = segments.slot( k );
+
+    if (!rebuild) {
+      int oldSlot = (i < gap ? k : k + gapSize);
+      lengths.add( oldSlot, -seg.length );
+      lengths.add( newSlot, seg.length );
+    }
+
+    if (seg.lengthQueued >= 0)
+      lengthQueue[ seg.lengthQueued ] = newSlot;
+    if (seg.tessQueued >= 0)
+      tessQueue[ seg.tessQueued ] = newSlot;
+  }
+
+  if (rebuild)
+    lengths.build( [this]( int slot ) {
+      int k = segments.index( slot );
+      return (segments.slot( k ) == slot && k < segments.size() ? segments[k].length : (int64_t) 0);
+    } );
+}
+
+
+// Make room for at least n segments.  Every segment after the gap
+// moves, so the tree and the queues are rebuilt.
+
+
+void Spline::growSegments( int n )
+
+{
+  segments.reserve( n );
+
+  lengths.resize( segments.capacity() );
+
+  lengths.build( [this]( int slot ) {
+    int k = segments.index( slot );
+    return (segments.slot( k ) == slot && k < segments.size() ? segments[k].length : (int64_t) 0);
+  } );
+
+  for (int k=0; k<segments.size(); k++) {
+    SplineSegment &seg = segments[k];
+    if (seg.lengthQueued >= 0)
+      lengthQueue[ seg.lengthQueued ] = segments.slot( k );
+    if (seg.tessQueued >= 0)
+      tessQueue[ seg.tessQueued ] = segments.slot( k );
+  }
+}
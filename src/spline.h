@@ -1,6 +1,21 @@
 /* spline.h
  *
  * This is a one-dimensional spline with a fixed knot vector [0,1,2,...].
+ *
+ * The arc length samples and tessellation are cached per segment.
+ * When points are inserted, removed or moved with insertPoint(),
+ * removePoint() and movePoint(), only the segments that those points
+ * affect are queued to be sampled again, so an edit near the previous
+ * one costs O(log n) however long the spline is.
+ *
+ * The segment lengths are kept in a Fenwick tree, indexed by each
+ * segment's storage position in the gap buffer (so that inserting a
+ * segment at the gap shifts nothing in the tree).  paramAtArcLength()
+ * finds the segment in the tree, then the position within it from the
+ * segment's own samples.  Lengths are in fixed point, so that their
+ * sums are exact and don't depend on the order of the edits: a replay
+ * that builds the same spline in another way finds the same arc
+ * lengths.
  */
 
 
@@ -9,13 +24,45 @@
 
 #include "headers.h"
 #include "seq.h"
+#include "gapSeq.h"
+#include "fenwickTree.h"
 
 
 #define SPLINE_COLOUR vec3(0.8,0.9,0.5)
 
-enum evalType { VALUE, TANGENT };
+#define DEFAULT_CHORD_TOLERANCE 0.05  // max distance between curve and tessellation
+#define DEFAULT_ANGLE_TOLERANCE 0.05  // max turn (radians) between tessellation samples
+
+enum evalType { VALUE, TANGENT, ACCELERATION };
+
+
+// What is cached for segment [i,i+1]
+
+class SplineSegment {
+ public:
+
+  static const int ARC_SAMPLES = 20; // arc length samples on each segment
+
+  bool       lengthValid;
+  float      arcSteps[ ARC_SAMPLES ]; // length between consecutive arc length samples
+  int64_t    length;            // in the tree: the sum of the steps, in fixed point
+  float      maxZ;              // highest sample
+
+  bool       tessValid;
+  seq<float> tessParams;        // tessellation samples, as positions in [0,1) within the segment
+
+  int        lengthQueued;      // position in Spline::lengthQueue, or -1
+  int        tessQueued;        // position in Spline::tessQueue, or -1
+
+  SplineSegment() {
+    lengthValid = false;
+    length = 0;
+    tessValid = false;
+    lengthQueued = -1;
+    tessQueued = -1;
+  }
+};
 
-  
 
 class Spline {
 
@@ -25,22 +72,53 @@ class Spline {
   int currSpline;
 
   void computeArcLengthParameterization();
-  float *arcLength;
-  float maxHeight;
+  float segmentCoeffs( float t, vec3 Mv[4] );
+  void segmentCoeffsAt( int i, vec3 Mv[4] );
+  static void evalCoeffs( vec3 Mv[4], float u, vec3 &value, vec3 &tangent, vec3 &accel );
+  static float curvatureFromDerivs( vec3 d1, vec3 d2 );
+  int   currRevision;           // incremented whenever the arc lengths change
+
+  gapSeq<SplineSegment> segments; // segments[i] is segment [i,i+1]
+
+  // Segments whose lengths or tessellations are out of date, by
+  // storage position in 'segments' (-1 for one since removed)
+
+  seq<int> lengthQueue;
+  seq<int> tessQueue;
+
+  FenwickTree lengths;          // segment lengths, by storage position in 'segments'
+
+  int   numTessSamples;         // in all segments
+  float tessChordTol, tessAngleTol;
+
+  void moveSegmentGap( int i );
+  void growSegments( int n );
+  void queueSegment( int i );
+
+  void subdivide( vec3 Mv[4], float t0, vec3 p0, float k0, float t1, vec3 p1, float k1,
+                  float chordTol, float angleTol, int depth, seq<float> &params );
 
  public:
 
-  seq<vec3> data;               // the data points
+  gapSeq<vec3> data;            // the data points (change them with the functions below)
   bool mustRecomputeArcLength;
 
   Spline() {
     mustRecomputeArcLength = true;
-    arcLength = NULL;
     currSpline = 0;
+    currRevision = 0;
+    numTessSamples = 0;
+    tessChordTol = -1;
+    tessAngleTol = -1;
   }
 
   void clear() {
     data.clear();
+    segments.clear();
+    lengths.clear();
+    lengthQueue.clear();
+    tessQueue.clear();
+    numTessSamples = 0;
     mustRecomputeArcLength = true;
   }
 
@@ -48,22 +126,47 @@ class Spline {
     currSpline++;
     if (MName[currSpline][0] == '\0')
       currSpline = 0;
-    mustRecomputeArcLength = true;
+    segmentsChanged( 0, data.size()-1 );
   }
 
   const char *name() {
     return MName[currSpline];
   }
 
-  float getMaxHeight() {
-    if (mustRecomputeArcLength)
-      computeArcLengthParameterization();
-    return maxHeight;
+  bool setCOB( const char *cobName ) { // select a change-of-basis matrix by name
+    for (int i=0; MName[i][0] != '\0'; i++)
+      if (strcmp( MName[i], cobName ) == 0) {
+        currSpline = i;
+        segmentsChanged( 0, data.size()-1 );
+        return true;
+      }
+    return false;
   }
 
+  int revision() {
+    return currRevision;
+  }
+
+  float getMaxHeight();          // looks at every segment
+
   void draw( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawIntervals );
   void drawWithArcLength( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawIntervals );
   void addPoint( vec3 v );
+  void insertPoint( int i, vec3 v ); // v becomes point i
+
+  void reserve( int n ) {       // room for n points
+    data.reserve( n );
+    if (n > segments.capacity())
+      growSegments( n );
+  }
+
+  void removePoint( int i );
+  void movePoint( int i, vec3 v );
+
+  // Segments first ... last have changed.  The range wraps around, so
+  // it can start below 0 or end beyond the last segment.
+
+  void segmentsChanged( int first, int last );
   float paramAtArcLength( float s );
   float totalArcLength();
 
@@ -72,6 +175,19 @@ class Spline {
   void drawLocalSystem( float t, mat4 &MVP );
 
   vec3 eval( float t, evalType type ); // evaluate the spline at param t
+  void evalAll( float t, vec3 &value, vec3 &tangent, vec3 &accel );
+  float curvature( float t );
+
+  // Sample the spline so that it is within the given tolerances of
+  // the true curve.  Returns the number of samples.  The samples of
+  // segment i are then tessSamples(i), as positions in [0,1) within
+  // the segment (so at curve parameters i + tessSamples(i)[j]).
+
+  int tessellate( float chordTol, float angleTol );
+
+  seq<float> &tessSamples( int i ) {
+    return segments[i].tessParams;
+  }
 
   vec3 value( float t ) {
     return eval( t, VALUE );
@@ -80,6 +196,10 @@ class Spline {
   vec3 tangent( float t ) {
     return eval( t, TANGENT );
   }
+
+  vec3 acceleration( float t ) {
+    return eval( t, ACCELERATION );
+  }
 };
 
 #endif
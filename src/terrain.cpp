@@ -3,20 +3,192 @@
 
 #include "terrain.h"
 #include "main.h"
+#include "profiler.h"
 
 
 #define CURTAIN_COLOUR 0.6,0.6,0.4
 #define BOTTOM_COLOUR  0.3,0.3,0.2
+#define UNDERSIDE_Z    -5   // level of underside of terrain box
 #define POST_COLOUR    0.6*.7,0.6*.7,0.4*.7
 
 #define VERTEX(x,y,z)  glVertex3f(x,y,z)
 
-void Terrain::readTextures( string basePath, string heightfieldFilename, string textureFilename )
+
+// Only the image headers are read here.  The rest of the loading
+// happens on another thread, so that the first frame can be shown
+// right away whatever the size of the terrain.
+
+
+Terrain::Terrain( string path, string heightfieldFilename, string textureFilename, float scale )
+
+{
+  loadStartTime = std::chrono::steady_clock::now();
+
+  basePath = path;
+  heightfield = new Heightfield();
+  textureName = textureFilename;
+
+  gpu.init( vertShader, fragShader, "in terrain.cpp" );
+
+  vertexBuffer = normalBuffer = texCoordBuffer = NULL;
+  indexBuffer = NULL;
+  points = normals = NULL;
+  tiles = NULL;
+
+  VAO = curtainVAO = 0;
+  vertexBufferID = normalBufferID = texCoordBufferID = indexBufferID = 0;
+
+  ready = false;
+  failed = false;
+  loaded = false;
+
+  // The headers give the size.  If either can't be read (which is
+  // reported), there is nothing to load.
+
+  if (heightfield->readSize( basePath, heightfieldFilename ))
+    texture = textureCache.acquire( basePath, textureFilename );
+
+  defaultHeightScale = (scale <= 0);
+  heightScale = (defaultHeightScale ? heightfield->defaultScale() : scale);
+
+  if (!texture) {
+    failed = true;
+    loaded = true;
+    return;
+  }
+
+  loader = std::thread( &Terrain::load, this );
+}
+
+
+// On the GL thread
+
+
+Terrain::~Terrain()
+
+{
+  if (loader.joinable())
+    loader.join();
+
+  delete tiles;
+
+  if (points != NULL) {
+    for (unsigned int x=0; x<heightfield->width + 2; x++)
+      delete [] points[x];
+    delete [] points;
+  }
+
+  if (normals != NULL) {
+    for (unsigned int x=0; x<heightfield->width; x++)
+      delete [] normals[x];
+    delete [] normals;
+  }
+
+  delete [] vertexBuffer;       // if never uploaded
+  delete [] normalBuffer;
+  delete [] texCoordBuffer;
+  delete [] indexBuffer;
+
+  GLuint buffers[4] = { vertexBufferID, normalBufferID, texCoordBufferID, indexBufferID };
+  glDeleteBuffers( 4, buffers );
+  glDeleteVertexArrays( 1, &VAO );
+
+  Segs::deleteVAO( curtainVAO );
+
+  delete heightfield;
+
+  // 'texture' is released to the cache
+}
+
+
+// Runs on the loader thread.  Nothing here may use OpenGL.
+
+void Terrain::load()
+
+{
+  // Decode the two images at the same time
+
+  std::thread textureLoader( &TextureCache::load, &textureCache, std::ref( texture ) );
+  bool ok = heightfield->load();
+  textureLoader.join();
+
+  if (!ok) {                    // reported by finishLoading(), on the GL thread
+    failed = true;
+    loaded = true;
+    return;
+  }
+
+  if (!heightfield->isTiled()) {
+    readTextures();
+    buildBuffers();
+  }
+
+  loaded = true;
+}
+
+
+// On the GL thread.  Returns true once the terrain is on the GPU, and
+// false while it is loading or if loading failed.
+
+bool Terrain::finishLoading()
 
 {
-  heightfield = new Texture( basePath, heightfieldFilename );
-  texture = new Texture( basePath, textureFilename );
+  if (ready)
+    return true;
+
+  if (!loaded)
+    return false;
+
+  if (failed) {
+    if (loader.joinable()) {
+      loader.join();
+      cerr << "Could not load the terrain from '" << heightfield->name << "'." << endl;
+    }
+    return false;
+  }
+
+  loader.join();
+
+  // The heightfield is only used on the CPU, so only the texture is
+  // uploaded
+
+  textureCache.upload( texture );
+
+  if (heightfield->isTiled()) {
+    tiles = new TerrainTiles( heightfield, heightScale );
+    tiles->setupGL();
+  } else
+    setupVAO();
+
+  setupCurtainVAO();
+
+  ready = true;
+
+  cout << "Loaded terrain (" << heightfield->width << "x" << heightfield->height << ") in "
+       << std::chrono::duration<double>( std::chrono::steady_clock::now() - loadStartTime ).count()
+       << " seconds" << endl
+       << "  decoded " << heightfield->name << " in " << heightfield->loadSeconds << " seconds and "
+       << texture->name << " in " << texture->loadSeconds << " seconds"
+#ifdef HAVE_ZLIB
+       << " (with zlib)"
+#endif
+       << endl
+       << "  uploaded " << texture->name << " (" << texture->gpuBytes / (1024.0 * 1024.0) << " MB"
+       << (texture->hasAlpha ? " RGBA" : " RGB") << ") in " << texture->uploadSeconds << " seconds" << endl;
+
+  char message[200];
+  textureCache.stats( message, sizeof(message) );
+  cout << "  " << message << endl;
+
+  return true;
+}
+
 
+// Build the points and normals from the decoded heightfield
+
+void Terrain::readTextures()
+
+{
   // Store texture map as a vec3 array.  Create a border around it
   // to allow indexing one beyond the texture.
 
@@ -26,9 +198,7 @@ void Terrain::readTextures( string basePath, string heightfieldFilename, string
 
   for (unsigned int x=0; x<heightfield->width; x++)
     for (unsigned int y=0; y<heightfield->height; y++) {
-      float alpha;
-      float height = heightfield->texel(x, y, alpha).x * 0.1*heightfield->width; // max height is 10% of width
-      points[x][y] = vec3(x,y, height );
+      points[x][y] = point( x, y );
     }
 
   // Compute normals for the texture map
@@ -74,16 +244,18 @@ void Terrain::readTextures( string basePath, string heightfieldFilename, string
 
 
 
-void Terrain::setupVAO()
+// Set up buffers of vertices, normals, texture coordinates and
+// faces.  setupVAO() uploads them.
 
-{
-  // Set up buffers of vertices, normals, and texture coordinates.
 
-  int nVerts = heightfield->width * heightfield->height;
+void Terrain::buildBuffers()
+
+{
+  nVerts = heightfield->width * heightfield->height;
 
-  GLfloat *vertexBuffer = new GLfloat[ nVerts * 3 ];
-  GLfloat *normalBuffer = new GLfloat[ nVerts * 3 ];
-  GLfloat *texCoordBuffer = new GLfloat[ nVerts * 2 ];
+  vertexBuffer = new GLfloat[ nVerts * 3 ];
+  normalBuffer = new GLfloat[ nVerts * 3 ];
+  texCoordBuffer = new GLfloat[ nVerts * 2 ];
 
   vec3 *v = (vec3*) vertexBuffer;
   vec3 *n = (vec3*) normalBuffer;
@@ -100,7 +272,7 @@ void Terrain::setupVAO()
 
   nFaces = 2 * (heightfield->width - 1) * (heightfield->height - 1);
 
-  GLuint *indexBuffer = new GLuint[ nFaces * 3 ];
+  indexBuffer = new GLuint[ nFaces * 3 ];
 
   GLuint *i = indexBuffer;
 
@@ -126,7 +298,13 @@ void Terrain::setupVAO()
     
     k++; // next row
   }
+}
+
+
+
+void Terrain::setupVAO()
 
+{
   // Create a VAO
 
   glGenVertexArrays( 1, &VAO );
@@ -134,7 +312,6 @@ void Terrain::setupVAO()
 
   // store vertices (i.e. one triple of floats per vertex)
 
-  GLuint vertexBufferID;
   glGenBuffers( 1, &vertexBufferID );
   glBindBuffer( GL_ARRAY_BUFFER, vertexBufferID );
 
@@ -147,7 +324,6 @@ void Terrain::setupVAO()
 
   // store vertex normals (i.e. one triple of floats per vertex)
 
-  GLuint normalBufferID;
   glGenBuffers( 1, &normalBufferID );
   glBindBuffer( GL_ARRAY_BUFFER, normalBufferID );
 
@@ -160,7 +336,6 @@ void Terrain::setupVAO()
 
   // store vertex texture coordinates (i.e. one triple of floats per vertex)
 
-  GLuint texCoordBufferID;
   glGenBuffers( 1, &texCoordBufferID );
   glBindBuffer( GL_ARRAY_BUFFER, texCoordBufferID );
 
@@ -173,7 +348,6 @@ void Terrain::setupVAO()
 
   // store faces (i.e. one triple of vertex indices per face)
 
-  GLuint indexBufferID;
   glGenBuffers( 1, &indexBufferID );
   glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, indexBufferID );
   glBufferData( GL_ELEMENT_ARRAY_BUFFER, nFaces * 3 * sizeof(GLuint), indexBuffer, GL_STATIC_DRAW );
@@ -184,59 +358,149 @@ void Terrain::setupVAO()
   delete[] normalBuffer;
   delete[] texCoordBuffer;
   delete[] indexBuffer;
+
+  vertexBuffer = normalBuffer = texCoordBuffer = NULL;
+  indexBuffer = NULL;
 }
 
 
 
-void Terrain::draw( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawUndersideOnly ) 
+// Build the underside and the curtain around the edge of the terrain
+// into one triangle strip.  They never change after loading, so this
+// is done once.
+//
+// The underside comes first, so that it can be drawn alone.  It is
+// joined to the curtain by two repeated vertices, which make
+// zero-area triangles.
+
+
+void Terrain::setupCurtainVAO()
 
 {
-  // Draw textured terrain
+  int W = heightfield->width;
+  int H = heightfield->height;
+
+  int maxVerts = 4 + 2 + 4*(W + H);
+
+  vec3 *pts = new vec3[ maxVerts ];
+  vec3 *colours = new vec3[ maxVerts ];
+
+  vec3 *p = pts;
+
+  // underside
+
+  *p++ = vec3( 0,   0,   UNDERSIDE_Z );
+  *p++ = vec3( W-1, 0,   UNDERSIDE_Z );
+  *p++ = vec3( 0,   H-1, UNDERSIDE_Z );
+  *p++ = vec3( W-1, H-1, UNDERSIDE_Z );
+
+  for (int k=0; k<4; k++)
+    colours[k] = vec3( BOTTOM_COLOUR );
+
+  // ---- curtains around terrain ----
+
+  vec3 *curtainStart = p + 2;
+  p = curtainStart;
+
+  // bottom
 
-  gpu.activate();
+  int i = 0;
+  int j = 0;
+  for ( ; i<W; i++) {
+    *p++ = vec3( i, j, heightAt( i, j ) );
+    *p++ = vec3( i, j, UNDERSIDE_Z );
+  }
+  i--;
   
-  gpu.setMat4( "MV", MV );
-  gpu.setMat4( "MVP", MVP );
-  gpu.setVec3( "lightDir", lightDir );
-  gpu.setFloat( "alpha", 1.0 );
+  // right
+
+  j++;
+  for ( ; j<H; j++) {
+    *p++ = vec3( i, j, heightAt( i, j ) );
+    *p++ = vec3( i, j, UNDERSIDE_Z );
+  }
+  j--;
   
-  const int textureUnitID = 0;
+  // top
+
+  i--;
+  for ( ; i >= 0; i--) {
+    *p++ = vec3( i, j, heightAt( i, j ) );
+    *p++ = vec3( i, j, UNDERSIDE_Z );
+  }
+  i++;
   
-  texture->activate( textureUnitID );
-  gpu.setInt( "terrainColourSampler", textureUnitID );
+  // (xmax,y)
 
-  // underside
+  j--;
+  for ( ; j >= 0; j--) {
+    *p++ = vec3( i, j, heightAt( i, j ) );
+    *p++ = vec3( i, j, UNDERSIDE_Z );
+  }
 
-  const float minZ = -5; // level of underside of terrain box
-  
-  {
-    vec3 pts[4], colours[4];
+  nCurtainVerts = p - pts;
 
-    vec3 *p = pts;
+  for (int k=4; k<nCurtainVerts; k++)
+    colours[k] = vec3( CURTAIN_COLOUR );
 
-    *p++ = vec3( 0,                    0,                     minZ );
-    *p++ = vec3( 0,                    heightfield->height-1, minZ );
-    *p++ = vec3( heightfield->width-1, heightfield->height-1, minZ );
-    *p++ = vec3( heightfield->width-1, 0,                     minZ );
+  // join underside and curtain
 
-    for (int i=0; i<4; i++)
-      colours[i] = vec3( BOTTOM_COLOUR );
+  pts[4] = pts[3];
+  pts[5] = curtainStart[0];
 
-    segs->drawSegs( GL_TRIANGLE_FAN, pts, colours, 4, MV, MVP, lightDir );
-  }
+  curtainVAO = Segs::makeVAO( pts, colours, NULL, nCurtainVerts );
 
-  if (drawUndersideOnly)
+  delete[] pts;
+  delete[] colours;
+}
+
+
+
+void Terrain::draw( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawUndersideOnly ) 
+
+{
+  PROFILE_GPU_SCOPE( "Terrain::draw" );
+
+  if (!ready && !finishLoading()) {
+    drawPlaceholder( MV, MVP, lightDir );
     return;
+  }
 
-  // Draw using element array
+  // Draw textured terrain
 
-  glBindVertexArray( VAO );
+  if (!drawUndersideOnly) {
+
+    gpu.activate();
+  
+    gpu.setMat4( "MV", MV );
+    gpu.setMat4( "MVP", MVP );
+    gpu.setVec3( "lightDir", lightDir );
+    gpu.setFloat( "alpha", 1.0 );
+  
+    const int textureUnitID = 0;
+  
+    texture->activate( textureUnitID );
+    gpu.setInt( "terrainColourSampler", textureUnitID );
+
+    // Draw using element array
+
+    if (tiles != NULL)
+      tiles->draw();
+    else {
+      glBindVertexArray( VAO );
+      glDrawElements( GL_TRIANGLES, nFaces*3, GL_UNSIGNED_INT, 0 );
+      glBindVertexArray( 0 );
+    }
 
-  glDrawElements( GL_TRIANGLES, nFaces*3, GL_UNSIGNED_INT, 0 );
+    gpu.deactivate();
+  }
+
+  // Underside and curtain (just the first four vertices for the underside)
 
-  glBindVertexArray( 0 );
+  segs->drawVAO( GL_TRIANGLE_STRIP, curtainVAO, (drawUndersideOnly ? 4 : nCurtainVerts), false, MV, MVP, lightDir );
 
-  gpu.deactivate();
+  if (drawUndersideOnly)
+    return;
 
   // Draw highlighted quads (for debugging)
 
@@ -245,72 +509,55 @@ void Terrain::draw( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawUndersideOnly )
     vec3 pts[4], colours[4];
       
     vec3 v = quadsToHighlight[i];
-    pts[0] = vec3( v.x, v.y, points[(int)v.x][(int)v.y].z + 0.1 );
+    pts[0] = vec3( v.x, v.y, heightAt( v.x, v.y ) + 0.1 );
     v.x++;
-    pts[1] = vec3( v.x, v.y, points[(int)v.x][(int)v.y].z + 0.1 );
+    pts[1] = vec3( v.x, v.y, heightAt( v.x, v.y ) + 0.1 );
     v.y++;
-    pts[2] = vec3( v.x, v.y, points[(int)v.x][(int)v.y].z + 0.1 );
+    pts[2] = vec3( v.x, v.y, heightAt( v.x, v.y ) + 0.1 );
     v.x--;
-    pts[3] = vec3( v.x, v.y, points[(int)v.x][(int)v.y].z + 0.1 );
+    pts[3] = vec3( v.x, v.y, heightAt( v.x, v.y ) + 0.1 );
 
     for (int j=0; j<4; j++)
       colours[j] = vec3(1,1,0);
 
     segs->drawSegs( GL_TRIANGLE_FAN, pts, colours, 4, MV, MVP, lightDir );
   }
+}
 
-  // Draw curtain
 
-  vec3 *pts = new vec3[ 4*(heightfield->width + heightfield->height) ];
-  vec3 *colours =  new vec3[ 4*(heightfield->width + heightfield->height) ];
+void Terrain::setFocus( seq<vec3> &drawAround, seq<vec3> &prefetchAround )
 
-  // ---- draw curtains around terrain ----
+{
+  if (tiles != NULL)
+    tiles->update( drawAround, prefetchAround );
+}
 
-  for (unsigned int i=0; i<4*(heightfield->width + heightfield->height); i++)
-    colours[i] = vec3( CURTAIN_COLOUR );
-  
-  vec3 *p = pts;
 
-  // bottom
+void Terrain::tileStats( char *buffer, int size )
 
-  int i = 0;
-  int j = 0;
-  for ( ; i<(int)heightfield->width; i++) {
-    *p++ = vec3( i, j, points[i][j].z );
-    *p++ = vec3( i, j, minZ );
-  }
-  i--;
-  
-  // right
+{
+  if (tiles != NULL)
+    tiles->stats( buffer, size );
+  else
+    snprintf( buffer, size, "tiles loading" );
+}
 
-  j++;
-  for ( ; j<(int)heightfield->height; j++) {
-    *p++ = vec3( i, j, points[i][j].z );
-    *p++ = vec3( i, j, minZ );
-  }
-  j--;
-  
-  // top
 
-  i--;
-  for ( ; i >= 0; i--) {
-    *p++ = vec3( i, j, points[i][j].z );
-    *p++ = vec3( i, j, minZ );
-  }
-  i++;
-  
-  // (xmax,y)
+// A flat rectangle of the terrain's size, shown while it loads
 
-  j--;
-  for ( ; j >= 0; j--) {
-    *p++ = vec3( i, j, points[i][j].z );
-    *p++ = vec3( i, j, minZ );
-  }
+void Terrain::drawPlaceholder( mat4 &MV, mat4 &MVP, vec3 lightDir )
 
-  segs->drawSegs( GL_TRIANGLE_STRIP, pts, colours, p-pts, MV, MVP, lightDir );
+{
+  int W = heightfield->width;
+  int H = heightfield->height;
 
-  delete[] pts;
-  delete[] colours;
+  vec3 pts[4] = { vec3( 0, 0, 0 ), vec3( W-1, 0, 0 ), vec3( 0, H-1, 0 ), vec3( W-1, H-1, 0 ) };
+  vec3 colours[4];
+
+  for (int i=0; i<4; i++)
+    colours[i] = vec3( CURTAIN_COLOUR );
+
+  segs->drawSegs( GL_TRIANGLE_STRIP, pts, colours, 4, MV, MVP, lightDir );
 }
 
 
@@ -322,6 +569,9 @@ void Terrain::draw( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawUndersideOnly )
 bool Terrain::findIntPoint( vec3 rayStart, vec3 rayDir, vec3 planePerp, vec3 &intPoint, mat4 &M )
 
 {
+  if (!ready)
+    return false;               // still loading
+
   // The ray/dir is in the WCS, so we first move it into the OCS of
   // the terrain.
 
@@ -445,10 +695,10 @@ bool Terrain::findIntPoint( vec3 rayStart, vec3 rayDir, vec3 planePerp, vec3 &in
 
     // Set heights of this terrain quad
 
-    ll = points[(int)ll.x][(int)ll.y];
-    lr = points[(int)lr.x][(int)lr.y];
-    ul = points[(int)ul.x][(int)ul.y];
-    ur = points[(int)ur.x][(int)ur.y];
+    ll = point( ll.x, ll.y );
+    lr = point( lr.x, lr.y );
+    ul = point( ul.x, ul.y );
+    ur = point( ur.x, ur.y );
 
     // Test for intersection of ray with the two terrain triangles
     // above this terrain pixel.
@@ -4,10 +4,16 @@
 #define TERRAIN_H
 
 #include "headers.h"
-#include "texture.h"
+#include "textureCache.h"
+#include "heightfield.h"
+#include "terrainTiles.h"
 #include "seq.h"
 #include "gpuProgram.h"
 
+#include <thread>
+#include <atomic>
+#include <chrono>
+
 
 class Terrain {
 
@@ -18,25 +24,96 @@ class Terrain {
   bool rayTriangleInt( vec3 rayStart, vec3 rayDir, vec3 v0, vec3 v1, vec3 v2, vec3 & intPoint, float & intParam );
 
   GLuint      VAO; 
+  GLuint      vertexBufferID, normalBufferID, texCoordBufferID, indexBufferID;
   GPUProgram  gpu;
   int         nFaces;
 
+  GLuint      curtainVAO;       // underside and curtain around the edge
+  int         nCurtainVerts;
+
   static const char *vertShader;
   static const char *fragShader;
 
+  // The images are decoded, and the points, normals and vertex
+  // buffers are built, on the 'loader' thread.  It sets 'loaded' when
+  // done.  The next draw() then uploads everything to the GPU and sets
+  // 'ready'.  Until then, draw() shows a flat placeholder of the right
+  // size, which is known from the image headers.
+  //
+  // The loader never changes the sizes (heightfield->width and height,
+  // and the texture's), which the GL thread reads while it runs.  It
+  // decodes into the images' own buffers, and nothing on the GL thread
+  // reads those until 'loaded' is set.
+  //
+  // If loading fails, the loader sets 'failed' before 'loaded', and
+  // finishLoading() reports it on the GL thread.  The placeholder is
+  // then drawn instead.
+
+  std::thread       loader;
+  std::atomic<bool> loaded;
+  bool              ready;
+  bool              failed;     // set before 'loaded', and read only after it
+
+  std::chrono::steady_clock::time_point loadStartTime;
+
+  GLfloat *vertexBuffer;        // built by the loader, deleted after upload
+  GLfloat *normalBuffer;
+  GLfloat *texCoordBuffer;
+  GLuint  *indexBuffer;
+  int      nVerts;
+
+  // For a tiled heightfield, there are no points, normals or vertex
+  // buffers for the whole terrain.  'tiles' draws the tiles near the
+  // points given to setFocus().
+
+  TerrainTiles *tiles;
+
+  void load();
+  void drawPlaceholder( mat4 &MV, mat4 &MVP, vec3 lightDir );
+
  public:
 
-  Texture *heightfield;
-  Texture *texture;
+  string       basePath;
+  Heightfield *heightfield;
+  TextureHandle texture;        // from textureCache (not to be used until loaded, as loading can switch it)
+  string       textureName;     // as given to the constructor
+  float        heightScale;     // height of a heightfield sample of 1.0
+  bool         defaultHeightScale;
+
+  // heightScale <= 0 uses heightfield->defaultScale()
 
-  Terrain( string basePath, string heightfieldFilename, string textureFilename ) {
-    readTextures( basePath, heightfieldFilename, textureFilename );
-    gpu.init( vertShader, fragShader, "in terrain.cpp" );
-    setupVAO();
+  Terrain( string basePath, string heightfieldFilename, string textureFilename, float heightScale );
+  ~Terrain();
+
+  bool finishLoading();         // on the GL thread; true once it's ready (draw() calls it)
+
+  bool hasFailed() {            // the files couldn't be loaded
+    return loaded && failed;
   }
   
-  void readTextures( string basePath, string heightfieldFilename, string textureFilename );
+  bool isTiled() {
+    return heightfield->isTiled();
+  }
+
+  float heightAt( int x, int y ) {
+    return heightfield->at( x, y ) * heightScale;
+  }
+
+  vec3 point( int x, int y ) {
+    return vec3( x, y, heightAt( x, y ) );
+  }
+
+  // For a tiled terrain: draw the tiles around the 'drawAround'
+  // points and load those around the 'prefetchAround' points (in
+  // terrain coordinates).  Call before draw().
+
+  void setFocus( seq<vec3> &drawAround, seq<vec3> &prefetchAround );
+  void tileStats( char *buffer, int size );
+
+  void readTextures();
+  void buildBuffers();
   void setupVAO();
+  void setupCurtainVAO();
   void draw( mat4 &MV, mat4 &MVP, vec3 lightDir, bool drawUndersideOnly );
 
   bool findIntPoint( vec3 rayStart, vec3 rayDir, vec3 planePerp, vec3 &intPoint, mat4 &M );
@@ -0,0 +1,410 @@
+// terrainTiles.cpp
+
+
+#include "terrainTiles.h"
+
+
+#define MIN(a,b)  ((a)<(b)?(a):(b))
+#define MAX(a,b)  ((a)>(b)?(a):(b))
+
+
+TerrainTiles::TerrainTiles( Heightfield *h, float scale )
+
+{
+  heightfield = h;
+  heightScale = scale;
+
+  tileSize = h->tileSize;
+  tilesX = h->tilesX;
+  tilesY = h->tilesY;
+  numTiles = tilesX * tilesY;
+
+  // Neighbouring tiles share their edge vertices
+
+  vertsPerTile = (tileSize+1) * (tileSize+1);
+
+  state = new unsigned char[ numTiles ];
+  slotOf = new int[ numTiles ];
+  wantedIn = new int[ numTiles ];
+
+  for (int i=0; i<numTiles; i++) {
+    state[i] = TILE_ABSENT;
+    slotOf[i] = -1;
+    wantedIn[i] = -1;
+  }
+
+  for (int i=0; i<MAX_RESIDENT_TILES; i++) {
+    slots[i].tile = -1;
+    slots[i].VAO = 0;
+  }
+
+  for (int i=0; i<MAX_BUILT_TILES; i++)
+    freeBuffers.add( new GLfloat[ vertsPerTile * TILE_VERTEX_FLOATS ] );
+
+  built.reserve( MAX_BUILT_TILES );
+
+  frame = 0;
+  indexBufferID = 0;
+  hits = misses = 0;
+  uploads = evictions = 0;
+
+  quit = false;
+  worker = std::thread( &TerrainTiles::run, this );
+}
+
+
+TerrainTiles::~TerrainTiles()
+
+{
+  {
+    std::lock_guard<std::mutex> l( lock );
+    quit = true;
+  }
+
+  wake.notify_all();
+  worker.join();
+
+  for (int i=0; i<freeBuffers.size(); i++)
+    delete [] freeBuffers[i];
+  for (int i=0; i<built.size(); i++)
+    delete [] built[i].verts;
+
+  delete [] state;
+  delete [] slotOf;
+  delete [] wantedIn;
+
+  for (int i=0; i<MAX_RESIDENT_TILES; i++)
+    if (slots[i].VAO != 0) {
+      glDeleteBuffers( 1, &slots[i].vertexBufferID );
+      glDeleteVertexArrays( 1, &slots[i].VAO );
+    }
+
+  glDeleteBuffers( 1, &indexBufferID );
+}
+
+
+// The index buffer is the same for every tile
+
+
+void TerrainTiles::setupGL()
+
+{
+  nIndices = 6 * tileSize * tileSize;
+
+  GLuint *indexBuffer = new GLuint[ nIndices ];
+  GLuint *i = indexBuffer;
+
+  int stride = tileSize+1;
+
+  for (int y=0; y<tileSize; y++)
+    for (int x=0; x<tileSize; x++) {
+
+      int k = y*stride + x;
+
+      *i++ = k;
+      *i++ = k+1;
+      *i++ = k + stride;
+
+      *i++ = k + stride;
+      *i++ = k+1;
+      *i++ = k+1 + stride;
+    }
+
+  glGenBuffers( 1, &indexBufferID );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, indexBufferID );
+  glBufferData( GL_ELEMENT_ARRAY_BUFFER, nIndices * sizeof(GLuint), indexBuffer, GL_STATIC_DRAW );
+
+  delete [] indexBuffer;
+}
+
+
+// The worker thread.  It builds the last tile in 'pending' whenever
+// there is a free buffer to build it in.
+
+
+void TerrainTiles::run()
+
+{
+  std::unique_lock<std::mutex> l( lock );
+
+  while (true) {
+
+    wake.wait( l, [this] { return quit || (pending.size() > 0 && freeBuffers.size() > 0); } );
+
+    if (quit)
+      return;
+
+    int tile = pending[ pending.size()-1 ];
+    pending.remove();
+
+    GLfloat *verts = freeBuffers[ freeBuffers.size()-1 ];
+    freeBuffers.remove();
+
+    state[tile] = TILE_BUILDING;
+
+    l.unlock();
+    buildTile( tile, verts );
+    l.lock();
+
+    state[tile] = TILE_BUILT;
+    built.add( BuiltTile( tile, verts ) );
+  }
+}
+
+
+// Fill 'verts' with the vertices of a tile.  Vertices past the right
+// or top edge of the heightfield are moved back onto it, which makes
+// zero-area triangles.  Normals are from central differences, which
+// reach into the neighbouring tiles.
+
+
+void TerrainTiles::buildTile( int tile, GLfloat *verts )
+
+{
+  int W = heightfield->width;
+  int H = heightfield->height;
+
+  int x0 = (tile % tilesX) * tileSize;
+  int y0 = (tile / tilesX) * tileSize;
+
+  GLfloat *v = verts;
+
+  for (int j=0; j<=tileSize; j++)
+    for (int i=0; i<=tileSize; i++) {
+
+      int x = MIN( x0+i, W-1 );
+      int y = MIN( y0+j, H-1 );
+
+      int xl = MAX( x-1, 0 ), xr = MIN( x+1, W-1 );
+      int yb = MAX( y-1, 0 ), yt = MIN( y+1, H-1 );
+
+      float dzdx = (heightfield->at( xr, y ) - heightfield->at( xl, y )) * heightScale / MAX( xr-xl, 1 );
+      float dzdy = (heightfield->at( x, yt ) - heightfield->at( x, yb )) * heightScale / MAX( yt-yb, 1 );
+
+      vec3 n = vec3( -dzdx, -dzdy, 1 ).normalize();
+
+      *v++ = x;
+      *v++ = y;
+      *v++ = heightfield->at( x, y ) * heightScale;
+      *v++ = n.x;
+      *v++ = n.y;
+      *v++ = n.z;
+      *v++ = x / (float) (W-1);
+      *v++ = y / (float) (H-1);
+    }
+}
+
+
+// Add the tiles within 'radius' tiles of p to 'tiles', nearest
+// first, skipping tiles already wanted in this frame
+
+
+void TerrainTiles::collect( vec3 p, int radius, seq<int> &tiles )
+
+{
+  int cx = MIN( MAX( (int) floor( p.x / tileSize ), 0 ), tilesX-1 );
+  int cy = MIN( MAX( (int) floor( p.y / tileSize ), 0 ), tilesY-1 );
+
+  for (int r=0; r<=radius; r++)
+    for (int ty=cy-r; ty<=cy+r; ty++)
+      for (int tx=cx-r; tx<=cx+r; tx++) {
+
+        if (MAX( abs(tx-cx), abs(ty-cy) ) != r)
+          continue;               // not on ring r
+
+        if (tx < 0 || tx >= tilesX || ty < 0 || ty >= tilesY)
+          continue;
+
+        int t = ty*tilesX + tx;
+
+        if (wantedIn[t] != frame) {
+          wantedIn[t] = frame;
+          tiles.add( t );
+        }
+      }
+}
+
+
+// Choose the wanted tiles, queue the ones that aren't on the GPU for
+// the worker, and upload some of the ones it has built
+
+
+void TerrainTiles::update( seq<vec3> &drawAround, seq<vec3> &prefetchAround )
+
+{
+  frame++;
+
+  drawTiles.clear();
+  prefetchTiles.clear();
+
+  for (int i=0; i<drawAround.size(); i++)
+    collect( drawAround[i], TILE_DRAW_RADIUS, drawTiles );
+
+  for (int i=0; i<prefetchAround.size(); i++)
+    collect( prefetchAround[i], TILE_PREFETCH_RADIUS, prefetchTiles );
+
+  for (int i=0; i<drawTiles.size(); i++)
+    if (slotOf[ drawTiles[i] ] >= 0)
+      hits++;
+    else
+      misses++;
+
+  BuiltTile toUpload[ TILE_UPLOADS_PER_FRAME ];
+  int numToUpload = 0;
+
+  {
+    std::lock_guard<std::mutex> l( lock );
+
+    while (numToUpload < TILE_UPLOADS_PER_FRAME && built.size() > 0) {
+      toUpload[ numToUpload++ ] = built[ built.size()-1 ];
+      built.remove();
+    }
+
+    // Replace the queue with this frame's wanted tiles, the most wanted
+    // (the nearest tiles to draw) last
+
+    for (int i=0; i<pending.size(); i++)
+      state[ pending[i] ] = TILE_ABSENT;
+
+    pending.clear();
+
+    for (int i=prefetchTiles.size()-1; i>=0; i--)
+      if (state[ prefetchTiles[i] ] == TILE_ABSENT) {
+        state[ prefetchTiles[i] ] = TILE_QUEUED;
+        pending.add( prefetchTiles[i] );
+      }
+
+    for (int i=drawTiles.size()-1; i>=0; i--)
+      if (state[ drawTiles[i] ] == TILE_ABSENT) {
+        state[ drawTiles[i] ] = TILE_QUEUED;
+        pending.add( drawTiles[i] );
+      }
+  }
+
+  for (int i=0; i<numToUpload; i++)
+    upload( toUpload[i] );
+
+  wake.notify_one();
+}
+
+
+// Find a GPU slot for a new tile.  If all are in use, evict the least
+// recently drawn tile that isn't wanted in this frame.  Returns -1 if
+// there is none.
+
+
+int TerrainTiles::findSlot()
+
+{
+  int best = -1;
+
+  for (int i=0; i<MAX_RESIDENT_TILES; i++) {
+
+    if (slots[i].tile < 0)
+      return i;
+
+    if (wantedIn[ slots[i].tile ] != frame && (best < 0 || slots[i].lastDrawn < slots[best].lastDrawn))
+      best = i;
+  }
+
+  if (best >= 0) {
+    int evicted = slots[best].tile;
+    slotOf[ evicted ] = -1;
+    slots[best].tile = -1;
+    evictions++;
+    std::lock_guard<std::mutex> l( lock );
+    state[ evicted ] = TILE_ABSENT;
+  }
+
+  return best;
+}
+
+
+void TerrainTiles::upload( BuiltTile &b )
+
+{
+  int s = findSlot();
+
+  if (s >= 0) {
+
+    TileSlot &slot = slots[s];
+
+    if (slot.VAO == 0) {        // first use of this slot
+
+      glGenVertexArrays( 1, &slot.VAO );
+      glBindVertexArray( slot.VAO );
+
+      glGenBuffers( 1, &slot.vertexBufferID );
+      glBindBuffer( GL_ARRAY_BUFFER, slot.vertexBufferID );
+      glBufferData( GL_ARRAY_BUFFER, vertsPerTile * TILE_VERTEX_FLOATS * sizeof(GLfloat), NULL, GL_DYNAMIC_DRAW );
+
+      // attributes 0, 1, 2 = position, normal, texture coordinates, as in Terrain
+
+      GLsizei stride = TILE_VERTEX_FLOATS * sizeof(GLfloat);
+
+      glEnableVertexAttribArray( 0 );
+      glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, stride, (void *) 0 );
+      glEnableVertexAttribArray( 1 );
+      glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, stride, (void *) (3 * sizeof(GLfloat)) );
+      glEnableVertexAttribArray( 2 );
+      glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, stride, (void *) (6 * sizeof(GLfloat)) );
+
+      glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, indexBufferID );
+
+      glBindVertexArray( 0 );
+    }
+
+    glBindBuffer( GL_ARRAY_BUFFER, slot.vertexBufferID );
+    glBufferSubData( GL_ARRAY_BUFFER, 0, vertsPerTile * TILE_VERTEX_FLOATS * sizeof(GLfloat), b.verts );
+
+    slot.tile = b.tile;
+    slot.lastDrawn = frame;
+    slotOf[ b.tile ] = s;
+    uploads++;
+  }
+
+  std::lock_guard<std::mutex> l( lock );
+
+  state[ b.tile ] = (s >= 0 ? TILE_RESIDENT : TILE_ABSENT);
+  freeBuffers.add( b.verts );
+}
+
+
+void TerrainTiles::draw()
+
+{
+  for (int i=0; i<drawTiles.size(); i++) {
+
+    int s = slotOf[ drawTiles[i] ];
+
+    if (s >= 0) {
+      slots[s].lastDrawn = frame;
+      glBindVertexArray( slots[s].VAO );
+      glDrawElements( GL_TRIANGLES, nIndices, GL_UNSIGNED_INT, 0 );
+    }
+  }
+
+  glBindVertexArray( 0 );
+}
+
+
+void TerrainTiles::stats( char *buffer, int size )
+
+{
+  int numResident = 0;
+  for (int i=0; i<MAX_RESIDENT_TILES; i++)
+    if (slots[i].tile >= 0)
+      numResident++;
+
+  int numQueued;
+  {
+    std::lock_guard<std::mutex> l( lock );
+    numQueued = pending.size();
+  }
+
+  float tileMB = vertsPerTile * TILE_VERTEX_FLOATS * sizeof(GLfloat) / (1024.0 * 1024.0);
+
+  snprintf( buffer, size, "tiles %d/%d on GPU (%.0f MB)  %d queued  hit rate %.1f%%  %ld uploads  %ld evictions",
+            numResident, numTiles, numResident * tileMB, numQueued,
+            (hits + misses > 0 ? 100.0 * hits / (hits + misses) : 100.0), uploads, evictions );
+}
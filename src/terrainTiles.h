@@ -0,0 +1,124 @@
+/* terrainTiles.h
+ *
+ * Drawing for a tiled heightfield (see heightfield.h) that is too
+ * large to have all of its geometry on the GPU.
+ *
+ * Each frame, update() is given the points to draw around (the eye,
+ * the point looked at, and the train) and the points to prefetch
+ * around (further along the track).  The tiles within
+ * TILE_DRAW_RADIUS tiles of the first, and TILE_PREFETCH_RADIUS tiles
+ * of the second, are wanted.
+ *
+ * A worker thread builds the vertices of wanted tiles that are not on
+ * the GPU, nearest first, reading the heights from the memory-mapped
+ * file.  update() uploads up to TILE_UPLOADS_PER_FRAME built tiles per
+ * frame into a fixed set of MAX_RESIDENT_TILES GPU buffers, evicting
+ * the least recently drawn tile when they are full.  draw() draws the
+ * wanted tiles that are on the GPU.
+ *
+ * A draw "hit" is a wanted tile that is already on the GPU.  stats()
+ * returns the hit rate and the memory in use.
+ */
+
+
+#ifndef TERRAIN_TILES_H
+#define TERRAIN_TILES_H
+
+#include "headers.h"
+#include "heightfield.h"
+#include "seq.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+#define TILE_DRAW_RADIUS        2     // in tiles
+#define TILE_PREFETCH_RADIUS    1
+#define MAX_RESIDENT_TILES      160   // tiles on the GPU
+#define MAX_BUILT_TILES         8     // tiles built and waiting for upload
+#define TILE_UPLOADS_PER_FRAME  4
+#define TILE_VERTEX_FLOATS      8     // position, normal, texture coordinates
+
+
+enum TileState {
+  TILE_ABSENT,
+  TILE_QUEUED,                  // in 'pending'
+  TILE_BUILDING,                // being built by the worker
+  TILE_BUILT,                   // in 'built', waiting for upload
+  TILE_RESIDENT                 // on the GPU
+};
+
+
+class TileSlot {
+ public:
+  int    tile;                  // -1 if unused
+  int    lastDrawn;             // frame number
+  GLuint VAO;
+  GLuint vertexBufferID;
+};
+
+
+class BuiltTile {
+ public:
+  int      tile;
+  GLfloat *verts;
+  BuiltTile() {}
+  BuiltTile( int t, GLfloat *v ) { tile = t; verts = v; }
+};
+
+
+class TerrainTiles {
+
+  Heightfield  *heightfield;
+  float         heightScale;
+  int           tileSize, tilesX, tilesY, numTiles;
+  int           vertsPerTile;
+
+  // Shared with the worker, and guarded by 'lock'
+
+  std::mutex    lock;
+  std::condition_variable wake;
+  bool          quit;
+  unsigned char *state;         // TileState of each tile
+  seq<int>      pending;        // tiles to build, the most wanted last
+  seq<BuiltTile> built;
+  seq<GLfloat*> freeBuffers;    // vertex buffers for the worker to fill
+
+  std::thread   worker;
+
+  // Main thread only
+
+  TileSlot      slots[ MAX_RESIDENT_TILES ];
+  int          *slotOf;         // slot of each tile, or -1
+  int          *wantedIn;       // frame in which each tile was last wanted
+  seq<int>      drawTiles;      // wanted this frame, nearest first
+  seq<int>      prefetchTiles;
+  GLuint        indexBufferID;
+  int           nIndices;
+  int           frame;
+
+  long          hits, misses;
+  long          uploads, evictions;
+
+  void run();
+  void buildTile( int tile, GLfloat *verts );
+  void collect( vec3 p, int radius, seq<int> &tiles );
+  int  findSlot();
+  void upload( BuiltTile &b );
+
+ public:
+
+  TerrainTiles( Heightfield *h, float scale );
+  ~TerrainTiles();              // on the GL thread
+
+  void setupGL();               // on the GL thread, before the first update()
+
+  void update( seq<vec3> &drawAround, seq<vec3> &prefetchAround );
+  void draw();                  // with the terrain's GPU program active
+
+  void stats( char *buffer, int size );
+};
+
+
+#endif
@@ -4,6 +4,13 @@
 #include "texture.h"
 #include "lodepng.h"
 
+#include <fstream>
+#include <chrono>
+
+#ifdef HAVE_ZLIB
+  #include <zlib.h>
+#endif
+
 
 bool Texture::useMipMaps = false;
 
@@ -14,6 +21,8 @@ bool Texture::useMipMaps = false;
 void Texture::registerWithOpenGL( )
 
 {
+  auto startTime = std::chrono::steady_clock::now();
+
   // Register it with OpenGL
 
   glGenTextures( 1, &textureID );
@@ -25,41 +34,421 @@ void Texture::registerWithOpenGL( )
   glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
 
   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
 
-  glTexImage2D( GL_TEXTURE_2D, 0, (hasAlpha ? GL_RGBA : GL_RGB), width, height, 0,
-                (hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, texmap );
+  if (isCompressed) {
+
+    // OpenGL can't make mipmaps of a compressed texture, so use the
+    // levels in the file.  If there are fewer than a full set,
+    // GL_TEXTURE_MAX_LEVEL keeps the texture complete.
+
+    gpuBytes = 0;
+
+    for (int i=0; i<levels.size(); i++) {
+      glCompressedTexImage2D( GL_TEXTURE_2D, i, compressedFormat, levels[i].width, levels[i].height, 0,
+                              levels[i].size, ktxFile.data() + levels[i].offset );
+      gpuBytes += levels[i].size;
+    }
+
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (levels.size() > 0 ? levels.size()-1 : 0) );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR) );
+
+    // Nothing on the CPU reads a compressed texture
+
+    std::vector<unsigned char>().swap( ktxFile );
 
-  glGenerateMipmap( GL_TEXTURE_2D );
+  } else {
+
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+
+    // An image that didn't load is uploaded as an empty texture
+
+    unsigned int w = (texmap != NULL ? width : 0);
+    unsigned int h = (texmap != NULL ? height : 0);
+
+    glTexImage2D( GL_TEXTURE_2D, 0, (hasAlpha ? GL_RGBA : GL_RGB), w, h, 0,
+                  (hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, texmap );
+
+    glGenerateMipmap( GL_TEXTURE_2D );
+
+    gpuBytes = (size_t) w * h * (hasAlpha ? 4 : 3) * 4 / 3; // mipmaps add a third
+  }
+
+  uploadSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - startTime ).count();
 }
 
 
 
-void Texture::loadTexture( string filename )
+#ifdef HAVE_ZLIB
+
+// Decompress the image data with zlib's inflate, which is several
+// times faster than lodepng's.  lodepng frees the output with free(),
+// so it is allocated with malloc().  custom_context points to the
+// expected size of the output.
+
+
+static unsigned zlibDecompress( unsigned char **out, size_t *outSize,
+                                const unsigned char *in, size_t inSize,
+                                const LodePNGDecompressSettings *settings )
 
 {
-  // Read image
-  
-  std::vector<unsigned char> image;
+  size_t size = *(const size_t *) settings->custom_context;
+  if (size < 1024)
+    size = 1024;
+
+  unsigned char *buffer = (unsigned char *) malloc( size );
+  if (buffer == NULL)
+    return 1;
+
+  z_stream zs;
+  memset( &zs, 0, sizeof(zs) );
+
+  if (inflateInit( &zs ) != Z_OK) {
+    free( buffer );
+    return 1;
+  }
+
+  zs.next_in = (Bytef *) in;
+  zs.avail_in = inSize;
+
+  size_t used = 0;
+  int result;
+
+  do {
+
+    if (used == size) {         // larger than expected (e.g. interlaced)
+      size *= 2;
+      unsigned char *bigger = (unsigned char *) realloc( buffer, size );
+      if (bigger == NULL) {
+        result = Z_MEM_ERROR;
+        break;
+      }
+      buffer = bigger;
+    }
+
+    zs.next_out = buffer + used;
+    zs.avail_out = size - used;
+
+    result = inflate( &zs, Z_NO_FLUSH );
+
+    used = size - zs.avail_out;
+
+  } while (result == Z_OK);
+
+  inflateEnd( &zs );
+
+  if (result != Z_STREAM_END) {
+    free( buffer );
+    return 1;
+  }
+
+  *out = buffer;
+  *outSize = used;
+
+  return 0;
+}
+
+#endif
+
+
+
+// Read and decode the file
+
+
+void Texture::load()
+
+{
+  auto startTime = std::chrono::steady_clock::now();
+
+  std::vector<unsigned char> file;
+
+  if (lodepng::load_file( file, path ) != 0)
+    cerr << "Could not read '" << path << "'." << endl;
+  else
+    load( file );
+
+  loadSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - startTime ).count();
+}
+
+
+// Decode the contents of the file, which may be taken
+
+
+void Texture::load( std::vector<unsigned char> &file )
+
+{
+  auto startTime = std::chrono::steady_clock::now();
+
+  if (isCompressed)
+    loadKTX( file );
+  else
+    loadTexture( file );
+
+  loadSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - startTime ).count();
+}
+
+
+// Decode the image into texmap.  The decoder's output buffer becomes
+// texmap, without a copy.
+//
+// The image is decoded to RGB unless it has an alpha channel or a tRNS
+// (transparency) chunk.
+//
+// This may run on another thread while the GL thread reads width and
+// height, so they are left as readSize() set them.  The image is
+// decoded into locals, and only stored if it decodes with that size.
+// If it doesn't, texmap stays NULL.
+
+
+void Texture::loadTexture( std::vector<unsigned char> &file )
+
+{
+  unsigned int w = 0, h = 0;
+
+  lodepng::State state;         // output is 8 bits per channel
+
+  unsigned error = lodepng_inspect( &w, &h, &state, file.data(), file.size() );
+
+  bool alpha = true;
 
-  unsigned error = lodepng::decode( image, width, height, filename.c_str() );
+  if (!error) {
+    LodePNGColorType type = state.info_png.color.colortype;
+    alpha = (type == LCT_RGBA || type == LCT_GREY_ALPHA ||
+             lodepng_chunk_find_const( file.data() + 8, file.data() + file.size(), "tRNS" ) != NULL);
+  }
 
-  if (error)
-    std::cerr << "Error loading '" << filename << "': " << lodepng_error_text(error) << std::endl;
+  state.info_raw.colortype = (alpha ? LCT_RGBA : LCT_RGB);
 
-  // Copy image to our own texmap
-  
-  texmap = new GLubyte[ width * height * 4 ];
+#ifdef HAVE_ZLIB
+  size_t rawSize = 0;
 
-  GLubyte *p = texmap;
-  for (unsigned int i=0; i<width*height*4; i++)
-    *p++ = image[i];
+  if (!error)
+    rawSize = h * (1 + (w * (size_t) lodepng_get_bpp( &state.info_png.color ) + 7) / 8);
 
+  state.decoder.zlibsettings.custom_zlib = zlibDecompress;
+  state.decoder.zlibsettings.custom_context = &rawSize;
+#endif
+
+  unsigned char *image = NULL;
+
+  if (!error)
+    error = lodepng_decode( &image, &w, &h, &state, file.data(), file.size() );
+
+  if (error) {
+    std::cerr << "Error loading '" << path << "': " << lodepng_error_text(error) << std::endl;
+    free( image );
+    return;
+  }
+
+  if (w != width || h != height) {
+    std::cerr << "Error loading '" << path << "': it is " << w << "x" << h << ", but its header was "
+              << width << "x" << height << "." << std::endl;
+    free( image );
+    return;
+  }
+
+  texmap = image;
+  hasAlpha = alpha;
+}
+
+
+
+// Read the width and height from the file header.  A PNG's is in the
+// first 33 bytes of the file and a KTX file's in the first 64.
+
+
+static const unsigned char ktxIdentifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+
+bool Texture::readSize( string basePath, string filename )
+
+{
+  name = filename;
+  path = basePath + string("/") + filename;
+  texmap = NULL;
   hasAlpha = true;
+  isCompressed = false;
+  width = height = 0;
+  loadSeconds = uploadSeconds = 0;
+  gpuBytes = 0;
+
+  unsigned char header[ KTX_HEADER_SIZE ];
+
+  ifstream in( path.c_str(), ios::binary );
+  in.read( (char *) header, sizeof(header) );
+
+  if (in.gcount() < 33) {
+    cerr << "Could not read '" << path << "'." << endl;
+    return false;
+  }
+
+  if (memcmp( header, ktxIdentifier, sizeof(ktxIdentifier) ) == 0) {
+
+    if (in.gcount() < KTX_HEADER_SIZE || !readKTXHeader( header ))
+      return false;
+
+    if (!formatSupported( compressedFormat )) {
+
+      string pngName = filename.substr( 0, filename.rfind( '.' ) ) + ".png";
+
+      cerr << "This OpenGL does not have the ETC2 format of '" << path
+           << "', so '" << pngName << "' is used instead." << endl;
+
+      bool ok = readSize( basePath, pngName );
+      name = filename;          // as given, e.g. to write back to the scene file
+      return ok;
+    }
+
+    return true;
+  }
+
+  lodepng::State state;
+  unsigned error = lodepng_inspect( &width, &height, &state, header, 33 );
+
+  if (error) {
+    cerr << "Error loading '" << path << "': " << lodepng_error_text(error) << endl;
+    width = height = 0;
+    return false;
+  }
+
+  return true;
+}
+
+
+// Check the KTX header for a single ETC2 2D texture.  The fields after
+// the identifier are 13 uint32s:
+//
+//   endianness, glType, glTypeSize, glFormat, glInternalFormat,
+//   glBaseInternalFormat, pixelWidth, pixelHeight, pixelDepth,
+//   numberOfArrayElements, numberOfFaces, numberOfMipmapLevels,
+//   bytesOfKeyValueData
+//
+// The key/value data follows the header, and then the mipmap levels.
+
+
+bool Texture::readKTXHeader( const unsigned char *header )
+
+{
+  uint32_t field[13];
+  memcpy( field, header + sizeof(ktxIdentifier), sizeof(field) );
+
+  if (field[0] != 0x04030201) {
+    cerr << "Error loading '" << path << "': only little-endian KTX files can be read." << endl;
+    return false;
+  }
+
+  if (field[1] != 0 || field[8] != 0 || field[9] != 0 || field[10] != 1) {
+    cerr << "Error loading '" << path << "': it is not a compressed 2D texture." << endl;
+    return false;
+  }
+
+  switch (field[4]) {
+
+  case GL_ETC1_RGB8_OES:        // ETC2 decoders also decode ETC1
+  case GL_COMPRESSED_RGB8_ETC2:
+    compressedFormat = GL_COMPRESSED_RGB8_ETC2;
+    hasAlpha = false;
+    break;
+
+  case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+  case GL_COMPRESSED_RGBA8_ETC2_EAC:
+    compressedFormat = field[4];
+    hasAlpha = true;
+    break;
+
+  default:
+    cerr << "Error loading '" << path << "': its format (0x" << hex << field[4] << dec << ") is not ETC2." << endl;
+    return false;
+  }
+
+  width = field[6];
+  height = field[7];
+  numLevels = (field[11] > 0 ? field[11] : 1);
+  dataOffset = KTX_HEADER_SIZE + (size_t) field[12];
+
+  isCompressed = true;
+
+  return true;
 }
 
 
+// Keep a KTX file's contents, which are uploaded as they are, and find
+// its mipmap levels.  Each level is a uint32 image size followed by the
+// image, padded to a multiple of four bytes.
+
+
+void Texture::loadKTX( std::vector<unsigned char> &file )
+
+{
+  ktxFile.swap( file );
+
+  size_t fileSize = ktxFile.size();
+
+  int blockBytes = (compressedFormat == GL_COMPRESSED_RGBA8_ETC2_EAC ? 16 : 8); // per 4x4 block
+
+  unsigned int w = width;
+  unsigned int h = height;
+  size_t offset = dataOffset;
 
+  levels.clear();
+
+  for (unsigned int i=0; i<numLevels; i++) {
+
+    uint32_t imageSize;
+
+    if (offset + 4 > fileSize)
+      break;
+
+    memcpy( &imageSize, ktxFile.data() + offset, 4 );
+
+    if (imageSize != (size_t) ((w+3)/4) * ((h+3)/4) * blockBytes || offset + 4 + imageSize > fileSize)
+      break;
+
+    MipLevel level;
+    level.width = w;
+    level.height = h;
+    level.offset = offset + 4;
+    level.size = imageSize;
+    levels.add( level );
+
+    offset += 4 + ((imageSize + 3) & ~3);
+
+    w = (w > 1 ? w/2 : 1);
+    h = (h > 1 ? h/2 : 1);
+  }
+
+  if ((unsigned int) levels.size() < numLevels) {
+    cerr << "Error loading '" << path << "': mipmap level " << levels.size() << " is missing or has the wrong size." << endl;
+    std::vector<unsigned char>().swap( ktxFile );
+    levels.clear();               // uploaded as an empty texture
+  }
+}
+
+
+// Whether OpenGL lists 'format' as a compressed texture format.  On
+// the GL thread.
+
+
+bool Texture::formatSupported( GLenum format )
+
+{
+  GLint n = 0;
+  glGetIntegerv( GL_NUM_COMPRESSED_TEXTURE_FORMATS, &n );
+
+  if (n <= 0)
+    return false;
+
+  GLint *formats = new GLint[n];
+  glGetIntegerv( GL_COMPRESSED_TEXTURE_FORMATS, formats );
+
+  bool found = false;
+  for (int i=0; i<n; i++)
+    if ((GLenum) formats[i] == format)
+      found = true;
+
+  delete [] formats;
+
+  return found;
+}
 
 
 // Find the texel at x,y for x,y in [0,width-1]x[0,height-1]
@@ -67,6 +456,11 @@ void Texture::loadTexture( string filename )
 vec3 Texture::texel( int x, int y, float &alpha )
 
 {
+  if (texmap == NULL || isCompressed) {
+    alpha = 1;
+    return vec3(0,0,0);
+  }
+
   if (x<0) x = 0;
   if (x>(int)width-1) x = width-1;
   if (y<0) y = 0;
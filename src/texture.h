@@ -1,4 +1,22 @@
 /* texture.h
+ *
+ * A texture from one of
+ *
+ *   - a PNG image.  It is decoded to RGBA if it has an alpha channel
+ *     or transparency, and to RGB otherwise.  OpenGL makes the mipmaps.
+ *
+ *   - a KTX (version 1) file of ETC2 compressed images, with the mipmap
+ *     levels made offline (e.g. by etc2comp or PVRTexTool).  The
+ *     levels are uploaded as they are, without decoding, so they take a
+ *     quarter (RGB) or half (RGBA) of the GPU memory of a PNG, and much
+ *     less time to load.  The formats are GL_COMPRESSED_RGB8_ETC2,
+ *     GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2,
+ *     GL_COMPRESSED_RGBA8_ETC2_EAC and GL_ETC1_RGB8_OES (which is
+ *     uploaded as RGB8_ETC2, of which it is a subset).
+ *
+ *     OpenGL ES 3.0 always has ETC2, but desktop OpenGL might not.  If
+ *     it doesn't, the PNG of the same name (e.g. "terrain.png" for
+ *     "terrain.ktx") is loaded instead.
  */
 
 
@@ -6,13 +24,44 @@
 #define TEXTURE_H
 
 #include "headers.h"
+#include "seq.h"
+
+#include <vector>
+
+
+#define KTX_HEADER_SIZE 64
+
+#ifndef GL_ETC1_RGB8_OES
+  #define GL_ETC1_RGB8_OES 0x8D64
+#endif
+
+
+class MipLevel {
+ public:
+  unsigned int width, height;
+  size_t       offset;          // in the file
+  size_t       size;            // in bytes
+};
+
 
 class Texture {
 
-  GLubyte *texmap; 
+  GLubyte *texmap;              // decoded PNG
+  string   path;                // basePath/name
+
+  // For a KTX file
+
+  bool          isCompressed;
+  GLenum        compressedFormat;
+  unsigned int  numLevels;
+  size_t        dataOffset;     // of the first level's image size
+  seq<MipLevel> levels;
+  std::vector<unsigned char> ktxFile; // until it is uploaded
 
   void registerWithOpenGL();
-  void loadTexture( string filename );
+  void loadTexture( std::vector<unsigned char> &file );
+  void loadKTX( std::vector<unsigned char> &file );
+  bool readKTXHeader( const unsigned char *header );
 
  public:
 
@@ -20,14 +69,57 @@ class Texture {
   GLuint textureID;
   unsigned int width, height;
   bool hasAlpha;
+  double loadSeconds;           // time to read and decode the file
+  double uploadSeconds;         // time in registerWithOpenGL()
+  size_t gpuBytes;              // including mipmaps
 
   static bool useMipMaps;
 
-  Texture() {}
+  Texture() {
+    texmap = NULL;
+    isCompressed = false;
+    textureID = 0;
+  }
+
+  ~Texture() {
+    free( texmap );
+    if (textureID != 0)
+      glDeleteTextures( 1, &textureID );
+  }
 
   Texture( string basePath, string filename ) {
-    name = filename;
-    loadTexture( basePath + string("/") + filename );
+    texmap = NULL;
+    textureID = 0;
+    if (readSize( basePath, filename ))
+      load();
+    registerWithOpenGL();
+  }
+
+  // To load on another thread, construct with Texture(), then
+  //
+  //   readSize()   sets the name and reads the width and height from the file header
+  //   load()       reads and decodes the image (needs no GL context)
+  //   upload()     registers the image with OpenGL (on the GL thread)
+  //
+  // readSize() of a KTX file checks that OpenGL has its format, so
+  // must also be called on the GL thread.  load(file) decodes a file
+  // that has already been read, and may take its contents.  A texture
+  // must be deleted on the GL thread once it has been uploaded.
+  //
+  // load() doesn't change width and height, so the GL thread can read
+  // them while it runs.  The decoded image must only be used after the
+  // loading thread says it's done (e.g. Terrain's 'loaded' flag).
+
+  bool readSize( string basePath, string filename );
+
+  void load();
+  void load( std::vector<unsigned char> &file );
+
+  string filePath() {
+    return path;
+  }
+
+  void upload() {
     registerWithOpenGL();
   }
 
@@ -41,6 +133,10 @@ class Texture {
       glDisable(GL_BLEND);
   }
 
+  static bool formatSupported( GLenum format );
+
+  // texel() is only for PNG images
+
   vec3 texel( int i, int j, float &alpha );
 };
 
@@ -0,0 +1,396 @@
+// textureCache.cpp
+
+
+#include "textureCache.h"
+#include "lodepng.h"
+
+#include <chrono>
+
+
+TextureCache textureCache;
+
+
+TextureCache::TextureCache()
+
+{
+  budget = (size_t) TEXTURE_CACHE_BUDGET_MB * 1024 * 1024;
+  residentBytes = 0;
+  releases = 0;
+
+  pathHits = contentHits = misses = evictions = 0;
+}
+
+
+// The path with symbolic links, "." and ".." resolved, so that one
+// file has one name.  Returns the path unchanged if the file doesn't
+// exist.
+
+
+static string canonicalPath( string path )
+
+{
+#ifdef _WIN32
+  char buffer[ _MAX_PATH ];
+  if (_fullpath( buffer, path.c_str(), sizeof(buffer) ) != NULL)
+    return string( buffer );
+#else
+  char *resolved = realpath( path.c_str(), NULL );
+  if (resolved != NULL) {
+    string s( resolved );
+    free( resolved );
+    return s;
+  }
+#endif
+
+  return path;
+}
+
+
+// FNV-1a over 8-byte words, with the high bits folded back in after
+// each word so that every byte affects the low bits
+
+
+static uint64_t hashBytes( const unsigned char *bytes, size_t n )
+
+{
+  uint64_t h = 14695981039346656037ULL;
+  size_t i = 0;
+
+  for (; i+8 <= n; i+=8) {
+    uint64_t w;
+    memcpy( &w, bytes+i, 8 );
+    h = (h ^ w) * 1099511628211ULL;
+    h ^= h >> 32;
+  }
+
+  for (; i<n; i++)
+    h = (h ^ bytes[i]) * 1099511628211ULL;
+
+  return h;
+}
+
+
+// Find a texture by its header and set up a handle to it.  Returns an
+// empty handle if the file can't be read.
+
+
+TextureHandle TextureCache::acquire( string basePath, string filename )
+
+{
+  TextureHandle h;
+
+  string path = canonicalPath( basePath + string("/") + filename );
+
+  struct stat info;
+  bool exists = (stat( path.c_str(), &info ) == 0);
+
+  {
+    std::lock_guard<std::mutex> l( lock );
+
+    int j;
+    TextureCacheEntry *e = findPath( path, j );
+
+    if (e != NULL) {
+
+      if (exists && info.st_size == e->paths[j].fileSize && info.st_mtime == e->paths[j].modified) {
+        pathHits++;
+        e->refs++;
+        h.entry = e;
+        return h;
+      }
+
+      forgetPath( path );       // the file has changed since it was loaded
+    }
+  }
+
+  // Not found.  The entry isn't in the cache until load() has checked
+  // its contents against the others.
+
+  Texture *texture = new Texture();
+
+  if (!texture->readSize( basePath, filename )) {
+    delete texture;
+    return h;
+  }
+
+  if (texture->filePath() != basePath + string("/") + filename) { // used a PNG instead of a KTX file
+    path = canonicalPath( texture->filePath() );
+    exists = (stat( path.c_str(), &info ) == 0);
+  }
+
+  TextureCachePath p;
+
+  p.path = path;
+  p.fileSize = (exists ? info.st_size : 0);
+  p.modified = (exists ? info.st_mtime : 0);
+
+  TextureCacheEntry *e = new TextureCacheEntry();
+
+  e->texture = texture;
+  e->paths.add( p );
+  e->size = 0;
+  e->hash = 0;
+  e->state = TEXTURE_NEW;
+  e->refs = 1;
+  e->lastReleased = 0;
+  e->listed = false;
+
+  h.entry = e;
+
+  return h;
+}
+
+
+// Read and decode the texture of a new handle.  If another texture has
+// the same contents, the handle is switched to it instead, and the new
+// handle's path (with its own size and time) is added to it.  If the
+// texture was found by acquire(), just wait until it's loaded.
+
+
+void TextureCache::load( TextureHandle &h )
+
+{
+  TextureCacheEntry *e = h.entry;
+
+  if (e == NULL)
+    return;
+
+  {
+    std::unique_lock<std::mutex> l( lock );
+
+    if (e->listed) {
+      loadedSignal.wait( l, [e] { return e->state >= TEXTURE_LOADED; } );
+      return;
+    }
+  }
+
+  auto startTime = std::chrono::steady_clock::now();
+
+  std::vector<unsigned char> file;
+
+  if (lodepng::load_file( file, e->texture->filePath() ) != 0)
+    file.clear();               // the decoder reports the error
+
+  uint64_t hash = hashBytes( file.data(), file.size() );
+
+  {
+    std::unique_lock<std::mutex> l( lock );
+
+    TextureCacheEntry *same = (file.size() > 0 ? findHash( hash, file.size() ) : NULL);
+
+    if (same != NULL) {
+
+      contentHits++;
+
+      int j;
+      if (findPath( e->paths[0].path, j ) == NULL)
+        same->paths.add( e->paths[0] );
+
+      same->refs++;
+      h.entry = same;           // under 'lock', and read by others only after load() returns
+
+      delete e->texture;        // never uploaded, so no GL call
+      delete e;
+
+      loadedSignal.wait( l, [same] { return same->state >= TEXTURE_LOADED; } );
+      return;
+    }
+
+    misses++;
+
+    e->hash = hash;
+    e->size = file.size();
+    e->state = TEXTURE_LOADING;
+    e->listed = true;
+    entries.add( e );
+  }
+
+  e->texture->load( file );
+  e->texture->loadSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - startTime ).count();
+
+  {
+    std::lock_guard<std::mutex> l( lock );
+    e->state = TEXTURE_LOADED;
+  }
+
+  loadedSignal.notify_all();
+}
+
+
+// Upload the handle's texture if it isn't already on the GPU, then
+// delete unused textures if over budget.  On the GL thread, after
+// load().
+
+
+void TextureCache::upload( TextureHandle &h )
+
+{
+  TextureCacheEntry *e = h.entry;
+
+  if (e == NULL || e->state == TEXTURE_UPLOADED)
+    return;
+
+  e->texture->upload();
+
+  std::lock_guard<std::mutex> l( lock );
+
+  e->state = TEXTURE_UPLOADED;
+  residentBytes += e->texture->gpuBytes;
+
+  evict();
+}
+
+
+// Delete the least recently released unused textures until within
+// budget.  Called with 'lock' held, on the GL thread.
+
+
+void TextureCache::evict()
+
+{
+  while (residentBytes > budget) {
+
+    int oldest = -1;
+
+    for (int i=0; i<entries.size(); i++)
+      if (entries[i]->refs == 0 && entries[i]->state == TEXTURE_UPLOADED &&
+          (oldest < 0 || entries[i]->lastReleased < entries[oldest]->lastReleased))
+        oldest = i;
+
+    if (oldest < 0)
+      return;                   // everything on the GPU is in use
+
+    TextureCacheEntry *e = entries[oldest];
+
+    residentBytes -= e->texture->gpuBytes;
+    evictions++;
+
+    entries.remove( oldest );
+
+    delete e->texture;
+    delete e;
+  }
+}
+
+
+// Find the entry with 'path', and set 'index' to the path's index in
+// the entry
+
+
+TextureCacheEntry *TextureCache::findPath( string &path, int &index )
+
+{
+  for (int i=0; i<entries.size(); i++)
+    for (int j=0; j<entries[i]->paths.size(); j++)
+      if (entries[i]->paths[j].path == path) {
+        index = j;
+        return entries[i];
+      }
+
+  return NULL;
+}
+
+
+TextureCacheEntry *TextureCache::findHash( uint64_t hash, off_t size )
+
+{
+  for (int i=0; i<entries.size(); i++)
+    if (entries[i]->hash == hash && entries[i]->size == size)
+      return entries[i];
+
+  return NULL;
+}
+
+
+void TextureCache::forgetPath( string &path )
+
+{
+  for (int i=0; i<entries.size(); i++)
+    for (int j=0; j<entries[i]->paths.size(); j++)
+      if (entries[i]->paths[j].path == path) {
+        entries[i]->paths.remove( j );
+        return;
+      }
+}
+
+
+void TextureCache::addRef( TextureCacheEntry *e )
+
+{
+  std::lock_guard<std::mutex> l( lock );
+  e->refs++;
+}
+
+
+// Drop a reference.  A texture that was never loaded is deleted right
+// away.  Others stay until evicted.
+
+
+void TextureCache::release( TextureCacheEntry *e )
+
+{
+  std::lock_guard<std::mutex> l( lock );
+
+  e->refs--;
+
+  if (e->refs > 0)
+    return;
+
+  e->lastReleased = ++releases;
+
+  if (!e->listed) {
+    delete e->texture;
+    delete e;
+  } else
+    evict();
+}
+
+
+void TextureCache::stats( char *buffer, int size )
+
+{
+  std::lock_guard<std::mutex> l( lock );
+
+  int numInUse = 0;
+  for (int i=0; i<entries.size(); i++)
+    if (entries[i]->refs > 0)
+      numInUse++;
+
+  snprintf( buffer, size, "textures %d (%d in use)  %.1f of %.0f MB on GPU  %ld path hits  %ld content hits  %ld misses  %ld evictions",
+            entries.size(), numInUse, residentBytes / (1024.0 * 1024.0), budget / (1024.0 * 1024.0),
+            pathHits, contentHits, misses, evictions );
+}
+
+
+
+TextureHandle::TextureHandle( const TextureHandle &h )
+
+{
+  entry = h.entry;
+
+  if (entry != NULL)
+    textureCache.addRef( entry );
+}
+
+
+TextureHandle::~TextureHandle()
+
+{
+  if (entry != NULL)
+    textureCache.release( entry );
+}
+
+
+TextureHandle &TextureHandle::operator=( const TextureHandle &h )
+
+{
+  if (h.entry != NULL)
+    textureCache.addRef( h.entry );
+
+  if (entry != NULL)
+    textureCache.release( entry );
+
+  entry = h.entry;
+
+  return *this;
+}
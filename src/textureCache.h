@@ -0,0 +1,148 @@
+/* textureCache.h
+ *
+ * Textures shared by everything that uses them, so that an image used
+ * twice (or again after a terrain is reloaded) is decoded and uploaded
+ * once.
+ *
+ * acquire() returns a TextureHandle, which counts as a reference to
+ * the texture until it is destroyed or reassigned.  Textures are
+ * found
+ *
+ *   - by canonical path, if the file's size and modification time
+ *     haven't changed since that path was loaded, without reading the
+ *     file, or
+ *
+ *   - by a hash of the file contents, so that the same image under
+ *     another name is loaded once.
+ *
+ * A texture is loaded in three steps, as for Texture:
+ *
+ *   acquire()   on the GL thread.  Reads the file header.
+ *   load()      on any thread.  Reads and decodes the file, unless it
+ *               is already loaded.
+ *   upload()    on the GL thread.  Uploads it, unless it is already
+ *               on the GPU.
+ *
+ * load() may switch the handle to another texture with the same
+ * contents, so the three steps must be done on the same handle before
+ * it is copied.  The switch is made with the cache locked, and other
+ * threads must not use the handle until load() has returned (e.g.
+ * Terrain waits for its 'loaded' flag).
+ *
+ * A texture with no references stays on the GPU, to be found by a
+ * later acquire(), until the GPU memory of all textures exceeds the
+ * budget.  The least recently released ones are deleted first.
+ * Textures that are in use are never deleted, so the budget can be
+ * exceeded.  Since releasing a handle can delete a texture, handles
+ * must be released on the GL thread.
+ */
+
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "headers.h"
+#include "texture.h"
+#include "seq.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <sys/stat.h>
+
+
+#define TEXTURE_CACHE_BUDGET_MB 256   // default; set with -texmem
+
+
+enum TextureEntryState {
+  TEXTURE_NEW,                  // header read
+  TEXTURE_LOADING,
+  TEXTURE_LOADED,               // decoded (or failed to)
+  TEXTURE_UPLOADED
+};
+
+
+// A name of a texture file, with the file's size and modification
+// time when it was found
+
+class TextureCachePath {
+ public:
+  string path;                  // canonical
+  off_t  fileSize;
+  time_t modified;
+};
+
+
+class TextureCacheEntry {
+ public:
+  Texture          *texture;
+  seq<TextureCachePath> paths;  // files with these contents
+  off_t             size;       // of the file contents
+  uint64_t          hash;       // of the file contents
+  TextureEntryState state;
+  int               refs;
+  long              lastReleased;
+  bool              listed;     // in the cache (false until load() has hashed it)
+};
+
+
+class TextureHandle {
+
+  TextureCacheEntry *entry;
+
+  friend class TextureCache;
+
+ public:
+
+  TextureHandle() { entry = NULL; }
+  TextureHandle( const TextureHandle &h );
+  ~TextureHandle();
+
+  TextureHandle &operator=( const TextureHandle &h );
+
+  Texture *operator->() { return entry->texture; }
+  Texture *get()        { return (entry != NULL ? entry->texture : NULL); }
+  operator bool() const { return entry != NULL; }
+};
+
+
+class TextureCache {
+
+  std::mutex    lock;
+  std::condition_variable loadedSignal;
+
+  seq<TextureCacheEntry*> entries;
+
+  size_t        budget;
+  size_t        residentBytes;
+  long          releases;       // counts release() calls, for LRU
+
+  long          pathHits, contentHits, misses, evictions;
+
+  TextureCacheEntry *findPath( string &path, int &index );
+  TextureCacheEntry *findHash( uint64_t hash, off_t size );
+  void forgetPath( string &path );
+  void evict();
+
+  friend class TextureHandle;
+  void addRef( TextureCacheEntry *e );
+  void release( TextureCacheEntry *e );
+
+ public:
+
+  TextureCache();
+
+  TextureHandle acquire( string basePath, string filename );
+  void load( TextureHandle &h );
+  void upload( TextureHandle &h );
+
+  void setBudget( size_t bytes ) {
+    budget = bytes;
+  }
+
+  void stats( char *buffer, int size );
+};
+
+
+extern TextureCache textureCache;
+
+#endif
@@ -4,13 +4,27 @@
 #include "main.h"
 #include "linalg.h"
 #include "spline.h"
+#include "profiler.h"
 
 
 #define SPHERE_RADIUS 5.0
 #define SPHERE_COLOUR 238/255.0, 106/255.0, 20/255.0
 
-float velocity = 70;
-float acceleration;
+
+// Model transformations of the cars and couplings, from the cylinder
+// model to a car lying along x.  These are built at compile time.
+
+static constexpr mat4 CAR_UPRIGHT  = compose( constRotate( 1.5, vec3(1,0,0) ), constRotate( 1.5, vec3(0,1,0) ) );
+static constexpr mat4 CAR_BODY     = compose( scale( 7, 4, 4 ), CAR_UPRIGHT );
+static constexpr mat4 CAR_COUPLING = compose( scale( 3, 1.3f, 1.3f ), CAR_UPRIGHT );
+
+
+const char * Train::physicsNames[] = {
+  "simple",
+  "energy",
+  "coupled"
+};
+
 
 // Draw the train.
 //
@@ -20,16 +34,20 @@ float acceleration;
 void Train::draw( mat4 &WCStoVCS, mat4 &WCStoCCS, vec3 lightDir, bool flag )
 
 {
+  PROFILE_GPU_SCOPE( "Train::draw" );
+
 #if 1
 
   // YOUR CODE HERE
-  float t = spline->paramAtArcLength( pos );
+  float length = spline->totalArcLength();
+
+  float t = spline->paramAtArcLength( cars[0].s );
   
   // Draw sphere
   vec3 o, x, y, z;
   spline->findLocalSystem( t, o, x, y, z );
 
-  mat4 T = translate(0, 0, 8);
+  constexpr mat4 T = translate(0, 0, 8);
 
   mat4 M   = translate( o ) * T *  scale( 5, 5, 5 );
   mat4 MV  = WCStoVCS * M;
@@ -37,42 +55,34 @@ void Train::draw( mat4 &WCStoVCS, mat4 &WCStoCCS, vec3 lightDir, bool flag )
 
   sphere->draw( MV, MVP, lightDir, vec3( SPHERE_COLOUR ) );
 
-  //draw 4 cylinders behind the first sphere
-for (int i = 1; i < 5; i++) {
-  float offset = float(i*-10);
-  float currentPos = fmod(pos + spline->totalArcLength() + offset, spline->totalArcLength());
-  float t = spline->paramAtArcLength( currentPos );
+  //draw the cars behind the first sphere, each at its own position on the track
+for (int i = 1; i < numCars; i++) {
+  float t = spline->paramAtArcLength( cars[i].s );
   vec3 o, x, y, z;
   spline->findLocalSystem( t, o, x, y, z );
 
-  //for small bouncing
-  float num = sin(2.0f * M_PI * currentPos / spline->totalArcLength());
-  float check = (int)((num+i)*10)% 3;
-  if(check == 0) {
-    o.z += 0.4;
-  }else {
-    o.z -= 0.4;
-  }
-
   vec3 axis = vec3(1,0,0) ^ z;
   float angle = atan2( axis.length(), vec3(1,0,0)*z );
 
   //translation matrix to move them slighllty in the world y direction
-  mat4 M   = translate( o ) * T * rotate(angle,axis)  * scale( 7, 4, 4) * rotate(1.5, vec3(1, 0, 0)) * rotate(1.5, vec3(0, 1, 0));
+  mat4 M   = translate( o ) * T * rotate(angle,axis) * CAR_BODY;
   mat4 MV  = WCStoVCS * M;
   mat4 MVP = WCStoCCS * M;
 
   cylinder->draw( MV, MVP, lightDir, vec3( SPHERE_COLOUR ) );
 
-
-  float currentPos2 = fmod(pos + spline->totalArcLength()+offset+5, spline->totalArcLength());
+  //draw the coupling halfway to the car ahead
+  float gap = cars[i-1].s - cars[i].s;
+  if (gap < -length/2)
+    gap += length;
+  float currentPos2 = fmod(cars[i].s + 0.5*gap + length, length);
   float t2 = spline->paramAtArcLength( currentPos2 );
   vec3 o2, x2, y2, z2;
   spline->findLocalSystem( t2, o2, x2, y2, z2 );
 
   //draw connecitng pieces
-  mat4 T2 = translate(0, -1, 8);
-  mat4 rectangleM = translate(o2) * T2 * rotate(angle, axis) * scale(3, 1.3f, 1.3f)*  rotate(1.5, vec3(1, 0, 0)) * rotate(1.5, vec3(0, 1, 0)); 
+  constexpr mat4 T2 = translate(0, -1, 8);
+  mat4 rectangleM = translate(o2) * T2 * rotate(angle, axis) * CAR_COUPLING;
   mat4 rectangleMV = WCStoVCS * rectangleM;
   mat4 rectangleMVP = WCStoCCS * rectangleM;
 
@@ -107,11 +117,46 @@ float dot(vec3 a, vec3 b) {
 
 void Train::advance( float elapsedSeconds )
 {
+  PROFILE_SCOPE( "Train::advance" );
+
 #if 1
 
   // YOUR CODE HERE
   float arcLength = spline->totalArcLength();
 
+  if (physics == ENERGY_PHYSICS) {
+
+    // Speed comes from the precomputed energy profile
+
+    speed = speedProfile()->speedAt( pos );
+
+    pos = fmod( pos + speed * elapsedSeconds, arcLength );
+    placeCarsBehind( pos, speed );
+    return;
+  }
+
+  if (physics == COUPLED_PHYSICS) {
+
+    // Integrate the coupled cars in fixed substeps.  Any leftover
+    // time is carried over to the next call.
+
+    speedProfile();             // make sure the slope table is current
+
+    if (elapsedSeconds > MAX_FRAME_TIME)
+      elapsedSeconds = MAX_FRAME_TIME;
+
+    unsimulatedTime += elapsedSeconds;
+
+    while (unsimulatedTime >= SUBSTEP) {
+      step( SUBSTEP );
+      unsimulatedTime -= SUBSTEP;
+    }
+
+    pos = cars[0].s;
+    speed = cars[0].v;
+    return;
+  }
+
   //check projection of trains' local x onto world z to calculate the angle its facing and adjust speed based on magnitude of that projection
   float magSum = 0;
   for (int i = 0; i < 5; i++) {
@@ -127,7 +172,7 @@ void Train::advance( float elapsedSeconds )
   // float angle = anglesSum / 5;
 
   //update speed based on the magnitude of the angle
-  acceleration = magnitude * 0.8;
+  float acceleration = magnitude * 0.8;
 
   if (velocity + acceleration < 35) {
     velocity = 35;
@@ -151,6 +196,8 @@ void Train::advance( float elapsedSeconds )
     pos = 0;
   }
 
+  placeCarsBehind( pos, velocity );
+
 
 #else
 
@@ -159,3 +206,158 @@ void Train::advance( float elapsedSeconds )
 
 #endif
 }
+
+
+// Advance the coupled cars by time h.
+//
+// Each car is a point mass moving along the track under gravity,
+// friction, air drag and the chain lift.  Adjacent cars are joined by
+// a spring-damper coupling with rest length CAR_SPACING.
+//
+// This uses semi-implicit (symplectic) Euler: velocities are updated
+// from the forces first, then positions are updated with the *new*
+// velocities.  That stays stable for the stiff couplings at SUBSTEP,
+// unlike explicit Euler.
+
+
+void Train::step( float h )
+
+{
+  float length = profile.totalLength();
+
+  if (length <= 0)
+    return;
+
+  float g = profile.gravity;
+  float friction = profile.friction * g;
+  float minSpeed = profile.minSpeed;
+
+  float accel[ MAX_NUM_CARS ];
+
+  // forces on each car from the track and air
+
+  for (int i=0; i<numCars; i++) {
+
+    float v = cars[i].v;
+    float a = -g * profile.slopeAt( cars[i].s ) - profile.drag * v * fabs(v);
+
+    if (v > 0)
+      a -= friction;
+    else if (v < 0)
+      a += friction;
+
+    if (v < minSpeed)
+      a += CHAIN_LIFT_GAIN * (minSpeed - v);
+
+    accel[i] = a;
+  }
+
+  // forces from the coupling between car i-1 and car i
+
+  for (int i=1; i<numCars; i++) {
+
+    float gap = cars[i-1].s - cars[i].s;
+    if (gap < -length/2)
+      gap += length;
+    else if (gap > length/2)
+      gap -= length;
+
+    float f = COUPLING_STIFFNESS * (gap - CAR_SPACING) + COUPLING_DAMPING * (cars[i-1].v - cars[i].v);
+
+    accel[i]   += f;
+    accel[i-1] -= f;
+  }
+
+  // semi-implicit Euler update
+
+  for (int i=0; i<numCars; i++) {
+
+    cars[i].v += accel[i] * h;
+    cars[i].s += cars[i].v * h;
+
+    if (cars[i].s >= length)
+      cars[i].s -= length;
+    else if (cars[i].s < 0)
+      cars[i].s += length;
+  }
+}
+
+
+// Put the cars at rest length behind a front car at 'frontPos', all
+// moving at 'frontSpeed'.
+
+
+void Train::placeCarsBehind( float frontPos, float frontSpeed )
+
+{
+  float length = spline->totalArcLength();
+
+  for (int i=0; i<numCars; i++) {
+    float s = frontPos - i * CAR_SPACING;
+    if (length > 0) {
+      s = fmod( s, length );
+      if (s < 0)
+        s += length;
+    }
+    cars[i].s = s;
+    cars[i].v = frontSpeed;
+  }
+}
+
+
+void Train::setNumCars( int n )
+
+{
+  if (n < 1)
+    n = 1;
+  if (n > MAX_NUM_CARS)
+    n = MAX_NUM_CARS;
+
+  // New cars are added at rest length behind the last car
+
+  float length = spline->totalArcLength();
+
+  for (int i=numCars; i<n; i++) {
+    float s = cars[i-1].s - CAR_SPACING;
+    if (length > 0 && s < 0)
+      s += length;
+    cars[i].s = s;
+    cars[i].v = cars[i-1].v;
+  }
+
+  numCars = n;
+}
+
+
+// A checksum of the complete simulation state of the train.  Two
+// runs that give the same checksum are (with high probability)
+// bit-for-bit identical.
+
+
+unsigned int Train::stateChecksum()
+
+{
+  unsigned int hash = 2166136261u; // FNV-1a
+
+  float state[] = { pos, speed, velocity, unsimulatedTime, profile.initialSpeed, (float) numCars, (float) physics };
+
+  hashBytes( hash, state, sizeof(state) );
+  hashBytes( hash, cars, numCars * sizeof(TrainCar) );
+
+  for (int i=0; i<spline->data.size(); i++)
+    hashBytes( hash, &spline->data[i], sizeof(vec3) );
+
+  return hash;
+}
+
+
+void Train::hashBytes( unsigned int &hash, const void *data, int numBytes )
+
+{
+  const unsigned char *p = (const unsigned char *) data;
+
+  for (int i=0; i<numBytes; i++) {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+}
@@ -5,29 +5,71 @@
 
 #include "headers.h"
 #include "spline.h"
+#include "speedProfile.h"
 
 
 #define SPEED_INC 0.5
 
+#define DEFAULT_NUM_CARS   5
+#define MAX_NUM_CARS       100
+#define CAR_SPACING        10      // rest length of the coupling between cars
+#define COUPLING_STIFFNESS 400     // spring constant of a coupling (per unit mass)
+#define COUPLING_DAMPING   20      // damping constant of a coupling (per unit mass)
+#define CHAIN_LIFT_GAIN    2       // how quickly the chain lift restores minSpeed
+#define SUBSTEP            (1/480.0) // integration step for COUPLED_PHYSICS
+#define MAX_FRAME_TIME     0.1     // longest elapsed time simulated in one advance()
+
+
+// Physical models used to move the train
+
+enum PhysicsModel { SIMPLE_PHYSICS, ENERGY_PHYSICS, COUPLED_PHYSICS, NUM_PHYSICS_MODELS };
+
+
+// One car of the train, treated as a point mass on the track
+
+class TrainCar {
+ public:
+  float s;                      // arc length position on the spline
+  float v;                      // speed along the spline
+};
+
 
 class Train {
 
+  static const char * physicsNames[];
+
   Spline *spline;
 
   // state
 
   float pos;                    // position on spline
   float speed;
+  float velocity;               // speed in SIMPLE_PHYSICS
 
   float mass;
 
+  PhysicsModel physics;
+  SpeedProfile profile;         // speed vs. arc length for ENERGY_PHYSICS
+
+  TrainCar cars[ MAX_NUM_CARS ]; // cars[0] is at the front
+  int      numCars;
+  float    unsimulatedTime;     // elapsed time not yet covered by a SUBSTEP
+
+  void placeCarsBehind( float frontPos, float frontSpeed );
+  static void hashBytes( unsigned int &hash, const void *data, int numBytes );
+
  public:
 
   Train( Spline *spl ) {
     spline = spl;
     pos = 0;
     speed = 70;
+    velocity = 70;
     mass = 1;
+    physics = SIMPLE_PHYSICS;
+    numCars = DEFAULT_NUM_CARS;
+    unsimulatedTime = 0;
+    placeCarsBehind( pos, speed );
   }
   
   void draw( mat4 &WCStoVCS, mat4 &WCStoCCS, vec3 lightDir, bool flag ); 
@@ -39,15 +81,66 @@ class Train {
 
   void accelerate() {
     speed += SPEED_INC;
+    profile.initialSpeed += SPEED_INC;
+    profile.invalidate();
   }
 
   void brake() {
     speed -= SPEED_INC;
+    profile.initialSpeed -= SPEED_INC;
+    profile.invalidate();
+  }
+
+  // Losses to rolling friction and air drag (from the scene file,
+  // where negative means the default), used by the speed profile and
+  // COUPLED_PHYSICS
+
+  void setLosses( float friction, float drag ) {
+    profile.setLosses( friction, drag );
+  }
+
+  float getFriction() {
+    return profile.friction;
+  }
+
+  float getDrag() {
+    return profile.drag;
+  }
+
+  void step( float h );          // one integration step of COUPLED_PHYSICS
+
+  void nextPhysicsModel() {
+    physics = (PhysicsModel) ((physics+1) % NUM_PHYSICS_MODELS);
+    placeCarsBehind( pos, speed );
+  }
+
+  int getNumCars() {
+    return numCars;
+  }
+
+  void setNumCars( int n );
+
+  PhysicsModel getPhysicsModel() {
+    return physics;
+  }
+
+  const char *physicsName() {
+    return physicsNames[ physics ];
+  }
+
+  // The speed table, rebuilt if the track has changed
+
+  SpeedProfile *speedProfile() {
+    if (profile.isStale( spline ))
+      profile.compute( spline );
+    return &profile;
   }
 
   float getPos() {
     return pos;
   }
+
+  unsigned int stateChecksum();
 };
 
 